@@ -0,0 +1,46 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Preloaded into the parsers the benchmark runs (LD_PRELOAD): counts the
+// calls to malloc, calloc and realloc and writes the number to the file
+// descriptor in BENCH_ALLOC_FD when the process exits. The blocks come from
+// the allocator of the C library as they would without it.
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static long allocs;
+
+void *malloc(size_t size)
+{
+  __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size)
+{
+  __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void alloc_count_report()
+{
+  const char *fd = getenv("BENCH_ALLOC_FD");
+  char buf[32];
+  int len;
+
+  if (fd == NULL)
+    return;
+  len = snprintf(buf, sizeof(buf), "%ld\n",
+      __atomic_load_n(&allocs, __ATOMIC_RELAXED));
+  write(atoi(fd), buf, len);
+}
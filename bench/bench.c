@@ -0,0 +1,352 @@
+#define _GNU_SOURCE // for pipe2
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h> // for PATH_MAX
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h> // for clock_gettime
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+#include "corpus.h"
+
+// Runs every parser of the repository on the same inputs and prints one
+// table with the throughput, the allocations, the latency per input and
+// the peak memory of each parser on each kind of input.
+//
+// Every input is parsed by a process of its own, the way the parsers are
+// used from the command line, with the input on stdin and a single lexer
+// thread. The time and the allocations it takes to start a parser and parse
+// a single number are measured first and taken off the throughput, so
+// tokens/s is about parsing; the latencies are of the whole process.
+
+static Engine engines[] = {
+  {"top_down", {"top_down/parser", "top_down/grammar", NULL}, 1,
+    VERDICT_EXIT},
+  {"bot_up_naive", {"bot_up_naive/parser", "bot_up_naive/grammar", NULL}, 0,
+    VERDICT_STDOUT},
+  {"bot_up_lr1", {"bot_up_lr1/parser", "-j", "1", "bot_up_lr1/grammar.math",
+    NULL}, 0, VERDICT_STDOUT},
+};
+#define NUM_ENGINES (int)(sizeof(engines) / sizeof(Engine))
+
+
+static void usage()
+{
+  fprintf(stderr, "Usage: bench [-R repository] [-n inputs] [-l long_inputs] "
+      "[-s scale] [-t timeout]\n"
+      "             [-r seed] [engine...]\n");
+  exit(1);
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parse the 'len' bytes of 'in' with a new process of the engine. The input
+// is put into the file 'in_fd' which becomes its stdin, its output is read
+// through a pipe and only the end of it is kept.
+static Run run(Engine *e, int in_fd, const char *in, long len,
+    const char *counter, int timeout)
+{
+  char tail[BENCH_TAIL_LEN + 1], buf[BENCH_READ_LEN], fd_env[16];
+  int out_pipe[2], alloc_pipe[2], status;
+  long tail_len = 0, n;
+  struct rusage ru;
+  double start;
+  pid_t pid;
+  Run out;
+
+  if (ftruncate(in_fd, 0) < 0 || pwrite(in_fd, in, len, 0) != len) {
+    perror("input file");
+    exit(1);
+  }
+  lseek(in_fd, 0, SEEK_SET);
+  if (pipe2(out_pipe, O_CLOEXEC) < 0 || pipe2(alloc_pipe, O_CLOEXEC) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  start = seconds();
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(in_fd, 0);
+    dup2(out_pipe[1], 1);
+    dup2(null_fd, 2);
+    dup2(alloc_pipe[1], BENCH_ALLOC_FD);
+    if (counter != NULL) {
+      snprintf(fd_env, sizeof(fd_env), "%d", BENCH_ALLOC_FD);
+      setenv("BENCH_ALLOC_FD", fd_env, 1);
+      setenv("LD_PRELOAD", counter, 1);
+    }
+    // an alarm outlives exec, the parser is killed when it goes off
+    alarm(timeout);
+    execv(e->argv[0], (char **)e->argv);
+    _exit(127);
+  }
+  close(out_pipe[1]);
+  close(alloc_pipe[1]);
+
+  while ((n = read(out_pipe[0], buf, sizeof(buf))) > 0) {
+    if (n >= BENCH_TAIL_LEN) {
+      memcpy(tail, buf + n - BENCH_TAIL_LEN, BENCH_TAIL_LEN);
+      tail_len = BENCH_TAIL_LEN;
+    } else {
+      if (tail_len + n > BENCH_TAIL_LEN) {
+        memmove(tail, tail + tail_len + n - BENCH_TAIL_LEN,
+            BENCH_TAIL_LEN - n);
+        tail_len = BENCH_TAIL_LEN - n;
+      }
+      memcpy(tail + tail_len, buf, n);
+      tail_len += n;
+    }
+  }
+  tail[tail_len] = '\0';
+  wait4(pid, &status, 0, &ru);
+  out.seconds = seconds() - start;
+  out.max_rss_kb = ru.ru_maxrss;
+
+  n = read(alloc_pipe[0], buf, sizeof(buf) - 1);
+  buf[(n > 0) ? n : 0] = '\0';
+  out.allocs = (n > 0) ? atol(buf) : -1;
+  close(out_pipe[0]);
+  close(alloc_pipe[0]);
+
+  if (WIFSIGNALED(status)) {
+    out.status = (WTERMSIG(status) == SIGALRM) ? RUN_TIMEOUT : RUN_CRASH;
+  } else if (e->verdict == VERDICT_EXIT) {
+    out.status = (WEXITSTATUS(status) == 0) ? RUN_ACCEPT :
+      (WEXITSTATUS(status) == 1) ? RUN_REJECT : RUN_CRASH;
+  } else if (strstr(tail, "Grammar correct\n") != NULL) {
+    out.status = RUN_ACCEPT;
+  } else if (strstr(tail, "Grammar incorrect\n") != NULL) {
+    out.status = RUN_REJECT;
+  } else {
+    out.status = RUN_CRASH;
+  }
+  return out;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+static int long_cmp(const void *a, const void *b)
+{
+  long x = *(long *)a, y = *(long *)b;
+  return (x > y) - (x < y);
+}
+
+// the median time and allocations of starting the engine and parsing a
+// single number, returns 0 if it can't do that
+static int startup(Engine *e, int in_fd, const char *counter, int timeout,
+    double *seconds_out, long *allocs_out)
+{
+  double times[BENCH_STARTUP_RUNS];
+  long allocs[BENCH_STARTUP_RUNS];
+  const char *in = e->num_as_n ? "n\n" : "1\n";
+  Run r;
+
+  for (int i = 0; i < BENCH_STARTUP_RUNS; i++) {
+    r = run(e, in_fd, in, strlen(in), counter, timeout);
+    if (r.status != RUN_ACCEPT)
+      return 0;
+    times[i] = r.seconds;
+    allocs[i] = r.allocs;
+  }
+  qsort(times, BENCH_STARTUP_RUNS, sizeof(double), double_cmp);
+  qsort(allocs, BENCH_STARTUP_RUNS, sizeof(long), long_cmp);
+  *seconds_out = times[BENCH_STARTUP_RUNS / 2];
+  *allocs_out = allocs[BENCH_STARTUP_RUNS / 2];
+  return 1;
+}
+
+static BenchRow bench_set(Engine *e, CorpusSet *set, int in_fd,
+    const char *counter, int timeout)
+{
+  BenchRow out = {0, 0, 0, 0, 0.0, 0, NULL, 0};
+  int done = 0;
+  char *text;
+  long len;
+  Run r;
+
+  out.latencies = malloc(set->size * sizeof(double));
+  for (int i = 0; i < set->size; i++) {
+    text = Corpus_render(&set->inputs[i], e->num_as_n, &len);
+    r = run(e, in_fd, text, len, counter, timeout);
+    free(text);
+
+    if (r.max_rss_kb > out.max_rss_kb)
+      out.max_rss_kb = r.max_rss_kb;
+    if (r.status == RUN_TIMEOUT || r.status == RUN_CRASH) {
+      out.failed++;
+      continue;
+    }
+    if ((r.status == RUN_ACCEPT) == set->inputs[i].valid)
+      out.ok++;
+    else
+      out.wrong++;
+    out.toks += set->inputs[i].len;
+    out.seconds += r.seconds;
+    out.allocs = (out.allocs < 0 || r.allocs < 0) ? -1 : out.allocs + r.allocs;
+    out.latencies[done++] = r.seconds;
+  }
+  qsort(out.latencies, done, sizeof(double), double_cmp);
+  return out;
+}
+
+static void print_row(Engine *e, CorpusSet *set, BenchRow *row,
+    double start_seconds, long start_allocs)
+{
+  int done = row->ok + row->wrong;
+  // what is left once starting the process is taken off, too little work
+  // to tell apart from that is left out
+  double net = row->seconds - done * start_seconds;
+
+  printf("%-13s %-10s %6d %9ld %6d %6d %6d", e->name, set->name, set->size,
+      set->num_toks, row->ok, row->wrong, row->failed);
+  if (done > 0 && net > 0) {
+    printf(" %11.0f %9.1f", row->toks / net, net * 1e9 / row->toks);
+  } else {
+    printf(" %11s %9s", "-", "-");
+  }
+  if (done > 0 && row->allocs >= 0 && start_allocs >= 0 &&
+      row->allocs > done * start_allocs) {
+    printf(" %10.2f", (double)(row->allocs - done * start_allocs) /
+        row->toks);
+  } else {
+    printf(" %10s", "-");
+  }
+  if (done > 0) {
+    printf(" %9.2f %9.2f", row->latencies[done / 2] * 1e3,
+        row->latencies[done * 99 / 100] * 1e3);
+  } else {
+    printf(" %9s %9s", "-", "-");
+  }
+  printf(" %8.1f\n", row->max_rss_kb / 1024.0);
+  fflush(stdout);
+}
+
+static int selected(Engine *e, char **names, int num_names)
+{
+  for (int i = 0; i < num_names; i++) {
+    if (strcmp(e->name, names[i]) == 0)
+      return 1;
+  }
+  return num_names == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  const char *repo = "..";
+  int num = BENCH_NUM_SHORT, num_long = BENCH_NUM_LONG, timeout = BENCH_TIMEOUT;
+  double scale = 1.0;
+  unsigned seed = 1;
+  char counter_path[PATH_MAX], in_path[] = "/tmp/bench_input.XXXXXX";
+  const char *counter = NULL;
+  CorpusSet *sets[4];
+  double start_seconds;
+  long start_allocs;
+  int in_fd;
+
+  while ((opt = getopt(argc, argv, "R:n:l:s:t:r:")) != -1) {
+    switch (opt) {
+      case 'R':
+        repo = optarg;
+        break;
+      case 'n':
+        num = atoi(optarg);
+        break;
+      case 'l':
+        num_long = atoi(optarg);
+        break;
+      case 's':
+        scale = atof(optarg);
+        break;
+      case 't':
+        timeout = atoi(optarg);
+        break;
+      case 'r':
+        seed = strtoul(optarg, NULL, 10);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (num < 1 || num_long < 1 || scale <= 0 || timeout < 1 || seed == 0)
+    usage();
+  for (int i = optind; i < argc; i++) {
+    int found = 0;
+    for (int e = 0; e < NUM_ENGINES; e++)
+      found |= (strcmp(engines[e].name, argv[i]) == 0);
+    if (!found) {
+      fprintf(stderr, "error: no engine '%s'\n", argv[i]);
+      usage();
+    }
+  }
+
+  // the counter is next to the benchmark, the parsers are run from the
+  // repository
+  if (realpath("alloc_count.so", counter_path) != NULL)
+    counter = counter_path;
+  else
+    fprintf(stderr, "warning: alloc_count.so not found, no allocations\n");
+  if (chdir(repo) < 0) {
+    perror(repo);
+    return 1;
+  }
+  if ((in_fd = mkstemp(in_path)) < 0) {
+    perror(in_path);
+    return 1;
+  }
+  unlink(in_path);
+
+  sets[0] = Corpus_short(num, BENCH_SHORT_LEN, &seed);
+  sets[1] = Corpus_flat(num_long, BENCH_FLAT_LEN * scale, &seed);
+  sets[2] = Corpus_nested(num_long, BENCH_NESTED_DEPTH * scale, &seed);
+  sets[3] = Corpus_near_miss(num, BENCH_SHORT_LEN, &seed);
+
+  printf("%-13s %-10s %6s %9s %6s %6s %6s %11s %9s %10s %9s %9s %8s\n",
+      "engine", "corpus", "inputs", "tokens", "ok", "wrong", "failed",
+      "tokens/s", "ns/token", "allocs/tok", "p50 ms", "p99 ms", "peak MB");
+  for (int e = 0; e < NUM_ENGINES; e++) {
+    if (!selected(&engines[e], argv + optind, argc - optind))
+      continue;
+    if (access(engines[e].argv[0], X_OK) < 0) {
+      fprintf(stderr, "%s: %s not built, skipped\n", engines[e].name,
+          engines[e].argv[0]);
+      continue;
+    }
+    if (!startup(&engines[e], in_fd, counter, timeout, &start_seconds,
+          &start_allocs)) {
+      fprintf(stderr, "%s: can't parse a single number, skipped\n",
+          engines[e].name);
+      continue;
+    }
+    fprintf(stderr, "%s: %.2f ms and %ld allocations to start and parse one "
+        "number\n", engines[e].name, start_seconds * 1e3, start_allocs);
+
+    for (int s = 0; s < 4; s++) {
+      BenchRow row = bench_set(&engines[e], sets[s], in_fd, counter, timeout);
+      print_row(&engines[e], sets[s], &row, start_seconds, start_allocs);
+      free(row.latencies);
+    }
+  }
+
+  for (int s = 0; s < 4; s++)
+    Corpus_free(sets[s]);
+  close(in_fd);
+}
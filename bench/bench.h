@@ -0,0 +1,59 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#define BENCH_MAX_ARGS 8
+#define BENCH_TAIL_LEN 64 // of the output, where the verdict is
+#define BENCH_READ_LEN (64 << 10)
+#define BENCH_ALLOC_FD 3 // the preloaded counter writes to it
+#define BENCH_STARTUP_RUNS 11
+
+// defaults of the options
+#define BENCH_NUM_SHORT 500 // short and near-miss inputs
+#define BENCH_NUM_LONG 10 // flat and nested inputs
+#define BENCH_SHORT_LEN 40 // tokens at most
+#define BENCH_FLAT_LEN 20000 // tokens, times the scale
+#define BENCH_NESTED_DEPTH 2000 // bracket pairs, times the scale
+#define BENCH_TIMEOUT 10 // seconds per input
+
+// how a parser says whether the input is correct
+typedef enum _Verdict {
+  VERDICT_EXIT, // exit status 0 or 1
+  VERDICT_STDOUT // the last line is 'Grammar correct' or 'Grammar incorrect'
+} Verdict;
+
+// one of the parsers of the repository
+typedef struct _Engine {
+  const char *name;
+  const char *argv[BENCH_MAX_ARGS]; // relative to the repository
+  int num_as_n; // numbers are the terminal 'n'
+  Verdict verdict;
+} Engine;
+
+typedef enum _RunStatus {
+  RUN_ACCEPT,
+  RUN_REJECT,
+  RUN_TIMEOUT,
+  RUN_CRASH // a signal or no verdict
+} RunStatus;
+
+// one process parsing one input
+typedef struct _Run {
+  RunStatus status;
+  double seconds; // from fork to exit
+  long allocs; // -1 if the counter was not loaded
+  long max_rss_kb;
+} Run;
+
+// what the runs of an engine on a set of inputs add up to
+typedef struct _BenchRow {
+  int ok;
+  int wrong;
+  int failed;
+  long toks; // of the inputs that got a verdict, the same for the rest
+  double seconds;
+  long allocs; // -1 if not known for all of them
+  double *latencies;
+  long max_rss_kb;
+} BenchRow;
+
+#endif
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "corpus.h"
+
+#define CORPUS_INIT_CAP 64
+
+
+/******************************************************************************/
+/* Inputs                                                                     */
+/******************************************************************************/
+
+// xorshift, so the corpus is the same on every machine for the same seed
+unsigned corpus_rand(unsigned *seed)
+{
+  *seed ^= *seed << 13;
+  *seed ^= *seed >> 17;
+  *seed ^= *seed << 5;
+  return *seed;
+}
+
+static void push(CorpusInput *in, int *cap, CorpusTok tok)
+{
+  if (in->len == *cap) {
+    *cap *= 2;
+    in->toks = realloc(in->toks, *cap * sizeof(CorpusTok));
+  }
+  in->toks[in->len++] = tok;
+}
+
+static CorpusTok random_op(unsigned *seed)
+{
+  static const CorpusTok ops[] = {TOK_PLUS, TOK_MINUS, TOK_TIMES};
+  return ops[corpus_rand(seed) % 3];
+}
+
+// A random expression of about 'target' tokens: after an operator comes a
+// number or an opening bracket, after a number or a closing bracket an
+// operator or a closing bracket, and what is still open is closed at the
+// end. So it is in the language of every grammar.
+static void gen_expr(CorpusInput *in, int *cap, int target, unsigned *seed)
+{
+  int depth = 0, need_operand = 1;
+
+  while (1) {
+    if (need_operand) {
+      if (in->len + depth < target - 2 && corpus_rand(seed) % 4 == 0) {
+        push(in, cap, TOK_LB);
+        depth++;
+      } else {
+        push(in, cap, TOK_NUM);
+        need_operand = 0;
+      }
+    } else if (in->len + depth >= target) {
+      break;
+    } else if (depth > 0 && corpus_rand(seed) % 3 == 0) {
+      push(in, cap, TOK_RB);
+      depth--;
+    } else {
+      push(in, cap, random_op(seed));
+      need_operand = 1;
+    }
+  }
+  for (; depth > 0; depth--)
+    push(in, cap, TOK_RB);
+}
+
+static CorpusSet *CorpusSet_construct(const char *name, int num)
+{
+  CorpusSet *out = malloc(sizeof(CorpusSet));
+
+  out->name = name;
+  out->inputs = malloc(num * sizeof(CorpusInput));
+  out->size = num;
+  out->num_toks = 0;
+  return out;
+}
+
+static void CorpusInput_init(CorpusInput *in, int cap, int valid)
+{
+  in->toks = malloc(cap * sizeof(CorpusTok));
+  in->len = 0;
+  in->valid = valid;
+}
+
+// expressions of 1 to 'max_len' tokens with brackets anywhere
+CorpusSet *Corpus_short(int num, int max_len, unsigned *seed)
+{
+  CorpusSet *out = CorpusSet_construct("short", num);
+  int cap;
+
+  for (int i = 0; i < num; i++) {
+    cap = CORPUS_INIT_CAP;
+    CorpusInput_init(&out->inputs[i], cap, 1);
+    gen_expr(&out->inputs[i], &cap, 1 + corpus_rand(seed) % max_len, seed);
+    out->num_toks += out->inputs[i].len;
+  }
+  return out;
+}
+
+// '1 + 2 - 3 ...' of 'len' tokens, no brackets
+CorpusSet *Corpus_flat(int num, int len, unsigned *seed)
+{
+  CorpusSet *out = CorpusSet_construct("flat", num);
+  CorpusInput *in;
+
+  for (int i = 0; i < num; i++) {
+    in = &out->inputs[i];
+    CorpusInput_init(in, len + 1, 1);
+    in->toks[in->len++] = TOK_NUM;
+    while (in->len + 2 <= len) {
+      in->toks[in->len++] = (corpus_rand(seed) % 2) ? TOK_PLUS : TOK_MINUS;
+      in->toks[in->len++] = TOK_NUM;
+    }
+    out->num_toks += in->len;
+  }
+  return out;
+}
+
+// '( 1 + ( ( 2 * ( ... ) ) ) )' with 'depth' bracket pairs, half of the
+// levels put an operand before the next bracket
+CorpusSet *Corpus_nested(int num, int depth, unsigned *seed)
+{
+  CorpusSet *out = CorpusSet_construct("nested", num);
+  CorpusInput *in;
+  int cap;
+
+  for (int i = 0; i < num; i++) {
+    in = &out->inputs[i];
+    cap = 4 * depth + 1;
+    CorpusInput_init(in, cap, 1);
+    for (int d = 0; d < depth; d++) {
+      in->toks[in->len++] = TOK_LB;
+      if (corpus_rand(seed) % 2) {
+        in->toks[in->len++] = TOK_NUM;
+        in->toks[in->len++] = random_op(seed);
+      }
+    }
+    in->toks[in->len++] = TOK_NUM;
+    for (int d = 0; d < depth; d++)
+      in->toks[in->len++] = TOK_RB;
+    out->num_toks += in->len;
+  }
+  return out;
+}
+
+// Expressions like the short ones with one mistake in them: a closing
+// bracket left out or one too many, an operator at the end or two numbers
+// in a row. Each of these is wrong in every grammar.
+CorpusSet *Corpus_near_miss(int num, int max_len, unsigned *seed)
+{
+  CorpusSet *out = CorpusSet_construct("near-miss", num);
+  CorpusInput *in;
+  int cap, pos, kind;
+
+  for (int i = 0; i < num; i++) {
+    in = &out->inputs[i];
+    cap = CORPUS_INIT_CAP;
+    CorpusInput_init(in, cap, 0);
+    gen_expr(in, &cap, 1 + corpus_rand(seed) % max_len, seed);
+    // room for one more token
+    push(in, &cap, TOK_NUM);
+    in->len--;
+
+    kind = corpus_rand(seed) % 4;
+    pos = corpus_rand(seed) % in->len;
+    if (kind == 0) {
+      // the first closing bracket from 'pos' on, or the other way round
+      while (pos < in->len && in->toks[pos] != TOK_RB)
+        pos++;
+      if (pos == in->len)
+        kind = 1;
+      else
+        memmove(in->toks + pos, in->toks + pos + 1,
+            (in->len - pos - 1) * sizeof(CorpusTok));
+      in->len -= (kind == 0);
+    }
+    if (kind == 1) {
+      in->toks[in->len++] = TOK_RB;
+    } else if (kind == 2) {
+      in->toks[in->len++] = random_op(seed);
+    } else if (kind == 3) {
+      // every expression has a number
+      while (in->toks[pos] != TOK_NUM)
+        pos = (pos + 1) % in->len;
+      memmove(in->toks + pos + 1, in->toks + pos,
+          (in->len - pos) * sizeof(CorpusTok));
+      in->len++;
+    }
+    out->num_toks += in->len;
+  }
+  return out;
+}
+
+void Corpus_free(CorpusSet *set)
+{
+  for (int i = 0; i < set->size; i++)
+    free(set->inputs[i].toks);
+  free(set->inputs);
+  free(set);
+}
+
+
+/******************************************************************************/
+/* Rendering                                                                  */
+/******************************************************************************/
+
+// The text of the input, tokens separated by spaces. Numbers are 'n' for
+// top_down, otherwise up to three digits that only depend on the position.
+char *Corpus_render(CorpusInput *in, int num_as_n, long *len_out)
+{
+  static const char *spelling[] = {"n", "+", "-", "*", "(", ")"};
+  char *out = malloc(4 * (long)in->len + 2);
+  long len = 0;
+
+  for (int i = 0; i < in->len; i++) {
+    if (in->toks[i] == TOK_NUM && !num_as_n)
+      len += sprintf(out + len, "%d", (i * 7919) % 1000);
+    else
+      len += sprintf(out + len, "%s", spelling[in->toks[i]]);
+    out[len++] = ' ';
+  }
+  out[len++] = '\n';
+  out[len] = '\0';
+  *len_out = len;
+  return out;
+}
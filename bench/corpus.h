@@ -0,0 +1,42 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+// Arithmetic expressions every parser can read. An input is a list of
+// abstract tokens that is rendered for each parser: all of them split at
+// spaces, top_down reads numbers as the terminal 'n', the others as digits.
+
+typedef enum _CorpusTok {
+  TOK_NUM,
+  TOK_PLUS,
+  TOK_MINUS,
+  TOK_TIMES,
+  TOK_LB,
+  TOK_RB
+} CorpusTok;
+
+typedef struct _CorpusInput {
+  CorpusTok *toks;
+  int len;
+  int valid; // whether the input is in the language of the grammars
+} CorpusInput;
+
+// inputs of one shape
+typedef struct _CorpusSet {
+  const char *name;
+  CorpusInput *inputs;
+  int size;
+  long num_toks;
+} CorpusSet;
+
+
+unsigned corpus_rand(unsigned *seed);
+
+CorpusSet *Corpus_short(int num, int max_len, unsigned *seed);
+CorpusSet *Corpus_flat(int num, int len, unsigned *seed);
+CorpusSet *Corpus_nested(int num, int depth, unsigned *seed);
+CorpusSet *Corpus_near_miss(int num, int max_len, unsigned *seed);
+void Corpus_free(CorpusSet *set);
+
+char *Corpus_render(CorpusInput *in, int num_as_n, long *len_out);
+
+#endif
@@ -0,0 +1,848 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dfa_lex.h"
+#include "parse_types.h"
+#include "util_types.h"
+
+typedef unsigned long long BitWord;
+
+static int nfa_add_state(Nfa *nfa, int kind, int set);
+static int nfa_add_set(Nfa *nfa, unsigned set[CHARSET_WORDS]);
+static void charset_add(unsigned set[CHARSET_WORDS], int c);
+static int charset_has(unsigned set[CHARSET_WORDS], int c);
+static NfaFrag regex_alt(RegexParser *rp);
+static NfaFrag regex_concat(RegexParser *rp);
+static NfaFrag regex_repeat(RegexParser *rp);
+static NfaFrag regex_atom(RegexParser *rp);
+static void regex_class(RegexParser *rp, unsigned set[CHARSET_WORDS]);
+static void regex_escape(RegexParser *rp, unsigned set[CHARSET_WORDS]);
+static void nfa_closure(Nfa *nfa, BitWord *set, int *stack);
+static void dfa_minimize(Dfa *dfa);
+static void dfa_check_split(Dfa *dfa);
+
+// the patterns keep their order, it decides between matches of the same
+// length
+LexRule *lex_rules_add(LexRule *rules, const char *pattern, TokType tok)
+{
+  LexRule *new = malloc(sizeof(LexRule));
+  LexRule *last;
+  new->pattern = strdup(pattern);
+  new->tok = tok;
+  new->next = NULL;
+  if (rules == NULL)
+    return new;
+  for (last = rules; last->next != NULL; last = last->next);
+  last->next = new;
+  return rules;
+}
+
+void lex_rules_free(LexRule *rules)
+{
+  LexRule *next;
+  for (; rules != NULL; rules = next) {
+    next = rules->next;
+    free(rules->pattern);
+    free(rules);
+  }
+}
+
+
+/******************************************************************************/
+/* Regular expressions to NFA (Thompson's construction)                       */
+/* Supported: literals, '.', [a-z] and [^a-z] classes, escapes \n \t \s \d \w */
+/* and \ followed by any other character for the character itself,           */
+/* grouping with (), alternation with |, and the * + ? operators             */
+/******************************************************************************/
+
+static void charset_add(unsigned set[CHARSET_WORDS], int c)
+{
+  set[c / 32] |= 1u << (c % 32);
+}
+
+static int charset_has(unsigned set[CHARSET_WORDS], int c)
+{
+  return (set[c / 32] >> (c % 32)) & 1;
+}
+
+static int nfa_add_state(Nfa *nfa, int kind, int set)
+{
+  if (nfa->size == nfa->capacity) {
+    nfa->capacity = (nfa->capacity == 0) ? 64 : 2 * nfa->capacity;
+    nfa->states = realloc(nfa->states, nfa->capacity * sizeof(NfaState));
+  }
+  nfa->states[nfa->size].kind = kind;
+  nfa->states[nfa->size].out1 = -1;
+  nfa->states[nfa->size].out2 = -1;
+  nfa->states[nfa->size].set = set;
+  nfa->states[nfa->size].rule = -1;
+  return nfa->size++;
+}
+
+static int nfa_add_set(Nfa *nfa, unsigned set[CHARSET_WORDS])
+{
+  if (nfa->num_sets == nfa->sets_capacity) {
+    nfa->sets_capacity = (nfa->sets_capacity == 0) ? 16 : 2 * nfa->sets_capacity;
+    nfa->sets = realloc(nfa->sets, nfa->sets_capacity * sizeof(*nfa->sets));
+  }
+  memcpy(nfa->sets[nfa->num_sets], set, sizeof(*nfa->sets));
+  return nfa->num_sets++;
+}
+
+static NfaFrag frag_from_set(Nfa *nfa, unsigned set[CHARSET_WORDS])
+{
+  NfaFrag out;
+  out.start = nfa_add_state(nfa, NFA_SET, nfa_add_set(nfa, set));
+  out.end = nfa_add_state(nfa, NFA_EPS, -1);
+  nfa->states[out.start].out1 = out.end;
+  return out;
+}
+
+static NfaFrag regex_alt(RegexParser *rp)
+{
+  NfaFrag left, right, out;
+
+  left = regex_concat(rp);
+  while (*rp->p == '|') {
+    rp->p++;
+    right = regex_concat(rp);
+    out.start = nfa_add_state(rp->nfa, NFA_EPS, -1);
+    out.end = nfa_add_state(rp->nfa, NFA_EPS, -1);
+    rp->nfa->states[out.start].out1 = left.start;
+    rp->nfa->states[out.start].out2 = right.start;
+    rp->nfa->states[left.end].out1 = out.end;
+    rp->nfa->states[right.end].out1 = out.end;
+    left = out;
+  }
+  return left;
+}
+
+static NfaFrag regex_concat(RegexParser *rp)
+{
+  NfaFrag out, next;
+
+  // empty sequence
+  out.start = out.end = nfa_add_state(rp->nfa, NFA_EPS, -1);
+  while (*rp->p != '\0' && *rp->p != '|' && *rp->p != ')') {
+    next = regex_repeat(rp);
+    rp->nfa->states[out.end].out1 = next.start;
+    out.end = next.end;
+  }
+  return out;
+}
+
+static NfaFrag regex_repeat(RegexParser *rp)
+{
+  NfaFrag inner, out;
+  NfaState *states;
+
+  inner = regex_atom(rp);
+  while (*rp->p == '*' || *rp->p == '+' || *rp->p == '?') {
+    out.start = nfa_add_state(rp->nfa, NFA_EPS, -1);
+    out.end = nfa_add_state(rp->nfa, NFA_EPS, -1);
+    states = rp->nfa->states;
+    states[out.start].out1 = inner.start;
+    states[inner.end].out1 = out.end;
+    if (*rp->p != '+') // zero repetitions allowed
+      states[out.start].out2 = out.end;
+    if (*rp->p != '?') // more than one repetition allowed
+      states[inner.end].out2 = inner.start;
+    rp->p++;
+    inner = out;
+  }
+  return inner;
+}
+
+static NfaFrag regex_atom(RegexParser *rp)
+{
+  unsigned set[CHARSET_WORDS];
+  NfaFrag out;
+
+  memset(set, 0, sizeof(set));
+  switch (*rp->p) {
+    case '(':
+      rp->p++;
+      out = regex_alt(rp);
+      if (*rp->p != ')')
+        error("lexer pattern '%s': missing ')'", rp->pattern);
+      rp->p++;
+      return out;
+    case '[':
+      rp->p++;
+      regex_class(rp, set);
+      break;
+    case '.':
+      rp->p++;
+      for (int c = 0; c < 256; c++) {
+        if (c != '\n')
+          charset_add(set, c);
+      }
+      break;
+    case '\\':
+      rp->p++;
+      regex_escape(rp, set);
+      break;
+    case '*':
+    case '+':
+    case '?':
+      error("lexer pattern '%s': '%c' has nothing to repeat",
+          rp->pattern, *rp->p);
+    default:
+      charset_add(set, (unsigned char)*rp->p++);
+  }
+  return frag_from_set(rp->nfa, set);
+}
+
+// the '[' is already consumed
+static void regex_class(RegexParser *rp, unsigned set[CHARSET_WORDS])
+{
+  unsigned single[CHARSET_WORDS];
+  int negate = 0, lo, hi;
+
+  if (*rp->p == '^') {
+    negate = 1;
+    rp->p++;
+  }
+  // a ']' right at the start is a literal
+  do {
+    if (*rp->p == '\0')
+      error("lexer pattern '%s': missing ']'", rp->pattern);
+    if (*rp->p == '\\') {
+      rp->p++;
+      memset(single, 0, sizeof(single));
+      regex_escape(rp, single);
+      for (int i = 0; i < CHARSET_WORDS; i++)
+        set[i] |= single[i];
+      continue;
+    }
+    lo = (unsigned char)*rp->p++;
+    hi = lo;
+    if (rp->p[0] == '-' && rp->p[1] != ']' && rp->p[1] != '\0') {
+      hi = (unsigned char)rp->p[1];
+      rp->p += 2;
+      if (hi < lo)
+        error("lexer pattern '%s': invalid range", rp->pattern);
+    }
+    for (int c = lo; c <= hi; c++)
+      charset_add(set, c);
+  } while (*rp->p != ']');
+  rp->p++;
+
+  if (negate) {
+    for (int i = 0; i < CHARSET_WORDS; i++)
+      set[i] = ~set[i];
+  }
+}
+
+// the '\' is already consumed
+static void regex_escape(RegexParser *rp, unsigned set[CHARSET_WORDS])
+{
+  int c;
+
+  switch (c = (unsigned char)*rp->p++) {
+    case '\0':
+      error("lexer pattern '%s': trailing '\\'", rp->pattern);
+    case 'n':
+      charset_add(set, '\n');
+      break;
+    case 't':
+      charset_add(set, '\t');
+      break;
+    case 's':
+      for (c = 0; c < 256; c++) {
+        if (isspace(c))
+          charset_add(set, c);
+      }
+      break;
+    case 'd':
+      for (c = '0'; c <= '9'; c++)
+        charset_add(set, c);
+      break;
+    case 'w':
+      for (c = 0; c < 256; c++) {
+        if (isalnum(c) || c == '_')
+          charset_add(set, c);
+      }
+      break;
+    default:
+      charset_add(set, c);
+  }
+}
+
+
+/******************************************************************************/
+/* NFA to DFA (subset construction over byte equivalence classes)            */
+/******************************************************************************/
+
+// add everything reachable over epsilon transitions to 'set'
+static void nfa_closure(Nfa *nfa, BitWord *set, int *stack)
+{
+  int top = 0, s, next[2];
+
+  for (s = 0; s < nfa->size; s++) {
+    if ((set[s / 64] >> (s % 64)) & 1)
+      stack[top++] = s;
+  }
+  while (top > 0) {
+    s = stack[--top];
+    if (nfa->states[s].kind != NFA_EPS)
+      continue;
+    next[0] = nfa->states[s].out1;
+    next[1] = nfa->states[s].out2;
+    for (int i = 0; i < 2; i++) {
+      if (next[i] >= 0 && !((set[next[i] / 64] >> (next[i] % 64)) & 1)) {
+        set[next[i] / 64] |= 1ull << (next[i] % 64);
+        stack[top++] = next[i];
+      }
+    }
+  }
+}
+
+static unsigned bitset_hash(BitWord *set, int words)
+{
+  unsigned long long h = 0;
+  for (int i = 0; i < words; i++)
+    h = (h ^ set[i]) * 0x100000001b3ull;
+  return (unsigned)(h ^ (h >> 32));
+}
+
+Dfa *Dfa_construct(LexRule *rules, int num_terminals)
+{
+  Nfa nfa;
+  RegexParser rp;
+  NfaFrag frag;
+  LexRule *rule, **rule_arr;
+  Dfa *out;
+  BitWord *dsets, *cur;
+  int *stack, *table, *trans, *accept;
+  int num_rules, start, prev, words, num_dstates, dstates_cap, table_cap;
+  int class_of[256], remap[2][256], rep[256], num_classes;
+  int d, c, s, i, best, slot, target;
+
+  if (rules == NULL)
+    error("grammar has no '%%lex' patterns");
+
+  memset(&nfa, 0, sizeof(Nfa));
+
+  // one NFA with an epsilon chain into the start of every pattern
+  num_rules = 0;
+  for (rule = rules; rule != NULL; rule = rule->next)
+    num_rules++;
+  rule_arr = malloc(num_rules * sizeof(LexRule *));
+  start = prev = nfa_add_state(&nfa, NFA_EPS, -1);
+  for (i = 0, rule = rules; rule != NULL; i++, rule = rule->next) {
+    rule_arr[i] = rule;
+    rp.pattern = rp.p = rule->pattern;
+    rp.nfa = &nfa;
+    frag = regex_alt(&rp);
+    if (*rp.p != '\0')
+      error("lexer pattern '%s': unexpected ')'", rule->pattern);
+    nfa.states[frag.end].rule = i;
+    s = nfa_add_state(&nfa, NFA_EPS, -1);
+    nfa.states[prev].out1 = frag.start;
+    nfa.states[prev].out2 = s;
+    prev = s;
+  }
+
+  // bytes that no character set tells apart share an equivalence class
+  memset(class_of, 0, sizeof(class_of));
+  num_classes = 1;
+  for (i = 0; i < nfa.num_sets; i++) {
+    memset(remap, -1, sizeof(remap));
+    int n = 0;
+    for (c = 0; c < 256; c++) {
+      int in = charset_has(nfa.sets[i], c);
+      if (remap[in][class_of[c]] < 0)
+        remap[in][class_of[c]] = n++;
+      class_of[c] = remap[in][class_of[c]];
+    }
+    num_classes = n;
+  }
+  for (c = 255; c >= 0; c--)
+    rep[class_of[c]] = c;
+
+  words = (nfa.size + 63) / 64;
+  stack = malloc(2 * nfa.size * sizeof(int) + sizeof(int));
+  dstates_cap = 64;
+  dsets = calloc(dstates_cap * words, sizeof(BitWord));
+  trans = malloc(dstates_cap * num_classes * sizeof(int));
+  accept = malloc(dstates_cap * sizeof(int));
+  table_cap = 256;
+  table = malloc(table_cap * sizeof(int));
+  memset(table, -1, table_cap * sizeof(int));
+  cur = calloc(words, sizeof(BitWord));
+
+  // state 0 is the empty set (dead state), state 1 the start state
+  num_dstates = 0;
+  for (i = 0; i < 2; i++) {
+    memset(cur, 0, words * sizeof(BitWord));
+    if (i == 1) {
+      cur[start / 64] |= 1ull << (start % 64);
+      nfa_closure(&nfa, cur, stack);
+    }
+    memcpy(dsets + num_dstates * words, cur, words * sizeof(BitWord));
+    slot = bitset_hash(cur, words) & (table_cap - 1);
+    while (table[slot] >= 0)
+      slot = (slot + 1) & (table_cap - 1);
+    table[slot] = num_dstates++;
+  }
+
+  for (d = 0; d < num_dstates; d++) {
+    for (c = 0; c < num_classes; c++) {
+      memset(cur, 0, words * sizeof(BitWord));
+      for (s = 0; s < nfa.size; s++) {
+        if (((dsets[d * words + s / 64] >> (s % 64)) & 1) &&
+            nfa.states[s].kind == NFA_SET &&
+            charset_has(nfa.sets[nfa.states[s].set], rep[c])) {
+          target = nfa.states[s].out1;
+          cur[target / 64] |= 1ull << (target % 64);
+        }
+      }
+      nfa_closure(&nfa, cur, stack);
+
+      slot = bitset_hash(cur, words) & (table_cap - 1);
+      while (table[slot] >= 0 &&
+          memcmp(dsets + table[slot] * words, cur, words * sizeof(BitWord)) != 0)
+        slot = (slot + 1) & (table_cap - 1);
+
+      if (table[slot] < 0) {
+        if (num_dstates == dstates_cap) {
+          dstates_cap *= 2;
+          dsets = realloc(dsets, dstates_cap * words * sizeof(BitWord));
+          trans = realloc(trans, dstates_cap * num_classes * sizeof(int));
+          accept = realloc(accept, dstates_cap * sizeof(int));
+        }
+        memcpy(dsets + num_dstates * words, cur, words * sizeof(BitWord));
+        table[slot] = num_dstates++;
+        // keep the table at most half full
+        if (2 * num_dstates > table_cap) {
+          table_cap *= 2;
+          table = realloc(table, table_cap * sizeof(int));
+          memset(table, -1, table_cap * sizeof(int));
+          for (i = 0; i < num_dstates; i++) {
+            slot = bitset_hash(dsets + i * words, words) & (table_cap - 1);
+            while (table[slot] >= 0)
+              slot = (slot + 1) & (table_cap - 1);
+            table[slot] = i;
+          }
+        }
+        target = num_dstates - 1;
+      } else {
+        target = table[slot];
+      }
+      trans[d * num_classes + c] = target;
+    }
+
+    // the earliest pattern wins if several match the same text
+    best = -1;
+    for (s = 0; s < nfa.size; s++) {
+      if (((dsets[d * words + s / 64] >> (s % 64)) & 1) &&
+          nfa.states[s].rule >= 0 && (best < 0 || nfa.states[s].rule < best))
+        best = nfa.states[s].rule;
+    }
+    accept[d] = (best < 0) ? LEX_NO_ACCEPT : rule_arr[best]->tok;
+    if (d == DFA_START && best >= 0)
+      error("lexer pattern '%s' matches the empty string",
+          rule_arr[best]->pattern);
+  }
+
+  out = malloc(sizeof(Dfa));
+  out->num_states = num_dstates;
+  out->num_classes = num_classes;
+  out->classes = malloc(256);
+  for (c = 0; c < 256; c++)
+    out->classes[c] = class_of[c];
+  out->trans = trans;
+  out->accept = accept;
+  out->num_terminals = num_terminals;
+  out->fingerprint = 0;
+  out->map_base = NULL;
+  out->map_len = 0;
+
+  dfa_minimize(out);
+  dfa_check_split(out);
+
+  free(cur);
+  free(table);
+  free(dsets);
+  free(stack);
+  free(rule_arr);
+  free(nfa.states);
+  free(nfa.sets);
+  return out;
+}
+
+// FNV-1a of the names of the terminals and of every pattern with its
+// terminal, tables written for another grammar have a different one
+static unsigned lex_fingerprint(Grammar *g)
+{
+  unsigned h = 2166136261u;
+  const char *s;
+
+  for (int t = 0; t < g->num_terms; t++) {
+    for (s = Grammar_name(g, t); ; s++) {
+      h = (h ^ (unsigned char)*s) * 16777619u;
+      if (*s == '\0')
+        break;
+    }
+  }
+  for (int i = 0; i < g->num_lex; i++) {
+    h = (h ^ (unsigned)g->lex_sym[i]) * 16777619u;
+    for (s = g->names + g->lex_pattern[i]; ; s++) {
+      h = (h ^ (unsigned char)*s) * 16777619u;
+      if (*s == '\0')
+        break;
+    }
+  }
+  return h;
+}
+
+// lexer for the '%lex' and '%ignore' patterns of the compiled grammar, the
+// patterns were checked when the grammar was compiled
+Dfa *Dfa_from_grammar(Grammar *g)
+{
+  LexRule *rules = NULL;
+  Dfa *out;
+
+  for (int i = 0; i < g->num_lex; i++) {
+    rules = lex_rules_add(rules, g->names + g->lex_pattern[i],
+        (g->lex_sym[i] == GRAMMAR_IGNORE) ? LEX_IGNORE : g->lex_sym[i]);
+  }
+  out = Dfa_construct(rules, g->num_terms);
+  out->fingerprint = lex_fingerprint(g);
+  lex_rules_free(rules);
+  return out;
+}
+
+
+/******************************************************************************/
+/* DFA minimization (Moore's partition refinement)                            */
+/* Start with one block per accepted token and keep splitting blocks whose    */
+/* states go to different blocks on the same equivalence class               */
+/******************************************************************************/
+
+static void dfa_minimize(Dfa *dfa)
+{
+  int n = dfa->num_states, k = dfa->num_classes;
+  int *block, *new_block, *first_rep, *next_rep, *renum, *trans, *accept;
+  int num_blocks, num_new, s, r, c, same;
+
+  block = malloc(n * sizeof(int));
+  new_block = malloc(n * sizeof(int));
+  first_rep = malloc(n * sizeof(int));
+  next_rep = malloc(n * sizeof(int));
+
+  // initial partition by accepted token
+  num_blocks = 0;
+  for (s = 0; s < n; s++) {
+    for (r = 0; r < s && dfa->accept[r] != dfa->accept[s]; r++);
+    block[s] = (r < s) ? block[r] : num_blocks++;
+  }
+
+  while (1) {
+    for (s = 0; s < num_blocks; s++)
+      first_rep[s] = -1;
+    num_new = 0;
+    for (s = 0; s < n; s++) {
+      // compare with one representative of every new block that was split
+      // off the same old block
+      for (r = first_rep[block[s]]; r >= 0; r = next_rep[r]) {
+        same = 1;
+        for (c = 0; c < k && same; c++) {
+          same = block[dfa->trans[r * k + c]] == block[dfa->trans[s * k + c]];
+        }
+        if (same)
+          break;
+      }
+      if (r >= 0) {
+        new_block[s] = new_block[r];
+      } else {
+        new_block[s] = num_new++;
+        next_rep[s] = first_rep[block[s]];
+        first_rep[block[s]] = s;
+      }
+    }
+    memcpy(block, new_block, n * sizeof(int));
+    if (num_new == num_blocks)
+      break;
+    num_blocks = num_new;
+  }
+
+  // renumber so that the dead and the start state keep their numbers
+  renum = malloc(num_blocks * sizeof(int));
+  for (s = 0; s < num_blocks; s++)
+    renum[s] = -1;
+  renum[block[DFA_DEAD]] = DFA_DEAD;
+  if (block[DFA_START] == block[DFA_DEAD])
+    error("lexer patterns can't match anything");
+  renum[block[DFA_START]] = DFA_START;
+  num_new = 2;
+  for (s = 0; s < n; s++) {
+    if (renum[block[s]] < 0)
+      renum[block[s]] = num_new++;
+  }
+
+  trans = malloc(num_blocks * k * sizeof(int));
+  accept = malloc(num_blocks * sizeof(int));
+  for (s = 0; s < n; s++) {
+    accept[renum[block[s]]] = dfa->accept[s];
+    for (c = 0; c < k; c++)
+      trans[renum[block[s]] * k + c] = renum[block[dfa->trans[s * k + c]]];
+  }
+  free(dfa->trans);
+  free(dfa->accept);
+  dfa->trans = trans;
+  dfa->accept = accept;
+  dfa->num_states = num_blocks;
+
+  free(renum);
+  free(next_rep);
+  free(first_rep);
+  free(new_block);
+  free(block);
+}
+
+// Lexing in chunks (see tok_buf.c) only starts chunks right after whitespace.
+// That is only safe if no match can continue past a whitespace character in a
+// way that the restarted scanner would see differently, i.e. if every
+// whitespace transition into a live state lands in a state that accepts an
+// ignored pattern and from which only more whitespace can follow.
+static void dfa_check_split(Dfa *dfa)
+{
+  int n = dfa->num_states, k = dfa->num_classes;
+  int *live, *nonws, changed, s, c, t;
+  int is_ws_class[256];
+
+  memset(is_ws_class, 0, sizeof(is_ws_class));
+  for (c = 0; c < 256; c++) {
+    if (isspace(c))
+      is_ws_class[dfa->classes[c]] = 1;
+  }
+  // a class mixing whitespace with other bytes counts as non-whitespace too
+  for (c = 0; c < 256; c++) {
+    if (!isspace(c) && is_ws_class[dfa->classes[c]])
+      is_ws_class[dfa->classes[c]] = 2;
+  }
+
+  live = calloc(n, sizeof(int)); // can reach an accepting state
+  nonws = calloc(n, sizeof(int)); // can reach one over a non-whitespace byte
+  do {
+    changed = 0;
+    for (s = 1; s < n; s++) {
+      int l = dfa->accept[s] != LEX_NO_ACCEPT, w = 0;
+      for (c = 0; c < k; c++) {
+        t = dfa->trans[s * k + c];
+        if (t == DFA_DEAD || !live[t])
+          continue;
+        l = 1;
+        if (is_ws_class[c] != 1 || nonws[t])
+          w = 1;
+      }
+      if (l != live[s] || w != nonws[s]) {
+        live[s] = l;
+        nonws[s] = w;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  dfa->split_on_space = 1;
+  for (s = 1; s < n; s++) {
+    for (c = 0; c < k; c++) {
+      t = dfa->trans[s * k + c];
+      if (is_ws_class[c] && t != DFA_DEAD && live[t] &&
+          (dfa->accept[t] != LEX_IGNORE || nonws[t]))
+        dfa->split_on_space = 0;
+    }
+  }
+  free(nonws);
+  free(live);
+}
+
+
+/******************************************************************************/
+/* Scanning                                                                   */
+/******************************************************************************/
+
+// longest match from every position, ties go to the earliest pattern
+// input that no pattern matches becomes a LEX_ERROR token
+// numeric tokens are decoded right away if the buffer asks for values
+void Dfa_scan(Dfa *dfa, const char *in, long start, long end, TokBuf *out)
+{
+  const unsigned char *classes = dfa->classes;
+  const int *trans = dfa->trans;
+  const int *accept = dfa->accept;
+  int k = dfa->num_classes;
+  int s, tok;
+  long p, tok_end;
+
+  while (start < end) {
+    s = DFA_START;
+    tok = LEX_NO_ACCEPT;
+    tok_end = start;
+    for (p = start; p < end; p++) {
+      s = trans[s * k + classes[(unsigned char)in[p]]];
+      if (s == DFA_DEAD)
+        break;
+      if (accept[s] != LEX_NO_ACCEPT) {
+        tok = accept[s];
+        tok_end = p + 1;
+      }
+    }
+    if (tok == LEX_NO_ACCEPT) {
+      // skip the byte and leave it to the parser to report, a run of
+      // unmatched bytes becomes one error token
+      if (out->size > 0 && out->types[out->size - 1] == LEX_ERROR &&
+          out->offsets[out->size - 1] + out->lengths[out->size - 1] == start)
+        out->lengths[out->size - 1]++;
+      else
+        TokBuf_append(out, LEX_ERROR, start, 1);
+      start++;
+      continue;
+    }
+    if (tok != LEX_IGNORE) {
+      TokBuf_append(out, tok, start, tok_end - start);
+      if (out->numeric != NULL && out->numeric[tok])
+        out->values[out->size - 1] = lex_number(in + start, tok_end - start);
+    }
+    start = tok_end;
+  }
+}
+
+
+/******************************************************************************/
+/* Binary table format                                                        */
+/* Tables are written as they are in memory so a mapped file can be used     */
+/* directly without copying anything                                          */
+/******************************************************************************/
+
+void Dfa_write(Dfa *dfa, const char *path)
+{
+  DfaFileHeader hdr;
+  FILE *f;
+
+  if ((f = fopen(path, "wb")) == NULL)
+    error("can't open file '%s' for writing", path);
+  memcpy(hdr.magic, DFA_MAGIC, 4);
+  hdr.num_states = dfa->num_states;
+  hdr.num_classes = dfa->num_classes;
+  hdr.split_on_space = dfa->split_on_space;
+  hdr.num_terminals = dfa->num_terminals;
+  hdr.fingerprint = dfa->fingerprint;
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fwrite(dfa->classes, 1, 256, f) != 256 ||
+      fwrite(dfa->accept, sizeof(int), dfa->num_states, f)
+        != (size_t)dfa->num_states ||
+      fwrite(dfa->trans, sizeof(int), dfa->num_states * dfa->num_classes, f)
+        != (size_t)dfa->num_states * dfa->num_classes)
+    error("can't write lexer tables to '%s'", path);
+  fclose(f);
+}
+
+// every next state, token and byte class of the tables is in range, so
+// Dfa_scan never reads outside of them
+static int tables_ok(Dfa *dfa)
+{
+  for (int c = 0; c < 256; c++) {
+    if (dfa->classes[c] >= dfa->num_classes)
+      return 0;
+  }
+  for (int s = 0; s < dfa->num_states; s++) {
+    if (dfa->accept[s] != LEX_NO_ACCEPT && dfa->accept[s] != LEX_IGNORE &&
+        (dfa->accept[s] <= GRAMMAR_END ||
+         dfa->accept[s] >= dfa->num_terminals))
+      return 0;
+  }
+  for (long i = 0; i < (long)dfa->num_states * dfa->num_classes; i++) {
+    if (dfa->trans[i] < 0 || dfa->trans[i] >= dfa->num_states)
+      return 0;
+  }
+  return 1;
+}
+
+// The tables have to be written for 'g', which is checked by the number of
+// terminals and the fingerprint of the terminals and patterns.
+Dfa *Dfa_map(const char *path, Grammar *g)
+{
+  DfaFileHeader *hdr;
+  struct stat st;
+  Dfa *out;
+  char *base;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    error("can't open file '%s'", path);
+  if (st.st_size < (long)sizeof(DfaFileHeader) + 256)
+    error("'%s' is not a lexer table file", path);
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED)
+    error("can't mmap file '%s'", path);
+  close(fd);
+
+  hdr = (DfaFileHeader *)base;
+  if (memcmp(hdr->magic, DFA_MAGIC, 4) != 0)
+    error("'%s' is not a lexer table file", path);
+  // the size is computed from the counts, so they are checked first
+  if (hdr->num_states <= DFA_START || hdr->num_classes < 1 ||
+      hdr->num_classes > 256)
+    error("lexer table file '%s' is corrupt", path);
+  if (st.st_size != (long)(sizeof(DfaFileHeader) + 256 +
+        sizeof(int) * hdr->num_states * (1 + hdr->num_classes)))
+    error("lexer table file '%s' is truncated", path);
+  if (hdr->num_terminals != g->num_terms)
+    error("lexer table file '%s' was built for a grammar with %d terminals "
+        "but this one has %d", path, hdr->num_terminals, g->num_terms);
+  if (hdr->fingerprint != lex_fingerprint(g))
+    error("lexer table file '%s' was built for a different grammar", path);
+
+  out = malloc(sizeof(Dfa));
+  out->num_states = hdr->num_states;
+  out->num_classes = hdr->num_classes;
+  out->split_on_space = hdr->split_on_space;
+  out->num_terminals = hdr->num_terminals;
+  out->fingerprint = hdr->fingerprint;
+  out->classes = (unsigned char *)(base + sizeof(DfaFileHeader));
+  out->accept = (int *)(base + sizeof(DfaFileHeader) + 256);
+  out->trans = out->accept + out->num_states;
+  out->map_base = base;
+  out->map_len = st.st_size;
+  if (!tables_ok(out))
+    error("lexer table file '%s' is corrupt", path);
+  return out;
+}
+
+void Dfa_print(Dfa *dfa, Grammar *g)
+{
+  printf("Lexer DFA: %d states, %d byte classes%s\n", dfa->num_states,
+      dfa->num_classes, dfa->split_on_space ? "" : ", can't be split on spaces");
+  for (int s = 1; s < dfa->num_states; s++) {
+    printf("State %d", s);
+    if (dfa->accept[s] == LEX_IGNORE)
+      printf(" (ignore)");
+    else if (dfa->accept[s] != LEX_NO_ACCEPT)
+      printf(" (%s)", Grammar_name(g, dfa->accept[s]));
+    printf(":");
+    for (int c = 0; c < dfa->num_classes; c++) {
+      if (dfa->trans[s * dfa->num_classes + c] != DFA_DEAD)
+        printf(" %d->%d", c, dfa->trans[s * dfa->num_classes + c]);
+    }
+    printf("\n");
+  }
+}
+
+void Dfa_free(Dfa *dfa)
+{
+  if (dfa->map_base != NULL) {
+    munmap(dfa->map_base, dfa->map_len);
+  } else {
+    free(dfa->classes);
+    free(dfa->accept);
+    free(dfa->trans);
+  }
+  free(dfa);
+}
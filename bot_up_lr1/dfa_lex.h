@@ -0,0 +1,103 @@
+#ifndef DFA_LEX_H
+#define DFA_LEX_H
+
+#include "parser.h"
+#include "tok_buf.h"
+#include "grammar.h"
+
+// token value for text that matches an '%ignore' pattern
+#define LEX_IGNORE -2
+#define LEX_NO_ACCEPT -1
+// token type for input that matches no pattern at all
+#define LEX_ERROR -3
+
+// every DFA has a dead state 0 that it never leaves and starts in state 1
+#define DFA_DEAD 0
+#define DFA_START 1
+
+#define NFA_EPS 0
+#define NFA_SET 1
+
+#define CHARSET_WORDS (256 / 32)
+
+#define DFA_MAGIC "DFA2"
+
+
+// pattern of a '%lex' or '%ignore' line in the grammar file
+typedef struct _LexRule {
+  char *pattern;
+  TokType tok; // terminal id or LEX_IGNORE
+  struct _LexRule *next;
+} LexRule;
+
+
+// Thompson NFA built from all the patterns
+typedef struct _NfaState {
+  int kind;
+  int out1;
+  int out2;
+  int set; // index of the character set for NFA_SET states
+  int rule; // index of the rule this state accepts or -1
+} NfaState;
+
+typedef struct _Nfa {
+  NfaState *states;
+  int size;
+  int capacity;
+  unsigned (*sets)[CHARSET_WORDS];
+  int num_sets;
+  int sets_capacity;
+} Nfa;
+
+typedef struct _NfaFrag {
+  int start;
+  int end; // NFA_EPS state without outgoing transitions yet
+} NfaFrag;
+
+typedef struct _RegexParser {
+  const char *pattern;
+  const char *p;
+  Nfa *nfa;
+} RegexParser;
+
+
+// minimized DFA with dense transition tables over byte equivalence classes
+// the next state of 's' on byte 'c' is trans[s * num_classes + classes[c]]
+typedef struct _Dfa {
+  int num_states;
+  int num_classes;
+  unsigned char *classes;
+  int *accept; // token for every state, LEX_NO_ACCEPT or LEX_IGNORE
+  int *trans;
+  int split_on_space; // 1 if chunks can be split after any whitespace
+  int num_terminals; // of the grammar the patterns are from
+  unsigned fingerprint; // of its terminals and patterns, 0 if not known
+  void *map_base; // set if the tables point into an mmap'd file
+  long map_len;
+} Dfa;
+
+// header of the binary format written by Dfa_write
+// followed by classes[256], accept[num_states] and
+// trans[num_states * num_classes]
+typedef struct _DfaFileHeader {
+  char magic[4];
+  int num_states;
+  int num_classes;
+  int split_on_space;
+  int num_terminals;
+  unsigned fingerprint;
+} DfaFileHeader;
+
+
+LexRule *lex_rules_add(LexRule *rules, const char *pattern, TokType tok);
+void lex_rules_free(LexRule *rules);
+
+Dfa *Dfa_construct(LexRule *rules, int num_terminals);
+Dfa *Dfa_from_grammar(Grammar *g);
+void Dfa_scan(Dfa *dfa, const char *in, long start, long end, TokBuf *out);
+void Dfa_write(Dfa *dfa, const char *path);
+Dfa *Dfa_map(const char *path, Grammar *g);
+void Dfa_print(Dfa *dfa, Grammar *g);
+void Dfa_free(Dfa *dfa);
+
+#endif
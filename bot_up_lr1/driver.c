@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "driver.h"
+
+
+// LR(1) parse of the token buffer with panic mode error recovery:
+// after an error, states are popped off the stack until one has an action for
+// the current token, and if there is none the token is thrown away.
+// Errors are only reported once ERR_RECOVERY_SHIFTS tokens were shifted since
+// the last one so that one mistake does not show up as a cascade of errors.
+//
+// Parsing continues from the state in 'run' and 'run' is kept up to date so
+// that the parse can be resumed. If 'on_shift' is given it is called after
+// every shift and the parse stops with PARSE_STOPPED if it returns non-zero.
+int lr_parse(PTable ptable, TokBuf *toks, ParseErrors *errs, ParseRun *run,
+    ShiftFn on_shift, void *arg)
+{
+  ParseStack *pstack = run->pstack;
+  ParseStack *iter;
+  Grammar *g = ptable.g;
+  const char *sym;
+  int rule;
+  int tok_idx = run->tok_idx;
+  TokType tt = toks->types[tok_idx];
+  Action *act;
+  int *goto_state;
+  char buf[ptable.key_len];
+  int shifts = run->shifts;
+  int out = PARSE_REJECT;
+
+  while (1) {
+    act = action_get(ptable, pstack->state_no, tt);
+    if (act == NULL) {
+      if (shifts >= ERR_RECOVERY_SHIFTS &&
+          ParseErrors_add(errs, ptable, pstack->state_no, tt,
+            toks->offsets[tok_idx], toks->lengths[tok_idx])) {
+        break;
+      }
+      // an error right after recovering means recovery did not help,
+      // skip the token so that every error makes progress
+      if (shifts == 0) {
+        if (tt == NONE)
+          break;
+        tt = toks->types[++tok_idx];
+      }
+      shifts = 0;
+
+      while (1) {
+        for (iter = pstack; iter != NULL &&
+            action_get(ptable, iter->state_no, tt) == NULL; iter = iter->next);
+        if (iter != NULL || tt == NONE)
+          break;
+        tt = toks->types[++tok_idx];
+      }
+      if (iter == NULL)
+        break;
+      while (pstack != iter) {
+        pstack = ParseStack_pop(pstack);
+      }
+    } else if (act->act_type == REDUCE) {
+      rule = act->act_instr.red_rule;
+      for (int i = 0; i < GRAMMAR_RULE_LEN(g, rule); i++) {
+        pstack = ParseStack_pop(pstack);
+      }
+      sym = Grammar_name(g, g->rule_lhs[rule]);
+      key_gen(buf, ptable.key_len, pstack->state_no, sym);
+      if ((goto_state = (int *)HashMap_get(ptable.goto_t, buf, NULL)) == NULL) {
+        error("state %d needs to have a goto state for symbol '%s'",
+            pstack->state_no, sym);
+      }
+      pstack = ParseStack_push(pstack, sym, *goto_state);
+    } else if (act->act_type == SHIFT) {
+      pstack = ParseStack_push(pstack, Grammar_name(g, tt),
+          act->act_instr.state_no);
+      tt = toks->types[++tok_idx];
+      shifts++;
+      if (on_shift != NULL) {
+        run->pstack = pstack;
+        run->tok_idx = tok_idx;
+        run->shifts = shifts;
+        if (on_shift(run, arg))
+          return PARSE_STOPPED;
+      }
+    } else if (act->act_type == ACCEPT && tt == NONE) {
+      out = PARSE_ACCEPT;
+      break;
+    } else {
+      break;
+    }
+  }
+  run->pstack = pstack;
+  run->tok_idx = tok_idx;
+  run->shifts = shifts;
+  return out;
+}
+
+void ParseRun_init(ParseRun *run, const char *root)
+{
+  run->pstack = ParseStack_push(NULL, root, 0);
+  run->tok_idx = 0;
+  run->shifts = ERR_RECOVERY_SHIFTS;
+}
+
+// parse the whole token buffer, returns 1 if it was accepted without errors
+int check_grammar(PTable ptable, const char *root, TokBuf *toks,
+    ParseErrors *errs)
+{
+  ParseRun run;
+  int out;
+
+  ParseRun_init(&run, root);
+  out = lr_parse(ptable, toks, errs, &run, NULL, NULL);
+  ParseStack_free(run.pstack);
+  return out == PARSE_ACCEPT && errs->size == 0;
+}
@@ -0,0 +1,27 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+
+#define PARSE_REJECT 0
+#define PARSE_ACCEPT 1
+#define PARSE_STOPPED 2 // stopped by the on_shift callback
+
+// everything the LR driver needs to continue a parse where it stopped
+typedef struct _ParseRun {
+  ParseStack *pstack;
+  int tok_idx;
+  int shifts; // tokens shifted since the last error
+} ParseRun;
+
+typedef int (*ShiftFn)(ParseRun *run, void *arg);
+
+
+void ParseRun_init(ParseRun *run, const char *root);
+int lr_parse(PTable ptable, TokBuf *toks, ParseErrors *errs, ParseRun *run,
+    ShiftFn on_shift, void *arg);
+int check_grammar(PTable ptable, const char *root, TokBuf *toks,
+    ParseErrors *errs);
+
+#endif
@@ -0,0 +1,532 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "dfa_lex.h"
+#include "eval.h"
+
+
+/******************************************************************************/
+/* Rule actions from the grammar                                              */
+/* Every rule of an expression grammar has one of these shapes:               */
+/*   expr: expr T_PLUS term        binary operator                            */
+/*   neg: T_MINUS neg              unary operator                             */
+/*   factor: T_LBRACKET expr T_RBRACKET                                       */
+/*   expr: term                    value of the only symbol                   */
+/*   factor: T_NUMBER              number                                     */
+/******************************************************************************/
+
+#define EVAL_OPS "+-*/%^"
+
+// the character a '%lex' pattern matches if it is a single operator: 'c',
+// '\c' or '[c]'
+static char pattern_op(const char *p)
+{
+  char c = 0;
+  int len = strlen(p);
+
+  if (len == 1)
+    c = p[0];
+  else if (len == 2 && p[0] == '\\')
+    c = p[1];
+  else if (len == 3 && p[0] == '[' && p[2] == ']')
+    c = p[1];
+  return (c != 0 && strchr(EVAL_OPS, c) != NULL) ? c : 0;
+}
+
+// put why the grammar can't be evaluated into 'why', returns 0
+static int eval_fail(char *why, int why_len, char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(why, why_len, fmt, ap);
+  va_end(ap);
+  return 0;
+}
+
+static int not_an_op(Grammar *g, int rule, int sym, char *why, int why_len)
+{
+  return eval_fail(why, why_len, "can't evaluate: '%s' in a rule of '%s' is "
+      "not an operator", Grammar_name(g, sym),
+      Grammar_name(g, g->rule_lhs[rule]));
+}
+
+// fill in the table for the rules of 'g', returns 0 if it can't
+static int eval_fill(EvalTable *out, Grammar *g, char *why, int why_len)
+{
+  const int *rhs;
+  int r, len, sym;
+  char kind, arg, op;
+
+  for (int i = 0; i < g->num_lex; i++) {
+    sym = g->lex_sym[i];
+    if (sym != GRAMMAR_IGNORE && out->op[sym] == 0)
+      out->op[sym] = pattern_op(g->names + g->lex_pattern[i]);
+  }
+
+  for (r = 0; r < g->num_rules; r++) {
+    rhs = GRAMMAR_RULE_RHS(g, r);
+    len = GRAMMAR_RULE_LEN(g, r);
+    kind = EVAL_COPY;
+    arg = 0;
+    op = 0;
+    if (len == 1) {
+      if (GRAMMAR_IS_TERM(g, rhs[0]))
+        out->numeric[rhs[0]] = 1;
+    } else if (len == 2 && GRAMMAR_IS_TERM(g, rhs[0]) &&
+        !GRAMMAR_IS_TERM(g, rhs[1])) {
+      kind = EVAL_UNARY;
+      arg = 1;
+      op = out->op[rhs[0]];
+      if (op == 0)
+        return not_an_op(g, r, rhs[0], why, why_len);
+      if (op != '-' && op != '+') {
+        return eval_fail(why, why_len, "can't evaluate: '%s' in a rule of "
+            "'%s' is not a unary operator", Grammar_name(g, rhs[0]),
+            Grammar_name(g, g->rule_lhs[r]));
+      }
+    } else if (len == 3 && !GRAMMAR_IS_TERM(g, rhs[0]) &&
+        GRAMMAR_IS_TERM(g, rhs[1]) && !GRAMMAR_IS_TERM(g, rhs[2])) {
+      kind = EVAL_BINARY;
+      op = out->op[rhs[1]];
+      if (op == 0)
+        return not_an_op(g, r, rhs[1], why, why_len);
+    } else if (len == 3 && GRAMMAR_IS_TERM(g, rhs[0]) &&
+        !GRAMMAR_IS_TERM(g, rhs[1]) && GRAMMAR_IS_TERM(g, rhs[2])) {
+      arg = 1;
+    } else {
+      return eval_fail(why, why_len, "can't evaluate: a rule of '%s' is "
+          "neither an operator, a number nor an expression in brackets",
+          Grammar_name(g, g->rule_lhs[r]));
+    }
+    out->kind[r] = kind;
+    out->arg[r] = arg;
+    out->rule_op[r] = op;
+  }
+
+  // numbers are never operators
+  for (int i = 0; i < g->num_terms; i++) {
+    if (out->numeric[i] && out->op[i] != 0) {
+      return eval_fail(why, why_len, "can't evaluate: terminal '%s' is used "
+          "as a number and as an operator", Grammar_name(g, i));
+    }
+  }
+  return 1;
+}
+
+// The table for an expression grammar, or NULL if 'g' is not one and then
+// 'why' says what is wrong with it. A process that parses with several
+// grammars can go on without values for some of them.
+EvalTable *EvalTable_try(Grammar *g, char *why, int why_len)
+{
+  EvalTable *out = malloc(sizeof(EvalTable));
+
+  out->num_terminals = g->num_terms;
+  out->numeric = calloc(g->num_terms, sizeof(char));
+  out->op = calloc(g->num_terms, sizeof(char));
+  out->num_rules = g->num_rules;
+  out->kind = malloc(g->num_rules * sizeof(char));
+  out->arg = malloc(g->num_rules * sizeof(char));
+  out->rule_op = calloc(g->num_rules, sizeof(char));
+  if (!eval_fill(out, g, why, why_len)) {
+    EvalTable_free(out);
+    return NULL;
+  }
+  return out;
+}
+
+EvalTable *EvalTable_construct(Grammar *g)
+{
+  char why[ERR_MSG_LEN];
+  EvalTable *out = EvalTable_try(g, why, sizeof(why));
+
+  if (out == NULL)
+    error("%s", why);
+  return out;
+}
+
+void EvalTable_free(EvalTable *table)
+{
+  free(table->numeric);
+  free(table->op);
+  free(table->kind);
+  free(table->arg);
+  free(table->rule_op);
+  free(table);
+}
+
+
+/******************************************************************************/
+/* Parsing                                                                    */
+/******************************************************************************/
+
+static double apply(char op, double l, double r)
+{
+  switch (op) {
+    case '+':
+      return l + r;
+    case '-':
+      return l - r;
+    case '*':
+      return l * r;
+    case '/':
+      return l / r;
+    case '%':
+      return fmod(l, r);
+    default:
+      return pow(l, r);
+  }
+}
+
+// value of the left side of 'rule' from the values of its right side
+static double rule_value(EvalTable *table, int rule, const double *v)
+{
+  switch (table->kind[rule]) {
+    case EVAL_COPY:
+      return v[(int)table->arg[rule]];
+    case EVAL_BINARY:
+      return apply(table->rule_op[rule], v[0], v[2]);
+    default:
+      return (table->rule_op[rule] == '-') ? -v[1] : v[1];
+  }
+}
+
+static void prog_emit(EvalProg *prog, char op)
+{
+  if (prog->len + 1 >= prog->cap) {
+    prog->cap *= 2;
+    prog->code = realloc(prog->code, prog->cap);
+  }
+  prog->code[prog->len++] = op;
+  prog->code[prog->len] = '\0';
+}
+
+static void prog_push(EvalProg *prog, double value)
+{
+  if (prog->num_consts == prog->consts_cap) {
+    prog->consts_cap *= 2;
+    prog->consts = realloc(prog->consts, prog->consts_cap * sizeof(double));
+  }
+  prog->consts[prog->num_consts++] = value;
+  prog_emit(prog, EVAL_OP_PUSH);
+}
+
+// the code for a reduce by 'rule', copies need none
+static void prog_rule(EvalTable *table, EvalProg *prog, int rule)
+{
+  if (table->kind[rule] == EVAL_BINARY)
+    prog_emit(prog, table->rule_op[rule]);
+  else if (table->kind[rule] == EVAL_UNARY && table->rule_op[rule] == '-')
+    prog_emit(prog, EVAL_OP_NEG);
+}
+
+// LR(1) parse of the token buffer that computes the value of the input on
+// the way. The values of the symbols on the stack are kept in an array next
+// to the states, a shift pushes the value decoded by the lexer and a reduce
+// replaces the values of the right side by the value of the rule, so no tree
+// is built. If 'prog' is given the same steps are also written to it as
+// bytecode. There is no error recovery, parsing stops at the first error.
+static int eval_run(PTable ptable, EvalTable *table, TokBuf *toks,
+    ParseErrors *errs, double *value, EvalProg *prog)
+{
+  Grammar *g = ptable.g;
+  int cap = EVAL_STACK_INIT_CAP;
+  int *states = malloc(cap * sizeof(int));
+  double *values = malloc(cap * sizeof(double));
+  int top = 0;
+  int tok_idx = 0;
+  TokType tt = toks->types[0];
+  Action *act;
+  int *goto_state;
+  const char *sym;
+  char buf[ptable.key_len];
+  int rule, len;
+  double val;
+  int out = 0;
+
+  states[0] = 0;
+  values[0] = 0;
+  while (1) {
+    act = action_get(ptable, states[top], tt);
+    if (act == NULL) {
+      ParseErrors_add(errs, ptable, states[top], tt, toks->offsets[tok_idx],
+          toks->lengths[tok_idx]);
+      break;
+    } else if (act->act_type == REDUCE ||
+        (act->act_type == ACCEPT && tt == NONE)) {
+      rule = act->act_instr.red_rule;
+      len = GRAMMAR_RULE_LEN(g, rule);
+      val = rule_value(table, rule, values + top - len + 1);
+      top -= len;
+      if (prog != NULL)
+        prog_rule(table, prog, rule);
+      // a rule of the root completed on top of the stack of a right
+      // recursive root accepts as well, the reductions below it are still
+      // needed for the value
+      if (act->act_type == ACCEPT && top == 0) {
+        *value = val;
+        out = 1;
+        break;
+      }
+
+      sym = Grammar_name(g, g->rule_lhs[rule]);
+      key_gen(buf, ptable.key_len, states[top], sym);
+      if ((goto_state = (int *)HashMap_get(ptable.goto_t, buf, NULL)) == NULL) {
+        error("state %d needs to have a goto state for symbol '%s'",
+            states[top], sym);
+      }
+      states[++top] = *goto_state;
+      values[top] = val;
+    } else if (act->act_type == SHIFT) {
+      if (++top == cap) {
+        cap *= 2;
+        states = realloc(states, cap * sizeof(int));
+        values = realloc(values, cap * sizeof(double));
+      }
+      states[top] = act->act_instr.state_no;
+      values[top] = toks->values[tok_idx];
+      if (prog != NULL && table->numeric[tt])
+        prog_push(prog, values[top]);
+      tt = toks->types[++tok_idx];
+    } else {
+      break;
+    }
+  }
+
+  free(states);
+  free(values);
+  return out;
+}
+
+// The tokens have to be lexed with table->numeric.
+int lr_eval(PTable ptable, EvalTable *table, TokBuf *toks, ParseErrors *errs,
+    double *value)
+{
+  return eval_run(ptable, table, toks, errs, value, NULL) && errs->size == 0;
+}
+
+// parse the token buffer into stack bytecode, returns 1 if it was accepted
+int lr_compile(PTable ptable, EvalTable *table, TokBuf *toks,
+    ParseErrors *errs, EvalProg *prog)
+{
+  double value;
+  int depth = 0;
+
+  prog->len = 0;
+  prog->code[0] = '\0';
+  prog->num_consts = 0;
+  if (!eval_run(ptable, table, toks, errs, &value, prog))
+    return 0;
+
+  prog->depth = 0;
+  for (int i = 0; i < prog->len; i++) {
+    if (prog->code[i] == EVAL_OP_PUSH)
+      depth++;
+    else if (prog->code[i] != EVAL_OP_NEG)
+      depth--;
+    if (depth > prog->depth)
+      prog->depth = depth;
+  }
+  return 1;
+}
+
+
+/******************************************************************************/
+/* Bytecode                                                                   */
+/* Expressions are compiled once per distinct text, programs of the same     */
+/* shape are then run EVAL_LANES at a time with every stack slot holding one  */
+/* value per lane, so every instruction is a loop over the lanes that the     */
+/* compiler turns into vector instructions                                    */
+/******************************************************************************/
+
+static void EvalProg_init(EvalProg *prog)
+{
+  prog->cap = EVAL_PROG_INIT_CAP;
+  prog->code = malloc(prog->cap);
+  prog->code[0] = '\0';
+  prog->len = 0;
+  prog->consts_cap = EVAL_PROG_INIT_CAP;
+  prog->consts = malloc(prog->consts_cap * sizeof(double));
+  prog->num_consts = 0;
+  prog->depth = 0;
+  prog->shape = -1;
+}
+
+EvalCache *EvalCache_construct(EvalTable *table)
+{
+  EvalCache *out = malloc(sizeof(EvalCache));
+  out->table = table;
+  out->texts = HashMap_construct(sizeof(int), MEM_OTHER);
+  out->shapes = HashMap_construct(sizeof(int), MEM_OTHER);
+  out->progs_cap = EVAL_PROG_INIT_CAP;
+  out->progs = malloc(out->progs_cap * sizeof(EvalProg));
+  out->num_progs = 0;
+  out->num_shapes = 0;
+  out->hits = 0;
+  EvalProg_init(&out->scratch);
+  out->toks = TokBuf_construct(0, table->numeric);
+  return out;
+}
+
+// Number of the program for the expression in[start] to in[end - 1], it is
+// only lexed and parsed the first time the same text is seen. Returns -1 if
+// the expression has an error.
+int EvalCache_compile(EvalCache *cache, PTable ptable, Dfa *dfa,
+    const char *in, long start, long end, ParseErrors *errs)
+{
+  EvalProg *scratch = &cache->scratch, *prog;
+  char *key = malloc(end - start + 1);
+  int *found, num;
+
+  memcpy(key, in + start, end - start);
+  key[end - start] = '\0';
+  if ((found = (int *)HashMap_get(cache->texts, key, NULL)) != NULL) {
+    cache->hits++;
+    free(key);
+    return *found;
+  }
+
+  cache->toks->size = 0;
+  Dfa_scan(dfa, in, start, end, cache->toks);
+  TokBuf_append(cache->toks, NONE, end, 0);
+  if (!lr_compile(ptable, cache->table, cache->toks, errs, scratch)) {
+    free(key);
+    return -1;
+  }
+
+  if (cache->num_progs == cache->progs_cap) {
+    cache->progs_cap *= 2;
+    cache->progs = realloc(cache->progs, cache->progs_cap * sizeof(EvalProg));
+  }
+  num = cache->num_progs++;
+  prog = &cache->progs[num];
+  *prog = *scratch;
+  // the compiled program keeps exactly what it needs
+  prog->code = strdup(scratch->code);
+  prog->cap = prog->len + 1;
+  prog->consts = malloc(scratch->num_consts * sizeof(double));
+  memcpy(prog->consts, scratch->consts, scratch->num_consts * sizeof(double));
+  prog->consts_cap = scratch->num_consts;
+
+  if ((found = (int *)HashMap_get(cache->shapes, prog->code, NULL)) != NULL) {
+    prog->shape = *found;
+  } else {
+    prog->shape = cache->num_shapes++;
+    HashMap_set(cache->shapes, prog->code, &prog->shape);
+  }
+  HashMap_set(cache->texts, key, &num);
+  free(key);
+  return num;
+}
+
+void EvalCache_free(EvalCache *cache)
+{
+  for (int i = 0; i < cache->num_progs; i++) {
+    free(cache->progs[i].code);
+    free(cache->progs[i].consts);
+  }
+  free(cache->progs);
+  free(cache->scratch.code);
+  free(cache->scratch.consts);
+  HashMap_deconstruct(cache->texts);
+  HashMap_deconstruct(cache->shapes);
+  TokBuf_free(cache->toks);
+  free(cache);
+}
+
+// run the code shared by the programs in 'lanes' on all of them at once,
+// 'stack' has room for depth * EVAL_LANES values
+static void eval_lanes(const char *code, EvalProg **lanes, double *stack,
+    double *out)
+{
+  double *a, *b; // the two slots on top of the stack
+  int top = -1, k = 0, l;
+
+  for (; *code != '\0'; code++) {
+    if (*code == EVAL_OP_PUSH) {
+      b = stack + ++top * EVAL_LANES;
+      for (l = 0; l < EVAL_LANES; l++)
+        b[l] = lanes[l]->consts[k];
+      k++;
+      continue;
+    }
+    b = stack + top * EVAL_LANES;
+    if (*code == EVAL_OP_NEG) {
+      for (l = 0; l < EVAL_LANES; l++)
+        b[l] = -b[l];
+      continue;
+    }
+
+    a = b - EVAL_LANES;
+    switch (*code) {
+      case '+':
+        for (l = 0; l < EVAL_LANES; l++)
+          a[l] += b[l];
+        break;
+      case '-':
+        for (l = 0; l < EVAL_LANES; l++)
+          a[l] -= b[l];
+        break;
+      case '*':
+        for (l = 0; l < EVAL_LANES; l++)
+          a[l] *= b[l];
+        break;
+      case '/':
+        for (l = 0; l < EVAL_LANES; l++)
+          a[l] /= b[l];
+        break;
+      default:
+        for (l = 0; l < EVAL_LANES; l++)
+          a[l] = apply(*code, a[l], b[l]);
+        break;
+    }
+    top--;
+  }
+  memcpy(out, stack, EVAL_LANES * sizeof(double));
+}
+
+// evaluate the programs with the numbers 'progs' into 'out', the programs
+// are grouped by shape and every group runs EVAL_LANES programs at a time
+void eval_batch(EvalCache *cache, const int *progs, int num, double *out)
+{
+  int *start = calloc(cache->num_shapes + 1, sizeof(int));
+  int *order = malloc(num * sizeof(int));
+  EvalProg *lanes[EVAL_LANES];
+  double res[EVAL_LANES];
+  double *stack;
+  EvalProg *first;
+  int i, j, l, end, n;
+
+  // counting sort of the programs by shape
+  for (i = 0; i < num; i++)
+    start[cache->progs[progs[i]].shape + 1]++;
+  for (i = 0; i < cache->num_shapes; i++)
+    start[i + 1] += start[i];
+  for (i = 0; i < num; i++)
+    order[start[cache->progs[progs[i]].shape]++] = i;
+
+  for (i = 0; i < num; i = end) {
+    first = &cache->progs[progs[order[i]]];
+    for (end = i + 1; end < num &&
+        cache->progs[progs[order[end]]].shape == first->shape; end++);
+    stack = malloc(first->depth * EVAL_LANES * sizeof(double));
+    for (j = i; j < end; j += EVAL_LANES) {
+      n = (end - j < EVAL_LANES) ? end - j : EVAL_LANES;
+      // a short last group repeats its first program in the unused lanes
+      for (l = 0; l < EVAL_LANES; l++)
+        lanes[l] = &cache->progs[progs[order[j + ((l < n) ? l : 0)]]];
+      eval_lanes(first->code, lanes, stack, res);
+      for (l = 0; l < n; l++)
+        out[order[j + l]] = res[l];
+    }
+    free(stack);
+  }
+  free(start);
+  free(order);
+}
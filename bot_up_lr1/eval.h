@@ -0,0 +1,78 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+#include "dfa_lex.h"
+
+#define EVAL_STACK_INIT_CAP 64
+#define EVAL_PROG_INIT_CAP 16
+// programs evaluated side by side, one lane each
+#define EVAL_LANES 8
+
+// what a rule does with the values of its right side
+#define EVAL_COPY 0 // the value of the symbol at 'arg'
+#define EVAL_BINARY 1 // 'op' applied to the first and the last symbol
+#define EVAL_UNARY 2 // 'op' applied to the last symbol
+
+// bytecode, the binary operators are their own characters
+#define EVAL_OP_PUSH 'n' // push the next constant
+#define EVAL_OP_NEG '~'
+
+// Arithmetic for every rule of an expression grammar. Operators are found
+// from the '%lex' patterns of the terminals, a terminal that makes up a
+// whole rule on its own is a number.
+typedef struct _EvalTable {
+  int num_terminals;
+  char *numeric; // terminals whose text is converted while lexing
+  char *op; // operator character of every terminal or 0
+  int num_rules;
+  char *kind;
+  char *arg;
+  char *rule_op;
+} EvalTable;
+
+// Stack bytecode of one expression, one character per instruction. The code
+// says nothing about the values of the numbers, so expressions with the
+// same code have the same shape and can be evaluated together.
+typedef struct _EvalProg {
+  char *code; // '\0' terminated
+  int len;
+  int cap;
+  double *consts; // pushed by the EVAL_OP_PUSH instructions in order
+  int num_consts;
+  int consts_cap;
+  int depth; // stack slots needed
+  int shape;
+} EvalProg;
+
+// compiled programs by the text of their expression
+typedef struct _EvalCache {
+  EvalTable *table;
+  HashMap *texts; // expression -> program number
+  HashMap *shapes; // code -> shape number
+  EvalProg *progs;
+  int num_progs;
+  int progs_cap;
+  int num_shapes;
+  int hits;
+  EvalProg scratch; // program being compiled
+  TokBuf *toks; // tokens of the expression being compiled
+} EvalCache;
+
+
+EvalTable *EvalTable_construct(Grammar *g);
+EvalTable *EvalTable_try(Grammar *g, char *why, int why_len);
+void EvalTable_free(EvalTable *table);
+int lr_eval(PTable ptable, EvalTable *table, TokBuf *toks, ParseErrors *errs,
+    double *value);
+int lr_compile(PTable ptable, EvalTable *table, TokBuf *toks,
+    ParseErrors *errs, EvalProg *prog);
+
+EvalCache *EvalCache_construct(EvalTable *table);
+int EvalCache_compile(EvalCache *cache, PTable ptable, Dfa *dfa,
+    const char *in, long start, long end, ParseErrors *errs);
+void EvalCache_free(EvalCache *cache);
+void eval_batch(EvalCache *cache, const int *progs, int num, double *out);
+
+#endif
@@ -0,0 +1,725 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "glr.h"
+
+static void enqueue_reductions(Glr *glr, GssNode *node, GssEdge *edge,
+    int with_empty);
+
+
+/******************************************************************************/
+/* Sets of what was made at the current level                                 */
+/* The same derivation is reached along many paths of the stack, looking it  */
+/* up in a list of the derivations of its node made ambiguous input quartic  */
+/******************************************************************************/
+
+static void GlrSeen_init(GlrSeen *seen)
+{
+  seen->capacity = GLR_SEEN_INIT_CAP;
+  seen->size = 0;
+  seen->slots = calloc(seen->capacity, sizeof(GlrSeenSlot));
+}
+
+static void GlrSeen_clear(GlrSeen *seen)
+{
+  if (seen->size > 0)
+    memset(seen->slots, 0, seen->capacity * sizeof(GlrSeenSlot));
+  seen->size = 0;
+}
+
+static unsigned long hash_word(unsigned long h, unsigned long word)
+{
+  return (h ^ word) * 0x9e3779b97f4a7c15ul;
+}
+
+// slot of the item with 'hash' that 'same' says is 'key', or the empty slot
+// it would go into
+static GlrSeenSlot *GlrSeen_find(GlrSeen *seen, unsigned long hash,
+    int (*same)(void *, void *), void *key)
+{
+  unsigned i = (hash >> 32) & (seen->capacity - 1);
+
+  while (seen->slots[i].item != NULL &&
+      (seen->slots[i].hash != hash || !same(seen->slots[i].item, key)))
+    i = (i + 1) & (seen->capacity - 1);
+  return &seen->slots[i];
+}
+
+// 'slot' is the empty slot GlrSeen_find returned for 'hash'
+static void GlrSeen_add(GlrSeen *seen, GlrSeenSlot *slot, unsigned long hash,
+    void *item)
+{
+  GlrSeenSlot *old = seen->slots;
+  int old_capacity = seen->capacity;
+  unsigned i;
+
+  slot->hash = hash;
+  slot->item = item;
+  if (2 * ++seen->size <= seen->capacity)
+    return;
+  seen->capacity *= 2;
+  seen->slots = calloc(seen->capacity, sizeof(GlrSeenSlot));
+  for (int j = 0; j < old_capacity; j++) {
+    if (old[j].item == NULL)
+      continue;
+    for (i = (old[j].hash >> 32) & (seen->capacity - 1);
+        seen->slots[i].item != NULL; i = (i + 1) & (seen->capacity - 1));
+    seen->slots[i] = old[j];
+  }
+  free(old);
+}
+
+
+/******************************************************************************/
+/* Shared packed parse forest                                                 */
+/******************************************************************************/
+
+static SppfNode *SppfNode_construct(Glr *glr, const char *sym, int start,
+    int end)
+{
+  SppfNode *out = malloc(sizeof(SppfNode));
+  out->sym = sym;
+  out->start = start;
+  out->end = end;
+  out->packed = NULL;
+  out->id = 0;
+  out->next_alloc = glr->sppf_nodes;
+  glr->sppf_nodes = out;
+  return out;
+}
+
+// symbol node for 'sym' over [start, level), there is only ever one
+static SppfNode *sppf_get(Glr *glr, const char *sym, int start)
+{
+  char buf[glr->ptable.key_len];
+  SppfNode **found, *out;
+
+  // on the fast path every reduction makes a new node, the map of the nodes
+  // of this level is only built once the level forks
+  if (glr->forked && glr->level_map == NULL) {
+    glr->level_map = HashMap_construct(sizeof(SppfNode *), MEM_OTHER);
+    for (int i = 0; i < glr->level_sppf_size; i++) {
+      out = glr->level_sppf[i];
+      key_gen(buf, glr->ptable.key_len, out->start, out->sym);
+      HashMap_set(glr->level_map, buf, (void *)&out);
+    }
+  }
+  if (glr->level_map != NULL) {
+    key_gen(buf, glr->ptable.key_len, start, sym);
+    if ((found = (SppfNode **)HashMap_get(glr->level_map, buf, NULL)) != NULL)
+      return *found;
+  }
+
+  out = SppfNode_construct(glr, sym, start, glr->level);
+  if (glr->level_sppf_size == glr->level_sppf_capacity) {
+    glr->level_sppf_capacity *= 2;
+    glr->level_sppf = realloc(glr->level_sppf,
+        glr->level_sppf_capacity * sizeof(SppfNode *));
+  }
+  glr->level_sppf[glr->level_sppf_size++] = out;
+  if (glr->level_map != NULL)
+    HashMap_set(glr->level_map, buf, (void *)&out);
+  return out;
+}
+
+static unsigned long packed_hash(int rule, SppfNode **kids, int m)
+{
+  unsigned long h = hash_word(0, rule);
+
+  for (int i = 0; i < m; i++)
+    h = hash_word(h, (unsigned long)kids[i]);
+  return h;
+}
+
+static int same_packed(void *item, void *key)
+{
+  SppfPacked *a = item, *b = key;
+
+  return a->rule == b->rule &&
+    memcmp(a->kids, b->kids, a->num_kids * sizeof(SppfNode *)) == 0;
+}
+
+// Add the derivation of 'node' by 'rule' from 'kids' unless it is known. On
+// the fast path every node is new, a forked level looks the derivation up
+// in the set of this level: all of its derivations end here, and the rule
+// and the kids are the same only for derivations of the same node.
+static void sppf_add_packed(Glr *glr, SppfNode *node, int rule,
+    SppfNode **kids)
+{
+  SppfPacked *iter, key;
+  GlrSeenSlot *slot = NULL;
+  unsigned long h = 0;
+  int m = GRAMMAR_RULE_LEN(glr->ptable.g, rule);
+
+  if (glr->forked) {
+    key.rule = rule;
+    key.num_kids = m;
+    key.kids = kids;
+    h = packed_hash(rule, kids, m);
+    slot = GlrSeen_find(&glr->packed_seen, h, same_packed, &key);
+    if (slot->item != NULL)
+      return;
+  }
+  iter = malloc(sizeof(SppfPacked));
+  iter->rule = rule;
+  iter->num_kids = m;
+  iter->kids = malloc(m * sizeof(SppfNode *));
+  memcpy(iter->kids, kids, m * sizeof(SppfNode *));
+  iter->next = node->packed;
+  node->packed = iter;
+  if (slot != NULL)
+    GlrSeen_add(&glr->packed_seen, slot, h, iter);
+}
+
+// all nodes reachable from 'root' in postorder, node ids are set to their
+// position in the array plus one
+SppfNode **Sppf_collect(SppfNode *root, int *num_out)
+{
+  int capacity = GLR_INIT_CAP, size = 0, depth = 0, stack_cap = GLR_INIT_CAP;
+  SppfNode **out = malloc(capacity * sizeof(SppfNode *));
+  // explicit stack, left recursive rules make forests as deep as the input
+  SppfNode **nodes = malloc(stack_cap * sizeof(SppfNode *));
+  SppfPacked **packs = malloc(stack_cap * sizeof(SppfPacked *));
+  int *kid_idx = malloc(stack_cap * sizeof(int));
+  SppfNode *node, *kid;
+
+  root->id = -1; // on the stack
+  nodes[0] = root;
+  packs[0] = root->packed;
+  kid_idx[0] = 0;
+  depth = 1;
+  while (depth > 0) {
+    node = nodes[depth - 1];
+    if (packs[depth - 1] != NULL &&
+        kid_idx[depth - 1] == packs[depth - 1]->num_kids) {
+      packs[depth - 1] = packs[depth - 1]->next;
+      kid_idx[depth - 1] = 0;
+      continue;
+    }
+    if (packs[depth - 1] == NULL) {
+      if (size == capacity) {
+        capacity *= 2;
+        out = realloc(out, capacity * sizeof(SppfNode *));
+      }
+      out[size++] = node;
+      node->id = size;
+      depth--;
+      continue;
+    }
+    kid = packs[depth - 1]->kids[kid_idx[depth - 1]++];
+    if (kid->id != 0)
+      continue;
+    if (depth == stack_cap) {
+      stack_cap *= 2;
+      nodes = realloc(nodes, stack_cap * sizeof(SppfNode *));
+      packs = realloc(packs, stack_cap * sizeof(SppfPacked *));
+      kid_idx = realloc(kid_idx, stack_cap * sizeof(int));
+    }
+    kid->id = -1;
+    nodes[depth] = kid;
+    packs[depth] = kid->packed;
+    kid_idx[depth] = 0;
+    depth++;
+  }
+
+  free(nodes);
+  free(packs);
+  free(kid_idx);
+  *num_out = size;
+  return out;
+}
+
+// number of nodes with more than one derivation
+int Sppf_num_ambiguous(SppfNode **nodes, int num)
+{
+  int out = 0;
+
+  for (int i = 0; i < num; i++) {
+    if (nodes[i]->packed != NULL && nodes[i]->packed->next != NULL)
+      out++;
+  }
+  return out;
+}
+
+// one line per node, derivations of ambiguous nodes are separated by '|'
+void Sppf_print(SppfNode **nodes, int num)
+{
+  SppfPacked *iter;
+
+  for (int i = 0; i < num; i++) {
+    printf("#%d %s [%d, %d)", nodes[i]->id, nodes[i]->sym,
+        nodes[i]->start, nodes[i]->end);
+    for (iter = nodes[i]->packed; iter != NULL; iter = iter->next) {
+      printf((iter == nodes[i]->packed) ? " =" : " |");
+      for (int j = 0; j < iter->num_kids; j++)
+        printf(" #%d", iter->kids[j]->id);
+    }
+    printf("\n");
+  }
+}
+
+
+/******************************************************************************/
+/* Graph-structured stack                                                     */
+/******************************************************************************/
+
+static GssNode *GssNode_construct(Glr *glr, int state_no, int level)
+{
+  GssNode *out = malloc(sizeof(GssNode));
+  out->state_no = state_no;
+  out->level = level;
+  out->edges = NULL;
+  out->in_level_parent = 0;
+  out->next_alloc = glr->gss_nodes;
+  glr->gss_nodes = out;
+  return out;
+}
+
+static GssEdge *GssNode_new_edge(GssNode *from, GssNode *to, SppfNode *label)
+{
+  GssEdge *out = malloc(sizeof(GssEdge));
+
+  out->to = to;
+  out->label = label;
+  out->next = from->edges;
+  from->edges = out;
+  if (to->level == from->level)
+    to->in_level_parent = 1;
+  return out;
+}
+
+// returns NULL if the edge is already there
+static GssEdge *GssNode_add_edge(GssNode *from, GssNode *to, SppfNode *label)
+{
+  GssEdge *iter;
+
+  for (iter = from->edges; iter != NULL; iter = iter->next) {
+    if (iter->to == to && iter->label == label)
+      return NULL;
+  }
+  return GssNode_new_edge(from, to, label);
+}
+
+static unsigned long edge_hash(GssNode *to, SppfNode *label)
+{
+  return hash_word(hash_word(0, (unsigned long)to), (unsigned long)label);
+}
+
+static int same_edge(void *item, void *key)
+{
+  GssEdge *a = item, *b = key;
+
+  return a->to == b->to && a->label == b->label;
+}
+
+// GssNode_add_edge for the edge of a reduction at a forked level, 'from'
+// is the node for the goto state of 'to' and the symbol of 'label', so the
+// edge is looked up in the set of this level by 'to' and 'label' alone
+static GssEdge *GssNode_add_reduced_edge(Glr *glr, GssNode *from, GssNode *to,
+    SppfNode *label)
+{
+  GssEdge key, *out;
+  GlrSeenSlot *slot;
+  unsigned long h = edge_hash(to, label);
+
+  key.to = to;
+  key.label = label;
+  slot = GlrSeen_find(&glr->edge_seen, h, same_edge, &key);
+  if (slot->item != NULL)
+    return NULL;
+  out = GssNode_new_edge(from, to, label);
+  GlrSeen_add(&glr->edge_seen, slot, h, out);
+  return out;
+}
+
+static GssNode *nodes_find(GssNode **nodes, int size, int state_no)
+{
+  for (int i = 0; i < size; i++) {
+    if (nodes[i]->state_no == state_no)
+      return nodes[i];
+  }
+  return NULL;
+}
+
+static void nodes_push(GssNode ***nodes, int *size, int *capacity,
+    GssNode *node)
+{
+  if (*size == *capacity) {
+    *capacity *= 2;
+    *nodes = realloc(*nodes, *capacity * sizeof(GssNode *));
+  }
+  (*nodes)[(*size)++] = node;
+}
+
+
+/******************************************************************************/
+/* Reductions                                                                 */
+/******************************************************************************/
+
+static int goto_state(Glr *glr, GssNode *node, const char *sym)
+{
+  char buf[glr->ptable.key_len];
+  int *out;
+
+  key_gen(buf, glr->ptable.key_len, node->state_no, sym);
+  if ((out = (int *)HashMap_get(glr->ptable.goto_t, buf, NULL)) == NULL) {
+    error("state %d needs to have a goto state for symbol '%s'",
+        node->state_no, sym);
+  }
+  return *out;
+}
+
+static void enqueue_reductions(Glr *glr, GssNode *node, GssEdge *edge,
+    int with_empty)
+{
+  Grammar *g = glr->ptable.g;
+  Action *acts;
+  GlrReduction *r;
+  int n;
+
+  acts = action_get_all(glr->ptable, node->state_no,
+      glr->toks->types[glr->level], &n);
+  for (int i = 0; i < n; i++) {
+    if (acts[i].act_type == SHIFT)
+      continue;
+    if (GRAMMAR_RULE_LEN(g, acts[i].act_instr.red_rule) == 0 && !with_empty)
+      continue;
+    if (glr->queue_size == glr->queue_capacity) {
+      glr->queue_capacity *= 2;
+      glr->queue = realloc(glr->queue,
+          glr->queue_capacity * sizeof(GlrReduction));
+    }
+    r = &glr->queue[glr->queue_size++];
+    r->node = node;
+    r->edge = (GRAMMAR_RULE_LEN(g, acts[i].act_instr.red_rule) == 0) ?
+      NULL : edge;
+    r->rule = acts[i].act_instr.red_rule;
+    r->accept = (acts[i].act_type == ACCEPT);
+  }
+}
+
+// the reduction reached 'w', push the reduced symbol onto it
+static void reduce_finish(Glr *glr, GlrReduction *r, GssNode *w,
+    SppfNode **kids)
+{
+  Grammar *g = glr->ptable.g;
+  const char *sym = Grammar_name(g, g->rule_lhs[r->rule]);
+  SppfNode *sym_node = sppf_get(glr, sym, w->level);
+  GssNode *u;
+  GssEdge *e;
+  int state_no;
+
+  sppf_add_packed(glr, sym_node, r->rule, kids);
+  if (r->accept && w == glr->bottom) {
+    glr->root_node = sym_node;
+    return;
+  }
+
+  state_no = goto_state(glr, w, sym);
+  if ((u = nodes_find(glr->frontier, glr->frontier_size, state_no)) == NULL) {
+    u = GssNode_construct(glr, state_no, glr->level);
+    nodes_push(&glr->frontier, &glr->frontier_size, &glr->frontier_capacity,
+        u);
+    GssNode_add_reduced_edge(glr, u, w, sym_node);
+    enqueue_reductions(glr, u, NULL, 1);
+    return;
+  }
+  if ((e = GssNode_add_reduced_edge(glr, u, w, sym_node)) == NULL)
+    return;
+  if (u->in_level_parent) {
+    // nodes of this level that were reduced before may have paths through
+    // the new edge now, so their reductions have to be done again
+    for (int i = 0; i < glr->frontier_size; i++)
+      enqueue_reductions(glr, glr->frontier[i], NULL, 0);
+  } else {
+    enqueue_reductions(glr, u, e, 0);
+  }
+}
+
+// walk 'remaining' edges down from 'v' collecting the symbol nodes
+static void reduce_paths(Glr *glr, GlrReduction *r, GssNode *v,
+    GssEdge *first, int remaining, SppfNode **kids)
+{
+  GssEdge *e;
+
+  if (remaining == 0) {
+    reduce_finish(glr, r, v, kids);
+    return;
+  }
+  for (e = (first != NULL) ? first : v->edges; e != NULL;
+      e = (first != NULL) ? NULL : e->next) {
+    kids[remaining - 1] = e->label;
+    reduce_paths(glr, r, e->to, NULL, remaining - 1, kids);
+  }
+}
+
+// Single stack and a single action: this is just the LR driver, the reduced
+// node replaces the top of the stack and nothing needs to be merged.
+// Returns 0 once the level has to fork or only shifts are left.
+static int reduce_fast(Glr *glr)
+{
+  Grammar *g = glr->ptable.g;
+  SppfNode **kids = glr->kids;
+  SppfNode *sym_node;
+  GssNode *v = glr->frontier[0], *w, *u;
+  Action *act;
+  const char *sym;
+  int rule, n, k;
+
+  act = action_get_all(glr->ptable, v->state_no,
+      glr->toks->types[glr->level], &n);
+  if (n != 1 || act->act_type == SHIFT)
+    return 0;
+  rule = act->act_instr.red_rule;
+  for (w = v, k = GRAMMAR_RULE_LEN(g, rule) - 1; k >= 0; k--) {
+    if (w->edges == NULL || w->edges->next != NULL)
+      return 0;
+    kids[k] = w->edges->label;
+    w = w->edges->to;
+  }
+
+  sym = Grammar_name(g, g->rule_lhs[rule]);
+  sym_node = sppf_get(glr, sym, w->level);
+  sppf_add_packed(glr, sym_node, rule, kids);
+  if (act->act_type == ACCEPT && w == glr->bottom) {
+    glr->root_node = sym_node;
+    glr->frontier_size = 0;
+    return 0;
+  }
+  u = GssNode_construct(glr, goto_state(glr, w, sym), glr->level);
+  GssNode_add_edge(u, w, sym_node);
+  glr->frontier[0] = u;
+  return 1;
+}
+
+static int has_reductions(Glr *glr, GssNode *node)
+{
+  Action *acts;
+  int n;
+
+  acts = action_get_all(glr->ptable, node->state_no,
+      glr->toks->types[glr->level], &n);
+  for (int i = 0; i < n; i++) {
+    if (acts[i].act_type != SHIFT)
+      return 1;
+  }
+  return 0;
+}
+
+// the derivations and edges the fast path made at this level go into the
+// sets before the level forks
+static void seen_fill(Glr *glr)
+{
+  GlrSeenSlot *slot;
+  SppfPacked *packed;
+  GssEdge *e;
+  unsigned long h;
+
+  for (int i = 0; i < glr->level_sppf_size; i++) {
+    for (packed = glr->level_sppf[i]->packed; packed != NULL;
+        packed = packed->next) {
+      h = packed_hash(packed->rule, packed->kids, packed->num_kids);
+      slot = GlrSeen_find(&glr->packed_seen, h, same_packed, packed);
+      if (slot->item == NULL)
+        GlrSeen_add(&glr->packed_seen, slot, h, packed);
+    }
+  }
+  for (int i = 0; i < glr->frontier_size; i++) {
+    for (e = glr->frontier[i]->edges; e != NULL; e = e->next) {
+      h = edge_hash(e->to, e->label);
+      slot = GlrSeen_find(&glr->edge_seen, h, same_edge, e);
+      if (slot->item == NULL)
+        GlrSeen_add(&glr->edge_seen, slot, h, e);
+    }
+  }
+}
+
+static void reduce_all(Glr *glr)
+{
+  GlrReduction r;
+  int i;
+
+  glr->forked = 1;
+  seen_fill(glr);
+  glr->queue_size = 0;
+  for (i = 0; i < glr->frontier_size; i++)
+    enqueue_reductions(glr, glr->frontier[i], NULL, 1);
+  for (i = 0; i < glr->queue_size; i++) {
+    r = glr->queue[i]; // the queue may be reallocated while reducing
+    reduce_paths(glr, &r, r.node, r.edge,
+        GRAMMAR_RULE_LEN(glr->ptable.g, r.rule), glr->kids);
+  }
+}
+
+
+/******************************************************************************/
+/* Driver                                                                     */
+/******************************************************************************/
+
+// report the error with what any of the stacks could have taken
+static void glr_error(Glr *glr, ParseErrors *errs)
+{
+  TokBuf *toks = glr->toks;
+  ParseError *err;
+  int i, j, k;
+
+  ParseErrors_add(errs, glr->ptable, glr->frontier[0]->state_no,
+      toks->types[glr->level], toks->offsets[glr->level],
+      toks->lengths[glr->level]);
+  err = &errs->errs[errs->size - 1];
+  for (i = 1; i < glr->frontier_size; i++) {
+    for (j = 0; j < glr->ptable.g->num_terms; j++) {
+      if (action_get(glr->ptable, glr->frontier[i]->state_no, j) == NULL)
+        continue;
+      for (k = 0; k < err->num_expected && err->expected[k] != j; k++);
+      if (k == err->num_expected)
+        err->expected[err->num_expected++] = j;
+    }
+  }
+}
+
+// Tomita style GLR parse of the token buffer. All stacks are advanced one
+// token at a time: first every possible reduction is done, then every stack
+// that can shift the token does. Stacks that reach the same state at the
+// same token are merged, so the work stays polynomial even for ambiguous
+// grammars. As long as there is only one stack and one action per cell this
+// is the plain LR driver.
+// There is no error recovery, parsing stops at the first token no stack
+// can shift.
+Glr *glr_parse(PTable ptable, TokBuf *toks, ParseErrors *errs)
+{
+  Glr *out = malloc(sizeof(Glr));
+  GssNode *v, *u;
+  SppfNode *term;
+  Action *acts;
+  GssNode **tmp;
+  int n, tmp_cap, max_len;
+
+  out->ptable = ptable;
+  out->toks = toks;
+  out->gss_nodes = NULL;
+  out->sppf_nodes = NULL;
+  out->root_node = NULL;
+  out->frontier_capacity = out->next_capacity = GLR_INIT_CAP;
+  out->frontier = malloc(out->frontier_capacity * sizeof(GssNode *));
+  out->next = malloc(out->next_capacity * sizeof(GssNode *));
+  out->queue_capacity = GLR_INIT_CAP;
+  out->queue = malloc(out->queue_capacity * sizeof(GlrReduction));
+  out->level_sppf_capacity = GLR_INIT_CAP;
+  out->level_sppf = malloc(out->level_sppf_capacity * sizeof(SppfNode *));
+  out->level_map = NULL;
+  GlrSeen_init(&out->packed_seen);
+  GlrSeen_init(&out->edge_seen);
+  max_len = 1;
+  for (int r = 0; r < ptable.g->num_rules; r++) {
+    if (GRAMMAR_RULE_LEN(ptable.g, r) > max_len)
+      max_len = GRAMMAR_RULE_LEN(ptable.g, r);
+  }
+  out->kids = malloc(max_len * sizeof(SppfNode *));
+  out->det_levels = out->forked_levels = 0;
+
+  out->bottom = GssNode_construct(out, 0, 0);
+  out->frontier[0] = out->bottom;
+  out->frontier_size = 1;
+
+  for (out->level = 0; ; out->level++) {
+    out->forked = 0;
+    out->level_sppf_size = 0;
+    while (out->frontier_size == 1 && reduce_fast(out));
+    if (out->frontier_size > 1 ||
+        (out->frontier_size == 1 && has_reductions(out, out->frontier[0]))) {
+      reduce_all(out);
+    }
+    if (out->forked)
+      out->forked_levels++;
+    else
+      out->det_levels++;
+    if (out->level_map != NULL) {
+      HashMap_deconstruct(out->level_map);
+      out->level_map = NULL;
+    }
+    GlrSeen_clear(&out->packed_seen);
+    GlrSeen_clear(&out->edge_seen);
+
+    if (toks->types[out->level] == NONE) {
+      if (out->root_node == NULL && out->frontier_size > 0)
+        glr_error(out, errs);
+      break;
+    }
+
+    out->next_size = 0;
+    term = NULL;
+    for (int i = 0; i < out->frontier_size; i++) {
+      v = out->frontier[i];
+      acts = action_get_all(ptable, v->state_no, toks->types[out->level], &n);
+      for (int j = 0; j < n; j++) {
+        if (acts[j].act_type != SHIFT)
+          continue;
+        if (term == NULL) {
+          term = SppfNode_construct(out,
+              Grammar_name(ptable.g, toks->types[out->level]),
+              out->level, out->level + 1);
+        }
+        if ((u = nodes_find(out->next, out->next_size,
+                acts[j].act_instr.state_no)) == NULL) {
+          u = GssNode_construct(out, acts[j].act_instr.state_no,
+              out->level + 1);
+          nodes_push(&out->next, &out->next_size, &out->next_capacity, u);
+        }
+        GssNode_add_edge(u, v, term);
+      }
+    }
+    if (out->next_size == 0) {
+      glr_error(out, errs);
+      break;
+    }
+
+    tmp = out->frontier;
+    out->frontier = out->next;
+    out->next = tmp;
+    tmp_cap = out->frontier_capacity;
+    out->frontier_capacity = out->next_capacity;
+    out->next_capacity = tmp_cap;
+    out->frontier_size = out->next_size;
+  }
+
+  return out;
+}
+
+void Glr_free(Glr *glr)
+{
+  GssNode *node, *next_node;
+  GssEdge *edge, *next_edge;
+  SppfNode *sppf, *next_sppf;
+  SppfPacked *packed, *next_packed;
+
+  for (node = glr->gss_nodes; node != NULL; node = next_node) {
+    next_node = node->next_alloc;
+    for (edge = node->edges; edge != NULL; edge = next_edge) {
+      next_edge = edge->next;
+      free(edge);
+    }
+    free(node);
+  }
+  for (sppf = glr->sppf_nodes; sppf != NULL; sppf = next_sppf) {
+    next_sppf = sppf->next_alloc;
+    for (packed = sppf->packed; packed != NULL; packed = next_packed) {
+      next_packed = packed->next;
+      free(packed->kids);
+      free(packed);
+    }
+    free(sppf);
+  }
+  free(glr->frontier);
+  free(glr->next);
+  free(glr->queue);
+  free(glr->level_sppf);
+  free(glr->packed_seen.slots);
+  free(glr->edge_seen.slots);
+  free(glr->kids);
+  free(glr);
+}
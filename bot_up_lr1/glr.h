@@ -0,0 +1,106 @@
+#ifndef GLR_H
+#define GLR_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+
+#define GLR_INIT_CAP 16
+#define GLR_SEEN_INIT_CAP 64
+
+
+// shared packed parse forest: one node per symbol and span of tokens with one
+// packed node for every way it was derived
+typedef struct _SppfPacked {
+  int rule; // rule of the compiled grammar
+  int num_kids;
+  struct _SppfNode **kids;
+  struct _SppfPacked *next;
+} SppfPacked;
+
+typedef struct _SppfNode {
+  const char *sym;
+  int start; // token indices, the node covers tokens [start, end)
+  int end;
+  SppfPacked *packed; // NULL for terminals
+  int id; // set while printing
+  struct _SppfNode *next_alloc;
+} SppfNode;
+
+
+// graph-structured stack: stacks that share a prefix share its nodes
+typedef struct _GssEdge {
+  struct _GssNode *to;
+  SppfNode *label;
+  struct _GssEdge *next;
+} GssEdge;
+
+typedef struct _GssNode {
+  int state_no;
+  int level; // number of tokens shifted before the node was pushed
+  GssEdge *edges;
+  int in_level_parent; // a node of the same level has an edge to this one
+  struct _GssNode *next_alloc;
+} GssNode;
+
+// reduction by 'rule' along the paths from 'node' that start with 'edge'
+// or along all of them if 'edge' is NULL
+typedef struct _GlrReduction {
+  GssNode *node;
+  GssEdge *edge;
+  int rule;
+  int accept;
+} GlrReduction;
+
+// open addressing set of the packed nodes or edges made at the current level
+typedef struct _GlrSeenSlot {
+  unsigned long hash;
+  void *item; // NULL if empty
+} GlrSeenSlot;
+
+typedef struct _GlrSeen {
+  GlrSeenSlot *slots;
+  int size;
+  int capacity; // a power of 2
+} GlrSeen;
+
+typedef struct _Glr {
+  PTable ptable;
+  TokBuf *toks;
+  GssNode *bottom;
+  GssNode **frontier; // top nodes of all stacks at the current level
+  int frontier_size;
+  int frontier_capacity;
+  GssNode **next;
+  int next_size;
+  int next_capacity;
+  GlrReduction *queue;
+  int queue_size;
+  int queue_capacity;
+  SppfNode **level_sppf; // symbol nodes that end at the current level
+  int level_sppf_size;
+  int level_sppf_capacity;
+  SppfNode **kids; // symbol nodes of a reduction, as long as the longest rule
+  HashMap *level_map; // "start sym" to symbol node, only while forked
+  // derivations and edges of this level, only while forked: a rule and its
+  // kids decide the symbol node and a lower node and a label decide the
+  // node the edge is from, so neither needs to be compared with its siblings
+  GlrSeen packed_seen;
+  GlrSeen edge_seen;
+  int level; // index of the lookahead token
+  int forked; // the current level is not parsed on the fast path
+  SppfNode *root_node;
+  GssNode *gss_nodes; // everything allocated, for freeing
+  SppfNode *sppf_nodes;
+  // statistics
+  int det_levels; // levels parsed on the single stack fast path
+  int forked_levels;
+} Glr;
+
+
+Glr *glr_parse(PTable ptable, TokBuf *toks, ParseErrors *errs);
+SppfNode **Sppf_collect(SppfNode *root, int *num_out);
+int Sppf_num_ambiguous(SppfNode **nodes, int num);
+void Sppf_print(SppfNode **nodes, int num);
+void Glr_free(Glr *glr);
+
+#endif
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "incr_parse.h"
+
+static void checkpoint_take(IncrParse *ip, ParseRun *run);
+static int on_shift(ParseRun *run, void *arg);
+
+
+/******************************************************************************/
+/* Checkpoints                                                                */
+/* The parse can be resumed from any checkpoint because the parser state is   */
+/* just the stack, the position and how far error recovery has got            */
+/******************************************************************************/
+
+static int shifts_clamp(int shifts)
+{
+  return (shifts > ERR_RECOVERY_SHIFTS) ? ERR_RECOVERY_SHIFTS : shifts;
+}
+
+static void checkpoint_take(IncrParse *ip, ParseRun *run)
+{
+  ParseCheckpoint *cp;
+  ParseStack *iter;
+  int i;
+
+  if (ip->num_cps == ip->cps_capacity) {
+    ip->cps_capacity *= 2;
+    ip->cps = realloc(ip->cps, ip->cps_capacity * sizeof(ParseCheckpoint));
+  }
+  cp = &ip->cps[ip->num_cps++];
+  cp->tok_idx = run->tok_idx;
+  cp->shifts = shifts_clamp(run->shifts);
+  cp->num_errors = ip->errs->size;
+  cp->depth = 0;
+  for (iter = run->pstack; iter != NULL; iter = iter->next)
+    cp->depth++;
+  cp->states = malloc(cp->depth * sizeof(int));
+  cp->syms = malloc(cp->depth * sizeof(char *));
+  for (i = 0, iter = run->pstack; iter != NULL; i++, iter = iter->next) {
+    cp->states[i] = iter->state_no;
+    cp->syms[i] = iter->sym;
+  }
+}
+
+// 1 if resuming from 'cp' would do exactly what 'run' does from here on
+static int checkpoint_matches(ParseCheckpoint *cp, ParseRun *run)
+{
+  ParseStack *iter;
+  int i;
+
+  if (cp->shifts != shifts_clamp(run->shifts))
+    return 0;
+  for (i = 0, iter = run->pstack; iter != NULL && i < cp->depth;
+      i++, iter = iter->next) {
+    if (iter->state_no != cp->states[i])
+      return 0;
+  }
+  return iter == NULL && i == cp->depth;
+}
+
+static void checkpoint_restore(ParseCheckpoint *cp, ParseRun *run)
+{
+  run->pstack = NULL;
+  for (int i = cp->depth - 1; i >= 0; i--)
+    run->pstack = ParseStack_push(run->pstack, cp->syms[i], cp->states[i]);
+  run->tok_idx = cp->tok_idx;
+  run->shifts = cp->shifts;
+}
+
+static void checkpoint_free(ParseCheckpoint *cp)
+{
+  free(cp->states);
+  free(cp->syms);
+}
+
+// Checkpoints are taken every CHECKPOINT_INTERVAL tokens up to the end of
+// the edit. Past it the parse is compared against the old checkpoints so it
+// can stop as soon as it is back in a state the old parse was in, and new
+// checkpoints are only taken where old ones were to keep their spacing.
+static int on_shift(ParseRun *run, void *arg)
+{
+  IncrSync *sync = (IncrSync *)arg;
+  IncrParse *ip = sync->ip;
+  ParseCheckpoint *cp;
+  int n = run->tok_idx;
+
+  if (n < sync->sync_from) {
+    if (n % CHECKPOINT_INTERVAL == 0)
+      checkpoint_take(ip, run);
+    return 0;
+  }
+
+  while (sync->next_old < sync->num_old_cps &&
+      sync->old_cps[sync->next_old].tok_idx + sync->delta_tok < n)
+    sync->next_old++;
+  if (sync->next_old == sync->num_old_cps ||
+      sync->old_cps[sync->next_old].tok_idx + sync->delta_tok != n)
+    return 0;
+
+  cp = &sync->old_cps[sync->next_old];
+  // if the old parse ran out of errors it stopped early, so its tail can only
+  // be reused if this parse has not made fewer errors up to here
+  if (checkpoint_matches(cp, run) &&
+      !(sync->old_errs->size >= sync->old_errs->max_errors &&
+        ip->errs->size < cp->num_errors)) {
+    sync->matched = sync->next_old;
+    return 1;
+  }
+  checkpoint_take(ip, run);
+  sync->next_old++;
+  return 0;
+}
+
+
+/******************************************************************************/
+/* Re-lexing                                                                  */
+/******************************************************************************/
+
+// first real token that ends at or after 'pos', or the NONE token
+static int tok_find_end(TokBuf *toks, long pos)
+{
+  int lo = 0, hi = toks->size - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (toks->offsets[mid] + toks->lengths[mid] >= pos)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+// real token that starts exactly at 'offset' or -1
+static int tok_find_offset(TokBuf *toks, long offset)
+{
+  int lo = 0, hi = toks->size - 2, mid;
+
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (toks->offsets[mid] == offset)
+      return mid;
+    if (toks->offsets[mid] < offset)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return -1;
+}
+
+// Lex the new text from 'pos' in windows that double in size until a token
+// after the edit starts where an old token started. From there on the text
+// is the same as before, so the old tokens are still right.
+// Returns the number of new tokens in 'win' and sets 'j_out' to the index of
+// the first old token to keep.
+static int relex(IncrParse *ip, TokBuf *win, long pos, long edit_end,
+    long delta, int *j_out)
+{
+  TokBuf *old = ip->toks;
+  long window = RELEX_WINDOW, end;
+  int checked = 0, before, j, k;
+
+  while (1) {
+    end = (pos + window < ip->len) ? pos + window : ip->len;
+    before = win->size;
+    Dfa_scan(ip->dfa, ip->text, pos, end, win);
+    ip->relexed += win->size - before;
+
+    // the last token might have been cut off by the window, scan it again
+    if (end < ip->len && win->size > before) {
+      win->size--;
+      pos = win->offsets[win->size];
+    }
+
+    for (k = checked; k < win->size; k++) {
+      if (win->offsets[k] < edit_end)
+        continue;
+      j = tok_find_offset(old, win->offsets[k] - delta);
+      if (j >= 0 && old->types[j] == win->types[k] &&
+          old->lengths[j] == win->lengths[k]) {
+        *j_out = j;
+        return k;
+      }
+    }
+    checked = win->size;
+
+    if (end == ip->len) {
+      *j_out = old->size - 1;
+      return win->size;
+    }
+    window *= 2;
+  }
+}
+
+// replace old tokens [i0, j) by win[0:k] and move the tokens after the edit
+static void tokens_splice(TokBuf *toks, int i0, int j, TokBuf *win, int k,
+    long delta)
+{
+  int tail = toks->size - j;
+  int new_size = i0 + k + tail;
+
+  if (new_size > toks->capacity) {
+    while (toks->capacity < new_size)
+      toks->capacity *= 2;
+    toks->types = realloc(toks->types, toks->capacity * sizeof(TokType));
+    toks->offsets = realloc(toks->offsets, toks->capacity * sizeof(long));
+    toks->lengths = realloc(toks->lengths, toks->capacity * sizeof(int));
+  }
+  memmove(toks->types + i0 + k, toks->types + j, tail * sizeof(TokType));
+  memmove(toks->offsets + i0 + k, toks->offsets + j, tail * sizeof(long));
+  memmove(toks->lengths + i0 + k, toks->lengths + j, tail * sizeof(int));
+  for (int i = i0 + k; i < new_size; i++)
+    toks->offsets[i] += delta;
+  memcpy(toks->types + i0, win->types, k * sizeof(TokType));
+  memcpy(toks->offsets + i0, win->offsets, k * sizeof(long));
+  memcpy(toks->lengths + i0, win->lengths, k * sizeof(int));
+  toks->size = new_size;
+}
+
+
+/******************************************************************************/
+/* Incremental parse                                                          */
+/******************************************************************************/
+
+// move an error from an old error list, returns 1 if the budget is used up
+static int errors_move(ParseErrors *errs, ParseError *err, long delta)
+{
+  if (errs->size >= errs->max_errors)
+    return 1;
+  ParseErrors_grow(errs);
+  errs->errs[errs->size] = *err;
+  errs->errs[errs->size].offset += delta;
+  errs->size++;
+  err->expected = NULL;
+  return 0;
+}
+
+IncrParse *IncrParse_construct(PTable ptable, const char *root, Dfa *dfa,
+    const char *text, long len, int num_threads, int max_errors)
+{
+  IncrParse *out = malloc(sizeof(IncrParse));
+  IncrSync sync;
+  ParseRun run;
+
+  out->ptable = ptable;
+  out->root = root;
+  out->dfa = dfa;
+  out->len = len;
+  out->text = malloc(len + 1);
+  memcpy(out->text, text, len);
+  out->toks = lex_parallel(dfa, out->text, len, num_threads, NULL);
+  out->errs = ParseErrors_construct(max_errors);
+  out->cps_capacity = 16;
+  out->num_cps = 0;
+  out->cps = malloc(out->cps_capacity * sizeof(ParseCheckpoint));
+
+  sync.ip = out;
+  sync.sync_from = INT_MAX;
+  sync.delta_tok = 0;
+  sync.old_cps = NULL;
+  sync.num_old_cps = 0;
+  sync.next_old = 0;
+  sync.old_errs = NULL;
+  sync.matched = -1;
+
+  ParseRun_init(&run, root);
+  checkpoint_take(out, &run);
+  out->accepted =
+    (lr_parse(ptable, out->toks, out->errs, &run, on_shift, &sync) ==
+     PARSE_ACCEPT);
+  ParseStack_free(run.pstack);
+
+  out->relexed = out->toks->size - 1;
+  out->reparsed = run.tok_idx;
+  return out;
+}
+
+// replace 'old_len' bytes at 'start' by 'new_text' and bring the tokens,
+// errors and result up to date
+void IncrParse_edit(IncrParse *ip, long start, long old_len,
+    const char *new_text, long new_len)
+{
+  TokBuf *toks = ip->toks;
+  TokBuf *win;
+  ParseErrors *old_errs;
+  ParseCheckpoint *cp;
+  IncrSync sync;
+  ParseRun run;
+  long delta = new_len - old_len;
+  long pos;
+  int f, i0, j, k, c, t, i, res;
+
+  if (start < 0 || old_len < 0 || start + old_len > ip->len) {
+    error("edit of %ld bytes at offset %ld is outside of the input",
+        old_len, start);
+  }
+
+  if (delta > 0)
+    ip->text = realloc(ip->text, ip->len + delta + 1);
+  memmove(ip->text + start + new_len, ip->text + start + old_len,
+      ip->len - start - old_len);
+  memcpy(ip->text + start, new_text, new_len);
+  ip->len += delta;
+
+  // longest match may have looked past the end of a token, so lexing starts
+  // again one token before the first one the edit touches
+  f = tok_find_end(toks, start);
+  i0 = (f > 0) ? f - 1 : 0;
+  // a run of bad bytes right before would have been merged with new ones
+  if (i0 > 0 && toks->types[i0 - 1] == LEX_ERROR &&
+      toks->offsets[i0 - 1] + toks->lengths[i0 - 1] == toks->offsets[i0])
+    i0--;
+  pos = (f > 0) ? toks->offsets[i0] : 0;
+
+  ip->relexed = 0;
+  win = TokBuf_construct(0, NULL);
+  k = relex(ip, win, pos, start + new_len, delta, &j);
+  tokens_splice(toks, i0, j, win, k, delta);
+  TokBuf_free(win);
+
+  // resume from the last checkpoint before the edit, the old checkpoints
+  // after it are what the new parse tries to line up with
+  for (c = ip->num_cps - 1; ip->cps[c].tok_idx > i0; c--);
+  for (t = c + 1; t < ip->num_cps && ip->cps[t].tok_idx < j; t++);
+  for (i = c + 1; i < t; i++)
+    checkpoint_free(&ip->cps[i]);
+
+  sync.ip = ip;
+  sync.sync_from = i0 + k;
+  sync.delta_tok = i0 + k - j;
+  sync.num_old_cps = ip->num_cps - t;
+  sync.old_cps = malloc((sync.num_old_cps + 1) * sizeof(ParseCheckpoint));
+  memcpy(sync.old_cps, ip->cps + t, sync.num_old_cps * sizeof(ParseCheckpoint));
+  sync.next_old = 0;
+  sync.matched = -1;
+  ip->num_cps = c + 1;
+  cp = &ip->cps[c];
+
+  old_errs = ip->errs;
+  sync.old_errs = old_errs;
+  ip->errs = ParseErrors_construct(old_errs->max_errors);
+  for (i = 0; i < cp->num_errors; i++)
+    errors_move(ip->errs, &old_errs->errs[i], 0);
+
+  checkpoint_restore(cp, &run);
+  res = lr_parse(ip->ptable, toks, ip->errs, &run, on_shift, &sync);
+  ip->reparsed = run.tok_idx - cp->tok_idx;
+  ParseStack_free(run.pstack);
+
+  if (res == PARSE_STOPPED) {
+    // the rest of the old parse still holds, shifted by the edit
+    int base = sync.old_cps[sync.matched].num_errors;
+    int num_errors = ip->errs->size;
+
+    for (i = base; i < old_errs->size; i++) {
+      if (errors_move(ip->errs, &old_errs->errs[i], delta))
+        break;
+    }
+    for (i = 0; i < sync.num_old_cps; i++) {
+      cp = &sync.old_cps[i];
+      cp->num_errors += num_errors - base;
+      if (i < sync.matched || cp->num_errors >= ip->errs->max_errors) {
+        checkpoint_free(cp);
+        continue;
+      }
+      cp->tok_idx += sync.delta_tok;
+      if (ip->num_cps == ip->cps_capacity) {
+        ip->cps_capacity *= 2;
+        ip->cps = realloc(ip->cps, ip->cps_capacity * sizeof(ParseCheckpoint));
+      }
+      ip->cps[ip->num_cps++] = *cp;
+    }
+    ip->accepted = ip->accepted && ip->errs->size < ip->errs->max_errors;
+  } else {
+    for (i = 0; i < sync.num_old_cps; i++)
+      checkpoint_free(&sync.old_cps[i]);
+    ip->accepted = (res == PARSE_ACCEPT);
+  }
+
+  free(sync.old_cps);
+  ParseErrors_free(old_errs);
+}
+
+int IncrParse_correct(IncrParse *ip)
+{
+  return ip->accepted && ip->errs->size == 0;
+}
+
+void IncrParse_free(IncrParse *ip)
+{
+  for (int i = 0; i < ip->num_cps; i++)
+    checkpoint_free(&ip->cps[i]);
+  free(ip->cps);
+  ParseErrors_free(ip->errs);
+  TokBuf_free(ip->toks);
+  free(ip->text);
+  free(ip);
+}
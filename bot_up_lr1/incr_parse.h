@@ -0,0 +1,63 @@
+#ifndef INCR_PARSE_H
+#define INCR_PARSE_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+#include "dfa_lex.h"
+#include "driver.h"
+
+// a checkpoint is taken after a shift every CHECKPOINT_INTERVAL tokens
+#define CHECKPOINT_INTERVAL 1024
+// first window of input that is re-lexed after an edit, doubled until the
+// new tokens line up with the old ones again
+#define RELEX_WINDOW 256
+
+// snapshot of the parser right after shifting token tok_idx - 1
+typedef struct _ParseCheckpoint {
+  int tok_idx;
+  int depth;
+  int *states; // parse stack from the top down
+  const char **syms;
+  int shifts; // clamped to ERR_RECOVERY_SHIFTS
+  int num_errors;
+} ParseCheckpoint;
+
+// a document that is kept parsed across edits
+typedef struct _IncrParse {
+  PTable ptable;
+  const char *root;
+  Dfa *dfa;
+  char *text;
+  long len;
+  TokBuf *toks;
+  ParseCheckpoint *cps;
+  int num_cps;
+  int cps_capacity;
+  ParseErrors *errs;
+  int accepted;
+  // work done for the last edit
+  int relexed;
+  int reparsed;
+} IncrParse;
+
+// state of the shift callback while reparsing after an edit
+typedef struct _IncrSync {
+  IncrParse *ip;
+  int sync_from; // first new token index that lies after the edit
+  int delta_tok; // new token index - old token index after the edit
+  ParseCheckpoint *old_cps; // old checkpoints after the edit
+  int num_old_cps;
+  int next_old;
+  ParseErrors *old_errs;
+  int matched; // index into old_cps of the checkpoint that matched or -1
+} IncrSync;
+
+
+IncrParse *IncrParse_construct(PTable ptable, const char *root, Dfa *dfa,
+    const char *text, long len, int num_threads, int max_errors);
+void IncrParse_edit(IncrParse *ip, long start, long old_len,
+    const char *new_text, long new_len);
+int IncrParse_correct(IncrParse *ip);
+void IncrParse_free(IncrParse *ip);
+
+#endif
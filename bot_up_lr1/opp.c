@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "dfa_lex.h"
+#include "opp.h"
+
+
+/******************************************************************************/
+/* Binding powers from the grammar                                            */
+/* Expression grammars are written as one non-terminal per precedence level,  */
+/* from the root (lowest) down to the primary expressions:                    */
+/*   expr: expr T_PLUS term | term      left associative                      */
+/*   pow: atom T_POW pow | atom         right associative                     */
+/*   factor: T_LBRACKET expr T_RBRACKET | T_NUMBER                            */
+/******************************************************************************/
+
+static void set_kind(OpTable *table, Grammar *g, int sym, char kind)
+{
+  if (table->kind[sym] != OP_NONE &&
+      (table->kind[sym] != kind || kind == OP_BINARY)) {
+    error("not an operator grammar: terminal '%s' is used in more than one "
+        "place", Grammar_name(g, sym));
+  }
+  table->kind[sym] = kind;
+}
+
+static void set_binary(OpTable *table, Grammar *g, int sym, int lbp, int rbp)
+{
+  set_kind(table, g, sym, OP_BINARY);
+  table->lbp[sym] = lbp;
+  table->rbp[sym] = rbp;
+}
+
+// the rules of the last level: terminals and the root in brackets
+static void add_primary(OpTable *table, Grammar *g, int rule)
+{
+  const int *rhs = GRAMMAR_RULE_RHS(g, rule);
+  int len = GRAMMAR_RULE_LEN(g, rule);
+
+  if (len == 1 && GRAMMAR_IS_TERM(g, rhs[0])) {
+    set_kind(table, g, rhs[0], OP_ATOM);
+  } else if (len == 3 && GRAMMAR_IS_TERM(g, rhs[0]) && rhs[1] == g->start &&
+      GRAMMAR_IS_TERM(g, rhs[2])) {
+    set_kind(table, g, rhs[0], OP_OPEN);
+    set_kind(table, g, rhs[2], OP_CLOSE);
+    if (table->close[rhs[0]] != NONE && table->close[rhs[0]] != rhs[2]) {
+      error("not an operator grammar: '%s' is closed by more than one "
+          "terminal", Grammar_name(g, rhs[0]));
+    }
+    table->close[rhs[0]] = rhs[2];
+  } else {
+    error("not an operator grammar: a rule of '%s' is neither a terminal nor "
+        "'%s' in brackets", Grammar_name(g, g->rule_lhs[rule]),
+        Grammar_name(g, g->start));
+  }
+}
+
+// terminals are their own token types, they have the same ids in the
+// compiled grammar
+OpTable *OpTable_construct(Grammar *g)
+{
+  OpTable *out = malloc(sizeof(OpTable));
+  int level = g->start;
+  const int *rhs;
+  int next, len, r, bp;
+
+  out->g = g;
+  out->num_terminals = g->num_terms;
+  out->kind = calloc(g->num_terms, sizeof(char));
+  out->lbp = calloc(g->num_terms, sizeof(int));
+  out->rbp = calloc(g->num_terms, sizeof(int));
+  out->close = calloc(g->num_terms, sizeof(TokType));
+  out->num_levels = 0;
+
+  while (1) {
+    // a single non-terminal on the right side leads to the next level
+    next = -1;
+    for (r = g->sym_rules[level]; r < g->sym_rules[level + 1]; r++) {
+      rhs = GRAMMAR_RULE_RHS(g, r);
+      if (GRAMMAR_RULE_LEN(g, r) == 1 && !GRAMMAR_IS_TERM(g, rhs[0])) {
+        if (next >= 0) {
+          error("not an operator grammar: '%s' has more than one rule with "
+              "just a non-terminal", Grammar_name(g, level));
+        }
+        next = rhs[0];
+      }
+    }
+    if (next < 0)
+      break;
+    if (++out->num_levels > g->num_syms - g->num_terms) {
+      error("not an operator grammar: the levels below '%s' form a cycle",
+          Grammar_name(g, g->start));
+    }
+
+    // left associative operators bind a bit tighter to the right
+    bp = 2 * out->num_levels - 1;
+    for (r = g->sym_rules[level]; r < g->sym_rules[level + 1]; r++) {
+      rhs = GRAMMAR_RULE_RHS(g, r);
+      len = GRAMMAR_RULE_LEN(g, r);
+      if (len == 1)
+        continue;
+      if (len == 3 && GRAMMAR_IS_TERM(g, rhs[1]) && rhs[0] == level &&
+          rhs[2] == next) {
+        set_binary(out, g, rhs[1], bp, bp + 1);
+      } else if (len == 3 && GRAMMAR_IS_TERM(g, rhs[1]) && rhs[0] == next &&
+          rhs[2] == level) {
+        set_binary(out, g, rhs[1], bp + 1, bp);
+      } else {
+        error("not an operator grammar: a rule of '%s' is not a binary "
+            "operator on '%s' and '%s'", Grammar_name(g, level),
+            Grammar_name(g, level), Grammar_name(g, next));
+      }
+    }
+    level = next;
+  }
+
+  for (r = g->sym_rules[level]; r < g->sym_rules[level + 1]; r++) {
+    add_primary(out, g, r);
+  }
+  return out;
+}
+
+void OpTable_print(OpTable *table)
+{
+  const char *name;
+
+  printf("Operator precedence table (%d levels)...\n", table->num_levels);
+  for (int i = 0; i < table->num_terminals; i++) {
+    name = Grammar_name(table->g, i);
+    switch (table->kind[i]) {
+      case OP_ATOM:
+        printf("%s: operand\n", name);
+        break;
+      case OP_OPEN:
+        printf("%s: opening bracket for %s\n", name,
+            Grammar_name(table->g, table->close[i]));
+        break;
+      case OP_CLOSE:
+        printf("%s: closing bracket\n", name);
+        break;
+      case OP_BINARY:
+        printf("%s: binary operator, binding power %d %d\n", name,
+            table->lbp[i], table->rbp[i]);
+        break;
+    }
+  }
+}
+
+void OpTable_free(OpTable *table)
+{
+  free(table->kind);
+  free(table->lbp);
+  free(table->rbp);
+  free(table->close);
+  free(table);
+}
+
+
+/******************************************************************************/
+/* Parsing                                                                    */
+/******************************************************************************/
+
+static char kind_of(OpTable *table, TokType tt)
+{
+  return (tt > NONE && tt < table->num_terminals) ? table->kind[tt] : OP_NONE;
+}
+
+// report an unexpected token at tok_idx, 'operand' tells whether an operand
+// was expected and 'close' is the bracket that is open (NONE if there is none)
+static void report(OpTable *table, TokBuf *toks, ParseErrors *errs,
+    int tok_idx, int operand, TokType close)
+{
+  char *expected = calloc(table->num_terminals, sizeof(char));
+  char kind;
+
+  for (int i = 0; i < table->num_terminals; i++) {
+    kind = kind_of(table, i);
+    if (operand)
+      expected[i] = (kind == OP_ATOM || kind == OP_OPEN);
+    else
+      expected[i] = (kind == OP_BINARY || i == close);
+  }
+  ParseErrors_add_expected(errs, expected, table->num_terminals,
+      toks->types[tok_idx], toks->offsets[tok_idx], toks->lengths[tok_idx]);
+  free(expected);
+}
+
+// Operator precedence parse of the token buffer (shunting yard): operands go
+// to the output right away, an operator waits on the stack until one that
+// binds less tightly comes along. The output is the parse tree in postfix
+// order, as token indices without the brackets. There is no error recovery,
+// parsing stops at the first error.
+int opp_parse(OpTable *table, TokBuf *toks, ParseErrors *errs, int *postfix,
+    int *postfix_len)
+{
+  int *stack = malloc(toks->size * sizeof(int)); // token indices
+  int top = 0;
+  int depth = 0; // open brackets on the stack
+  int len = 0;
+  int operand = 1; // expecting an operand next
+  int out = 0;
+  TokType tt, close;
+  char kind;
+
+  for (int i = 0; ; i++) {
+    tt = toks->types[i];
+    kind = kind_of(table, tt);
+    if (operand) {
+      if (kind == OP_ATOM) {
+        if (postfix != NULL)
+          postfix[len] = i;
+        len++;
+        operand = 0;
+      } else if (kind == OP_OPEN) {
+        stack[top++] = i;
+        depth++;
+      } else {
+        report(table, toks, errs, i, 1, NONE);
+        break;
+      }
+      continue;
+    }
+
+    if (kind == OP_BINARY) {
+      while (top > 0 && kind_of(table, toks->types[stack[top - 1]]) ==
+          OP_BINARY && table->rbp[toks->types[stack[top - 1]]] > table->lbp[tt]) {
+        if (postfix != NULL)
+          postfix[len] = stack[top - 1];
+        len++;
+        top--;
+      }
+      stack[top++] = i;
+      operand = 1;
+      continue;
+    }
+
+    // everything up to the innermost bracket is complete now
+    while (top > 0 && kind_of(table, toks->types[stack[top - 1]]) == OP_BINARY) {
+      if (postfix != NULL)
+        postfix[len] = stack[top - 1];
+      len++;
+      top--;
+    }
+    close = (depth > 0) ? table->close[toks->types[stack[top - 1]]] : NONE;
+    if (tt != close) {
+      report(table, toks, errs, i, 0, close);
+      break;
+    }
+    if (tt == NONE) {
+      out = 1;
+      break;
+    }
+    top--;
+    depth--;
+  }
+
+  free(stack);
+  if (postfix_len != NULL)
+    *postfix_len = len;
+  return out && errs->size == 0;
+}
+
+void opp_print_postfix(TokBuf *toks, const char *in, int *postfix, int len)
+{
+  for (int i = 0; i < len; i++) {
+    printf("%s%.*s", (i > 0) ? " " : "", toks->lengths[postfix[i]],
+        in + toks->offsets[postfix[i]]);
+  }
+  printf("\n");
+}
@@ -0,0 +1,35 @@
+#ifndef OPP_H
+#define OPP_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+
+// what a terminal is in an operator grammar
+#define OP_NONE 0 // can't appear in an expression
+#define OP_ATOM 1
+#define OP_OPEN 2
+#define OP_CLOSE 3
+#define OP_BINARY 4
+
+// Binding powers for every terminal of an expression grammar. A binary
+// operator with a right power greater than the left power of the next one
+// binds tighter, so it is applied first.
+typedef struct _OpTable {
+  Grammar *g; // names of the terminals
+  int num_terminals;
+  char *kind;
+  int *lbp;
+  int *rbp;
+  TokType *close; // the closing bracket for every OP_OPEN
+  int num_levels;
+} OpTable;
+
+
+OpTable *OpTable_construct(Grammar *g);
+void OpTable_print(OpTable *table);
+void OpTable_free(OpTable *table);
+int opp_parse(OpTable *table, TokBuf *toks, ParseErrors *errs, int *postfix,
+    int *postfix_len);
+void opp_print_postfix(TokBuf *toks, const char *in, int *postfix, int len);
+
+#endif
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h> // for clock_gettime
+#include <unistd.h> // for getopt
+#include <pthread.h>
+
+#include "protocol.h"
+
+// Client of the parse daemon (parser -S socket grammar_file...).
+// Sends the whole input as one request and prints the reply like parser
+// does, or with -L sends the lines of the input as requests over several
+// connections at once and prints the throughput and the latencies.
+
+#define CLIENT_INIT_CAP 4096
+
+// one connection of the load generator, it sends requests first,
+// first + step, ... and records how long every one took
+typedef struct _LoadJob {
+  const char *path;
+  char **lines;
+  int *line_lens;
+  int num_lines;
+  int op;
+  int grammar;
+  long first;
+  long step;
+  long num_requests;
+  double *latencies; // in seconds, one for every request of this job
+  long num_done;
+  long accepted;
+} LoadJob;
+
+
+static void usage()
+{
+  fprintf(stderr, "Usage: parse_client [-v] [-g grammar] socket [parse_file]\n"
+      "       parse_client -L requests [-c connections] [-v] [-g grammar] "
+      "socket lines_file\n");
+  exit(1);
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// all of the file or stdin
+static char *read_input(const char *path, long *len_out)
+{
+  FILE *f = (path != NULL) ? fopen(path, "rb") : stdin;
+  long cap = CLIENT_INIT_CAP, len = 0, n;
+  char *out;
+
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  out = malloc(cap);
+  while ((n = fread(out + len, 1, cap - len, f)) > 0) {
+    len += n;
+    if (len == cap) {
+      cap *= 2;
+      out = realloc(out, cap);
+    }
+  }
+  if (f != stdin)
+    fclose(f);
+  *len_out = len;
+  return out;
+}
+
+// send one request for the grammar with the handle 'grammar' and wait for
+// the reply, the text of the reply is put in '*text' if it is not NULL,
+// returns 0 if the connection broke
+static int request(int fd, int op, int grammar, const char *in, int len,
+    ProtoReply *rep, char **text)
+{
+  ProtoRequest req = {op, grammar, len};
+  char *buf;
+
+  if (!proto_write(fd, &req, sizeof(ProtoRequest)) ||
+      !proto_write(fd, in, len) ||
+      !proto_read(fd, rep, sizeof(ProtoReply)))
+    return 0;
+  buf = malloc(rep->len + 1);
+  if (!proto_read(fd, buf, rep->len)) {
+    free(buf);
+    return 0;
+  }
+  buf[rep->len] = '\0';
+  if (text != NULL)
+    *text = buf;
+  else
+    free(buf);
+  return 1;
+}
+
+static int check(const char *path, int op, int grammar, const char *file)
+{
+  ProtoReply rep;
+  char *in, *text;
+  long len;
+  int fd;
+
+  in = read_input(file, &len);
+  if (len > PROTO_MAX_INPUT) {
+    fprintf(stderr, "error: input longer than %d bytes\n", PROTO_MAX_INPUT);
+    return 1;
+  }
+  if ((fd = proto_connect(path)) < 0)
+    return 1;
+  if (!request(fd, op, grammar, in, len, &rep, &text)) {
+    fprintf(stderr, "error: the daemon closed the connection\n");
+    return 1;
+  }
+  close(fd);
+  free(in);
+
+  if (rep.status == PROTO_BAD_REQUEST) {
+    fprintf(stderr, "error: %s", text);
+    free(text);
+    return 1;
+  }
+  printf("%s", text);
+  if (op == PROTO_EVAL && rep.status == PROTO_ACCEPT)
+    printf("value: %.15g\n", rep.value);
+  printf("Grammar %s\n", (rep.status == PROTO_ACCEPT) ?
+      "correct" : "incorrect");
+  free(text);
+  return 0;
+}
+
+static void *load_run(void *arg)
+{
+  LoadJob *job = (LoadJob *)arg;
+  ProtoReply rep;
+  double start;
+  long i;
+  int fd;
+
+  if ((fd = proto_connect(job->path)) < 0)
+    return NULL;
+  for (i = job->first; i < job->num_requests; i += job->step) {
+    int l = i % job->num_lines;
+    start = seconds();
+    if (!request(fd, job->op, job->grammar, job->lines[l], job->line_lens[l],
+          &rep, NULL)) {
+      fprintf(stderr, "error: the daemon closed the connection\n");
+      break;
+    }
+    job->latencies[job->num_done++] = seconds() - start;
+    job->accepted += (rep.status == PROTO_ACCEPT);
+  }
+  close(fd);
+  return NULL;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+  double x = *(double *)a, y = *(double *)b;
+  return (x > y) - (x < y);
+}
+
+// send 'num_requests' requests, the lines of the file over and over, on
+// 'num_conns' connections at the same time
+static int load(const char *path, int op, int grammar, const char *file,
+    long num_requests, int num_conns)
+{
+  LoadJob *jobs = malloc(num_conns * sizeof(LoadJob));
+  pthread_t *threads = malloc(num_conns * sizeof(pthread_t));
+  char **lines;
+  int *line_lens;
+  int num_lines = 0, lines_cap = CLIENT_INIT_CAP;
+  double *all, start, total;
+  long len, done = 0, accepted = 0;
+  char *in, *p, *nl;
+
+  in = read_input(file, &len);
+  lines = malloc(lines_cap * sizeof(char *));
+  line_lens = malloc(lines_cap * sizeof(int));
+  for (p = in; p < in + len; p = nl + 1) {
+    if ((nl = memchr(p, '\n', in + len - p)) == NULL)
+      nl = in + len;
+    if (num_lines == lines_cap) {
+      lines_cap *= 2;
+      lines = realloc(lines, lines_cap * sizeof(char *));
+      line_lens = realloc(line_lens, lines_cap * sizeof(int));
+    }
+    lines[num_lines] = p;
+    line_lens[num_lines++] = nl - p;
+  }
+  if (num_lines == 0) {
+    fprintf(stderr, "error: no lines to send\n");
+    return 1;
+  }
+
+  start = seconds();
+  for (int i = 0; i < num_conns; i++) {
+    jobs[i].path = path;
+    jobs[i].lines = lines;
+    jobs[i].line_lens = line_lens;
+    jobs[i].num_lines = num_lines;
+    jobs[i].op = op;
+    jobs[i].grammar = grammar;
+    jobs[i].first = i;
+    jobs[i].step = num_conns;
+    jobs[i].num_requests = num_requests;
+    jobs[i].latencies = malloc((num_requests / num_conns + 1) *
+        sizeof(double));
+    jobs[i].num_done = 0;
+    jobs[i].accepted = 0;
+    if (pthread_create(&threads[i], NULL, load_run, &jobs[i]) != 0) {
+      fprintf(stderr, "error: can't create connection thread %d\n", i);
+      exit(1);
+    }
+  }
+  for (int i = 0; i < num_conns; i++)
+    pthread_join(threads[i], NULL);
+  total = seconds() - start;
+
+  all = malloc(num_requests * sizeof(double));
+  for (int i = 0; i < num_conns; i++) {
+    memcpy(all + done, jobs[i].latencies, jobs[i].num_done * sizeof(double));
+    done += jobs[i].num_done;
+    accepted += jobs[i].accepted;
+    free(jobs[i].latencies);
+  }
+  qsort(all, done, sizeof(double), double_cmp);
+
+  printf("%ld requests on %d connections in %.3f s, %ld accepted\n", done,
+      num_conns, total, accepted);
+  if (done > 0) {
+    printf("%.0f requests/s, latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        done / total, all[done / 2] * 1e6, all[done * 99 / 100] * 1e6,
+        all[done - 1] * 1e6);
+  }
+
+  free(all);
+  free(lines);
+  free(line_lens);
+  free(in);
+  free(threads);
+  free(jobs);
+  return done < num_requests;
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  int op = PROTO_CHECK;
+  long num_requests = 0;
+  int num_conns = 1;
+  int grammar = 0;
+
+  while ((opt = getopt(argc, argv, "vg:L:c:")) != -1) {
+    switch (opt) {
+      case 'v':
+        op = PROTO_EVAL;
+        break;
+      case 'g':
+        grammar = atoi(optarg);
+        break;
+      case 'L':
+        num_requests = atol(optarg);
+        if (num_requests < 1)
+          usage();
+        break;
+      case 'c':
+        num_conns = atoi(optarg);
+        if (num_conns < 1)
+          usage();
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc || (num_requests > 0 && optind + 1 >= argc))
+    usage();
+
+  if (num_requests > 0)
+    return load(argv[optind], op, grammar, argv[optind + 1], num_requests,
+        num_conns);
+  return check(argv[optind], op, grammar,
+      (optind + 1 < argc) ? argv[optind + 1] : NULL);
+}
@@ -4,114 +4,169 @@
 #include <string.h>
 #include "parse_types.h"
 #include "util_types.h"
+#include "dfa_lex.h"
 
-static void gmap_free_val(const char *_1, void *val, void *_2);
-static void gmap_print_el(const char *key, void *val, void *_);
 static void conn_print(const char *key, void *val, void *_);
 
-char *terminals[] = {"NONE", "T_PLUS", "T_MINUS", "T_TIMES", "T_LBRACKET", "T_RBRACKET", "T_NUMBER"};
-//char *terminals[] = {"NONE", "T_LBRACKET", "T_RBRACKET"};
+/******************************************************************************/
+/* Parse table                                                                */
+/******************************************************************************/
 
-int is_terminal(const char *name)
+// 'buf' has room for 'len' characters, PTable.key_len is enough for every
+// key of the table
+void key_gen(char *buf, int len, int state_no, const char *token_type)
 {
-  for (int i = 0; i < NUM_TERMINALS; i++) {
-    if (strcmp(name, terminals[i]) == 0)
-      return 1;
-  }
-  return 0;
+  snprintf(buf, len, "%d %s", state_no, token_type);
 }
 
-TokType terminal_name_to_type(const char *name)
+static int Action_equal(Action *a, Action *b)
 {
-  for (int i = 0; i < NUM_TERMINALS; i++) {
-    if (strcmp(terminals[i], name) == 0) {
-      return (TokType)i;
-    }
-  }
-  return NONE;
+  if (a->act_type != b->act_type)
+    return 0;
+  if (a->act_type == SHIFT)
+    return a->act_instr.state_no == b->act_instr.state_no;
+  return a->act_instr.red_rule == b->act_instr.red_rule;
 }
 
+// set the action of a cell, if the cell already has a different action both
+// are kept in the conflict table
+static void action_add(PTable *table, const char *key, Action *act)
+{
+  Action *old;
+  ActionList *list, new_list;
 
-/******************************************************************************/
-/* Parse table                                                                */
-/******************************************************************************/
+  if ((old = (Action *)HashMap_get(table->action_t, key, NULL)) == NULL ||
+      Action_equal(old, act)) {
+    HashMap_set(table->action_t, key, (void *)act);
+    return;
+  }
 
-void key_gen(char *buf, int state_no, const char *token_type)
-{
-  snprintf(buf, FORMAT_BUFLEN, "%d %s", state_no, token_type);
+  if ((list = (ActionList *)HashMap_get(table->conflict_t, key, NULL)) == NULL) {
+    new_list.capacity = 4;
+    new_list.size = 1;
+    new_list.acts = mem_alloc(MEM_CONFLICTS,
+        new_list.capacity * sizeof(Action));
+    new_list.acts[0] = *old;
+    HashMap_set(table->conflict_t, key, (void *)&new_list);
+    list = (ActionList *)HashMap_get(table->conflict_t, key, NULL);
+    table->num_conflicts++;
+  }
+  for (int i = 0; i < list->size; i++) {
+    if (Action_equal(&list->acts[i], act))
+      return;
+  }
+  if (list->size == list->capacity) {
+    list->capacity *= 2;
+    list->acts = mem_realloc(MEM_CONFLICTS, list->acts,
+        list->capacity * sizeof(Action));
+  }
+  list->acts[list->size++] = *act;
+  HashMap_set(table->action_t, key, (void *)act);
 }
 
-PTable PTable_construct(const char *root, CC *cc, HashMap *gmap)
+PTable PTable_construct(Grammar *g, CC *cc)
 {
   LR1El *set_iter;
   Action act;
   PTable out;
-  GotoParams gparams;
-  char buf[FORMAT_BUFLEN];
+  CC **cc_next;
+  const char *sym;
+  int len, next, name_len = 0;
 
-  out.action_t = HashMap_construct(sizeof(Action));
-  out.goto_t = HashMap_construct(sizeof(int));
+  // the state number is followed by the longest name
+  for (int s = 0; s < g->num_syms; s++) {
+    if ((int)strlen(Grammar_name(g, s)) > name_len)
+      name_len = strlen(Grammar_name(g, s));
+  }
+  out.key_len = name_len + PTABLE_KEY_EXTRA;
+  char buf[out.key_len];
 
+  out.g = g;
+  out.action_t = HashMap_construct(sizeof(Action), MEM_ACTION_TABLE);
+  out.goto_t = HashMap_construct(sizeof(int), MEM_GOTO_TABLE);
+  out.conflict_t = HashMap_construct(sizeof(ActionList), MEM_CONFLICTS);
+  out.num_conflicts = 0;
 
   for (; cc != NULL; cc = cc->next) {
     for (set_iter = cc->cc_set; set_iter != NULL; set_iter = set_iter->next) {
-      if (strcmp(set_iter->rule->sym, root) == 0 &&
-          set_iter->pos == set_iter->rule->num_symbols &&
+      len = GRAMMAR_RULE_LEN(g, set_iter->rule);
+      next = (set_iter->pos < len) ?
+        GRAMMAR_RULE_RHS(g, set_iter->rule)[set_iter->pos] : -1;
+      if (g->rule_lhs[set_iter->rule] == g->start && set_iter->pos == len &&
           set_iter->lookahead == NONE) {
-        act.act_type = ACCEPT;      
-        act.act_instr.state_no = 0; // this is a don't care because there will be no
-                                 // transition to another state after accepting
+        act.act_type = ACCEPT;
+        // the LR driver accepts right away, the GLR driver still reduces
+        // by the rule to get the root of the parse forest
+        act.act_instr.red_rule = set_iter->rule;
 
-        key_gen(buf, cc->state_no, terminals[NONE]);
+        key_gen(buf, out.key_len, cc->state_no, Grammar_name(g, NONE));
 
-        HashMap_set(out.action_t, buf, (void *)&act);
-      } else if (set_iter->pos == set_iter->rule->num_symbols) {
+        action_add(&out, buf, &act);
+      } else if (set_iter->pos == len) {
         act.act_type = REDUCE;
         act.act_instr.red_rule = set_iter->rule;
 
-        key_gen(buf, cc->state_no, terminals[set_iter->lookahead]);
+        key_gen(buf, out.key_len, cc->state_no,
+            Grammar_name(g, set_iter->lookahead));
 
-        HashMap_set(out.action_t, buf, (void *)&act);
-      } else if (is_terminal(set_iter->rule->sym_l[set_iter->pos])) {
+        action_add(&out, buf, &act);
+      } else if (GRAMMAR_IS_TERM(g, next)) {
         act.act_type = SHIFT;
-        CC **cc_next =
-          (CC **)HashMap_get(
-            cc->goto_map,
-            set_iter->rule->sym_l[set_iter->pos],
-            NULL
-          );
+        sym = Grammar_name(g, next);
+        cc_next = (CC **)HashMap_get(cc->goto_map, sym, NULL);
 
         act.act_instr.state_no = (*cc_next)->state_no;
 
-        key_gen(buf, cc->state_no, set_iter->rule->sym_l[set_iter->pos]);
-        HashMap_set(out.action_t, buf, (void *)&act);
+        key_gen(buf, out.key_len, cc->state_no, sym);
+        action_add(&out, buf, &act);
       }
     }
 
-    gparams.cc = cc;
-    gparams.goto_t = out.goto_t;
-    HashMap_iter(gmap, add_to_goto, (void *)&gparams);
+    for (int s = g->num_terms; s < g->num_syms; s++) {
+      sym = Grammar_name(g, s);
+      if ((cc_next = (CC **)HashMap_get(cc->goto_map, sym, NULL)) != NULL) {
+        key_gen(buf, out.key_len, cc->state_no, sym);
+        HashMap_set(out.goto_t, buf, (void *)&((*cc_next)->state_no));
+      }
+    }
   }
 
   return out;
 }
 
 
-void add_to_goto(const char *key, void *val, void *params)
+// action for terminal 'tt' in state 'state_no' or NULL if there is none
+Action *action_get(PTable table, int state_no, TokType tt)
 {
-  GotoParams *p = (GotoParams *)params;
-  CC **next_cc;
-  char buf[FORMAT_BUFLEN];
+  char buf[table.key_len];
 
-  if (!(is_terminal(key))) {
-    if ((next_cc = (CC **)HashMap_get(p->cc->goto_map, key, NULL)) == NULL) {
-      return;
-    }
+  if (tt < 0) // input the lexer could not match
+    return NULL;
+  key_gen(buf, table.key_len, state_no, Grammar_name(table.g, tt));
+  return (Action *)HashMap_get(table.action_t, buf, NULL);
+}
 
-    key_gen(buf, p->cc->state_no, key);
+// all actions for terminal 'tt' in state 'state_no', their number is
+// stored in 'num_out'
+Action *action_get_all(PTable table, int state_no, TokType tt, int *num_out)
+{
+  char buf[table.key_len];
+  ActionList *list;
+  Action *act;
 
-    HashMap_set(p->goto_t, buf, (void *)&((*next_cc)->state_no));
+  *num_out = 0;
+  if (tt < 0)
+    return NULL;
+  key_gen(buf, table.key_len, state_no, Grammar_name(table.g, tt));
+  if ((act = (Action *)HashMap_get(table.action_t, buf, NULL)) == NULL)
+    return NULL;
+  if (table.num_conflicts > 0 &&
+      (list = (ActionList *)HashMap_get(table.conflict_t, buf, NULL)) != NULL) {
+    *num_out = list->size;
+    return list->acts;
   }
+  *num_out = 1;
+  return act;
 }
 
 void *state_list_reduce(const char *key, void *_, void *list)
@@ -132,10 +187,10 @@ void *non_terminals_list_reduce(const char *key, void *_, void *list)
   if (List_contains(list, (void *)nt_loc, str_equal))
     return list;
   else
-    return List_insert(list, (void *)strdup(nt_loc));
+    return List_insert(list, (void *)mem_strdup(MEM_OTHER, nt_loc));
 }
 
-void Action_print(Action act)
+void Action_print(Grammar *g, Action act)
 {
   switch (act.act_type) {
     case SHIFT:
@@ -143,7 +198,7 @@ void Action_print(Action act)
       break;
     case REDUCE:
       printf("r [");
-      ProdRule_print(act.act_instr.red_rule);
+      rule_print(g, act.act_instr.red_rule);
       printf("]");
       break;
     case ACCEPT:
@@ -154,8 +209,9 @@ void Action_print(Action act)
 
 void PTable_print(PTable table)
 {
-  char buf[FORMAT_BUFLEN];
+  char buf[table.key_len];
   Action *act;
+  ActionList *list;
   List *iter1, *iter2;
   printf("Action table:\n");
 
@@ -165,13 +221,20 @@ void PTable_print(PTable table)
     state = (long)iter1->val; 
     printf("Row for state %ld\n", state);
     // loop over all columns which are given by the non-terminals
-    for (int i = 0; i < NUM_TERMINALS; i++) {
-      printf("%s=", terminals[i]);
-      key_gen(buf, state, terminals[i]);
+    for (int i = 0; i < table.g->num_terms; i++) {
+      printf("%s=", Grammar_name(table.g, i));
+      key_gen(buf, table.key_len, state, Grammar_name(table.g, i));
       if ((act = (Action *)HashMap_get(table.action_t, buf, NULL)) == NULL) {
         printf("empty");
+      } else if ((list = (ActionList *)HashMap_get(table.conflict_t, buf,
+              NULL)) != NULL) {
+        for (int j = 0; j < list->size; j++) {
+          if (j > 0)
+            printf(" / ");
+          Action_print(table.g, list->acts[j]);
+        }
       } else {
-        Action_print(*act);
+        Action_print(table.g, *act);
       }
       printf("; ");
     }
@@ -189,7 +252,7 @@ void PTable_print(PTable table)
     state = (long)iter1->val;
     printf("Row for state %ld\n", state);
     for (iter2 = non_terminals; iter2 != NULL; iter2 = iter2->next) {
-      key_gen(buf, state, (char *)iter2->val);
+      key_gen(buf, table.key_len, state, (char *)iter2->val);
       printf("%s=", (char *)iter2->val);
       if ((goto_state = (int *)HashMap_get(table.goto_t, buf, NULL)) == NULL) {
         printf("empty");
@@ -205,383 +268,199 @@ void PTable_print(PTable table)
   List_free(non_terminals, 1);
 }
 
-void PTable_free(PTable table)
-{
-  HashMap_deconstruct(table.action_t);
-  HashMap_deconstruct(table.goto_t);
-}
-
-
-ParseStack *ParseStack_push(ParseStack *stack, const char *sym, int state_no)
-{
-  ParseStack *new = malloc(sizeof(ParseStack));
-  new->sym = strdup(sym);
-  new->state_no = state_no;
-  new->next = stack;
-  return new;
-}
-
-ParseStack *ParseStack_pop(ParseStack *stack)
-{
-  if (stack == NULL)
-    return NULL;
-  ParseStack *out = stack->next;
-  free(stack->sym);
-  free(stack);
-  return out;
-}
-
-void ParseStack_free(ParseStack *stack)
+static void action_list_free(const char *key, void *val, void *_)
 {
-  while ((stack = ParseStack_pop(stack)) != NULL);
+  mem_free(((ActionList *)val)->acts);
 }
 
-void ParseStack_print(ParseStack *stack)
+void PTable_free(PTable table)
 {
-  printf("Stack contents...\n");
-  for (; stack != NULL; stack = stack->next) {
-    printf("<%s, %d>; ", stack->sym, stack->state_no);
-  }
-  printf("\n");
+  HashMap_iter(table.conflict_t, action_list_free, NULL);
+  HashMap_deconstruct(table.conflict_t);
+  HashMap_deconstruct(table.action_t);
+  HashMap_deconstruct(table.goto_t);
 }
 
 
 /******************************************************************************/
-/* Grammar map                                                                */
+/* Parse errors                                                               */
 /******************************************************************************/
 
-static void gmap_print_el(const char *key, void *val, void *_)
+ParseErrors *ParseErrors_construct(int max_errors)
 {
-  printf("Non-terminal: '%s'\n", key);
-  ProdRule_print_list(*((ProdRule **)val));
-}
-
-void gmap_print(HashMap *gmap)
-{
-  HashMap_iter(gmap, gmap_print_el, NULL);
-}
-
-void ProdRule_print(ProdRule *rule)
-{
-  int i;
-  printf("[%s <- ", rule->sym);
-  for (i = 0; i < rule->num_symbols; i++) {
-    printf(" '%s' ", rule->sym_l[i]);
-  }
-  printf("]");
+  ParseErrors *out = mem_alloc(MEM_ERRORS, sizeof(ParseErrors));
+  out->capacity = 16;
+  out->size = 0;
+  out->max_errors = max_errors;
+  out->errs = mem_alloc(MEM_ERRORS, out->capacity * sizeof(ParseError));
+  return out;
 }
 
-void ProdRule_print_list(ProdRule *list)
+// make room for one more error, the list is allocated through the mem_
+// wrappers so it has to be grown through them as well
+void ParseErrors_grow(ParseErrors *errs)
 {
-  ProdRule *rule_iter;
-
-  for (rule_iter = list; rule_iter != NULL; rule_iter = rule_iter->next) {
-    ProdRule_print(rule_iter);
-    printf("\n");
+  if (errs->size == errs->capacity) {
+    errs->capacity *= 2;
+    errs->errs = mem_realloc(MEM_ERRORS, errs->errs,
+        errs->capacity * sizeof(ParseError));
   }
 }
 
-ProdRule *ProdRule_append(ProdRule *list, ProdRule *rule)
+// 'num_terminals' is the most terminals the error can expect
+static ParseError *ParseErrors_new(ParseErrors *errs, int num_terminals,
+    TokType found, long offset, int length)
 {
-  ProdRule *last;
+  ParseError *err;
 
-  APPEND(list, last, rule);
-}
-
-ProdRule *ProdRule_generate(const char *sym)
-{
-  ProdRule *out = malloc(sizeof(ProdRule));
-  out->sym = strdup(sym);
-  out->num_symbols = 0;
-  out->next = NULL;
-  return out;
+  ParseErrors_grow(errs);
+  err = &errs->errs[errs->size++];
+  err->offset = offset;
+  err->length = length;
+  err->found = found;
+  err->num_expected = 0;
+  err->expected = mem_alloc(MEM_ERRORS, num_terminals * sizeof(TokType));
+  return err;
 }
 
-
-ProdRule *ProdRule_generate_list(FILE *g_file, const char *sym)
+// record an error found in state 'state_no'
+// returns 1 if the error budget is used up
+int ParseErrors_add(ParseErrors *errs, PTable table, int state_no,
+    TokType found, long offset, int length)
 {
-  char token[TOK_LEN];
-  ProdRule *tmp_rule;
-  
-  ProdRule *prod_l;
-
-  prod_l = NULL;
-  tmp_rule = ProdRule_generate(sym);
+  ParseError *err = ParseErrors_new(errs, table.g->num_terms, found, offset,
+      length);
 
-  while (get_token(g_file, token) != EOF && token[strlen(token)-1] != ':') {
-    if (token[0] != '|') {
-      if (tmp_rule->num_symbols < MAX_TERMS_PER_RULE) {
-        tmp_rule->sym_l[tmp_rule->num_symbols++] = strdup(token);
-      } else {
-        error("Grammar parsing: exceeded maximum number of symbols"
-            "per production rule. "
-            "Can't be over '%d'", MAX_TERMS_PER_RULE);
-      }
-    } else {
-      prod_l = ProdRule_append(prod_l, tmp_rule);
-      tmp_rule = ProdRule_generate(sym);
-    }
+  for (int i = 0; i < table.g->num_terms; i++) {
+    if (action_get(table, state_no, i) != NULL)
+      err->expected[err->num_expected++] = i;
   }
-  prod_l = ProdRule_append(prod_l, tmp_rule);
-  if (token[strlen(token)-1] == ':')
-    unget_token(g_file, token);
-
-  return prod_l;
+  return errs->size >= errs->max_errors;
 }
 
-
-
-HashMap *gmap_generate(FILE *g_file, char *root_out)
+// record an error for parsers without an LR table, 'expected' has a flag for
+// every one of the 'num_terminals' terminals
+int ParseErrors_add_expected(ParseErrors *errs, const char *expected,
+    int num_terminals, TokType found, long offset, int length)
 {
-  char token[TOK_LEN];
-  ProdRule *prod_l;
-  HashMap *gram_map;
-
-  gram_map = HashMap_construct(sizeof(ProdRule *));
-
+  ParseError *err = ParseErrors_new(errs, num_terminals, found, offset,
+      length);
 
-  if (get_token(g_file, token) == EOF) {
-    error("grammar file empty");
+  for (int i = 0; i < num_terminals; i++) {
+    if (expected[i])
+      err->expected[err->num_expected++] = i;
   }
-  if (strcmp(token, "%start") != 0) {
-    error("expecting '%%start' to define root of grammar");
-  }
-  if (get_token(g_file, token) == EOF) {
-    error("missing root of grammar name after '%%start'");
-  }
-  strncpy(root_out, token, TOK_LEN);
-
-
-  while (get_token(g_file, token) != EOF) {
-    if (token[strlen(token)-1] == ':') {
-      token[strlen(token)-1] = '\0';
-      prod_l = ProdRule_generate_list(g_file, token);
-      HashMap_set(gram_map, token, (void *)&prod_l);
-    } else {
-      error("syntax: non-terminals must be defined with a"
-          "':' without spaces separating it from the non-terminal name");
-    }
-  }
-  return gram_map;
+  return errs->size >= errs->max_errors;
 }
 
-// assume that all tokens are separated by spaces
-int get_token(FILE *in, char *buf)
+// the terminals are named after the grammar the errors were found with
+void ParseErrors_fprint(FILE *out, Grammar *g, ParseErrors *errs)
 {
-  char in_c;
-  int buf_idx = 0;
+  ParseError *err;
 
-  while (isspace(in_c = fgetc(in))); // skip all whitespace characters
-
-  if (in_c == EOF)
-    return EOF;
-  else
-    buf[buf_idx++] = in_c;
-
-  do {
-    if (!isspace(in_c = fgetc(in)))
-      buf[buf_idx++] = in_c;
+  for (int i = 0; i < errs->size; i++) {
+    err = &errs->errs[i];
+    fprintf(out, "error at offset %ld: ", err->offset);
+    if (err->found == LEX_ERROR)
+      fprintf(out, "invalid input of length %d", err->length);
+    else if (err->found == NONE)
+      fprintf(out, "unexpected end of input");
     else
-      break;
-    if (in_c == EOF)
-      fprintf(stderr, "EOF\n");
-  } while (in_c != EOF);
-
-  buf[buf_idx] = '\0';
-  return (in_c == EOF) ? EOF : buf_idx;
-}
-
-void unget_token(FILE *in, char *token)
-{
-  if (ungetc(' ', in) == EOF) {
-    error("couldn't unget character ' '");
-  }
-  for (int i = strlen(token) - 1; i >= 0; i--) {
-    if (ungetc(token[i], in) == EOF) {
-      error("couldn't unget character '%c'", token[i]);
+      fprintf(out, "unexpected %s", Grammar_name(g, err->found));
+    fprintf(out, ", expecting one of:");
+    for (int j = 0; j < err->num_expected; j++) {
+      fprintf(out, " %s", (err->expected[j] == NONE) ?
+          "end of input" : Grammar_name(g, err->expected[j]));
     }
+    fprintf(out, "\n");
   }
+  if (errs->size >= errs->max_errors)
+    fprintf(out, "too many errors, stopped after %d\n", errs->size);
 }
 
-void ProdRule_free(ProdRule *rule)
+void ParseErrors_print(Grammar *g, ParseErrors *errs)
 {
-  int i;
-  for (i = 0; i < rule->num_symbols; i++) {
-    free(rule->sym_l[i]);
-  }
-  free(rule->sym);
-  free(rule);
+  ParseErrors_fprint(stdout, g, errs);
 }
 
-void ProdRule_free_list(ProdRule *prod_l)
+// forget all errors so the list can be used for the next parse
+void ParseErrors_clear(ParseErrors *errs)
 {
-  ProdRule *next;
-
-  for (; prod_l != NULL; prod_l = next) {
-    next = prod_l->next;
-    ProdRule_free(prod_l);
-  }
+  for (int i = 0; i < errs->size; i++)
+    mem_free(errs->errs[i].expected);
+  errs->size = 0;
 }
 
-static void gmap_free_val(const char *_1, void *val, void *_2)
+void ParseErrors_free(ParseErrors *errs)
 {
-  ProdRule_free_list(*((ProdRule **)val));
+  ParseErrors_clear(errs);
+  mem_free(errs->errs);
+  mem_free(errs);
 }
 
-void gmap_free(HashMap *gmap)
-{
-  HashMap_iter(gmap, gmap_free_val, NULL);
-  HashMap_deconstruct(gmap);
-}
 
-
-/******************************************************************************/
-/* First map																																	*/
-/******************************************************************************/
-
-
-FirstSetEl *fmap_get(HashMap *fmap, const char *name)
+ParseStack *ParseStack_push(ParseStack *stack, const char *sym, int state_no)
 {
-  FirstSetEl **out;
-  if ((out = HashMap_get(fmap, name, NULL)) == NULL) {
-    return NULL;
-  }
-  return *out;
+  ParseStack *new = mem_alloc(MEM_PARSE_STACK, sizeof(ParseStack));
+  new->sym = sym;
+  new->state_no = state_no;
+  new->next = stack;
+  return new;
 }
 
-
-HashMap *fmap_generate(HashMap *gmap, const char *root)
+ParseStack *ParseStack_pop(ParseStack *stack)
 {
-  HashMap *out;
-  FirstSetEl *fset_el;
-
-  out = HashMap_construct(sizeof(FirstSetEl *));
-
-  for (int i = 0; i < NUM_TERMINALS; i++) {
-    fset_el = fset_insert(NULL, i);
-    HashMap_set(out, terminals[i], (void *)&fset_el);
-  }
-
-  fmap_generate_here(out, root, gmap);
+  if (stack == NULL)
+    return NULL;
+  ParseStack *out = stack->next;
+  mem_free(stack);
   return out;
 }
 
-void fmap_generate_here(HashMap *fmap, const char *name, HashMap *gmap)
+void ParseStack_free(ParseStack *stack)
 {
-  ProdRule *prod_l, *rule_iter;
-  FirstSetEl *fset, *set_iter, **ret;
-
-  if ((HashMap_get(fmap, name, NULL)) == NULL) {
-    // generate new first map element with empty items list
-    fset = NULL;
-    // assume name exists in map because we generate first sets only for
-    // entries from grammar map
-    prod_l = *((ProdRule **)HashMap_get(gmap, name, NULL));
-    for (rule_iter = prod_l; rule_iter != NULL; rule_iter = rule_iter->next) {
-      if (strcmp(name, rule_iter->sym_l[0]) == 0)
-        continue;
-      fmap_generate_here(fmap, rule_iter->sym_l[0], gmap);
-      ret = (FirstSetEl **)HashMap_get(fmap, rule_iter->sym_l[0], NULL);
-
-      for (set_iter = *ret; set_iter != NULL; set_iter = set_iter->next) {
-        fset = fset_insert(fset, set_iter->token_type);
-      }
-    }
-    HashMap_set(fmap, name, (void *)&fset);
-  }
+  while ((stack = ParseStack_pop(stack)) != NULL);
 }
 
-void fmap_print_el(const char *name, void *val, void *_)
+void ParseStack_print(ParseStack *stack)
 {
-  FirstSetEl *fset = *((FirstSetEl **)val);
-
-  printf("FIRST(%s): {", (char *)name);
-  for (; fset != NULL; fset = fset->next) {
-    printf("%s,", terminals[fset->token_type]); 
+  printf("Stack contents...\n");
+  for (; stack != NULL; stack = stack->next) {
+    printf("<%s, %d>; ", stack->sym, stack->state_no);
   }
-  printf("}\n");
-}
-
-void fmap_print(HashMap *fmap)
-{
-  HashMap_iter(fmap, fmap_print_el, NULL);
+  printf("\n");
 }
 
-void fmap_free(HashMap *fmap)
-{
-  HashMap_iter(fmap, fset_free, NULL);
-  HashMap_deconstruct(fmap);
-}
 
 /******************************************************************************/
-/* First set                                                                  */
+/* Rules                                                                      */
+/* The rules are the flat arrays of the compiled grammar: the right sides of  */
+/* all rules in one array of symbol ids, rule r is                            */
+/* rhs[rule_off[r]] to rhs[rule_off[r + 1] - 1] and the rules of a            */
+/* non-terminal s are sym_rules[s] to sym_rules[s + 1] - 1.                   */
 /******************************************************************************/
 
-
-FirstSetEl *fset_insert(FirstSetEl *start, TokType t)
+void rule_print(Grammar *g, int rule)
 {
-  FirstSetEl *new, *iter, *prev;
-
-  prev = NULL;
-  for (iter = start; iter != NULL; iter = iter->next) {
-    if (t < iter->token_type) {
-      new = malloc(sizeof(FirstSetEl));
-      new->token_type = t;
-      new->next = iter;
-      if (prev != NULL) {
-        prev->next = new;
-        return start;
-      } else {
-        return new;
-      }
-    } else if (t == iter->token_type) { // don't add items that exist in set
-                                        // already
-      return start;
-    }
-    prev = iter;
-  }
-
-  // if it is not smaller than any other element insert it at the end
-  new = malloc(sizeof(FirstSetEl)); // rewrite malloc because it might be
-                                    // avoided in case when t is in set already
-                                    // this way no unnecessary memory allocations
-                                    // will be performed
-
-  new->token_type = t;
-  new->next = NULL;
-  if (prev == NULL) {
-    return new;
-  } else {
-    prev->next = new;
-    return start;
+  printf("[%s <- ", Grammar_name(g, g->rule_lhs[rule]));
+  for (int i = 0; i < GRAMMAR_RULE_LEN(g, rule); i++) {
+    printf(" '%s' ", Grammar_name(g, GRAMMAR_RULE_RHS(g, rule)[i]));
   }
+  printf("]");
 }
 
 
-
-void fset_free(const char *_1, void *val, void *_2)
-{
-  FirstSetEl *next, *iter;
-  for (iter = *((FirstSetEl **)val); iter != NULL; iter = next) {
-    next = iter->next;
-    free(iter);
-  }
-}
-
 /******************************************************************************/
 /* Canonical Collection Set																										*/
 /******************************************************************************/
 
-int cc_set_contains(LR1El *set, const char *sym, char *sym_l[],
-                    int pos, TokType lookahead, int num_rule_items)
+int cc_set_contains(LR1El *set, int rule, int pos, TokType lookahead)
 {
   LR1El *iter;
 
   for (iter = set; iter != NULL; iter = iter->next) {
-    if (strcmp(iter->rule->sym, sym) == 0 &&
-        string_set_equal(iter->rule->sym_l,
-          sym_l, iter->rule->num_symbols, num_rule_items) &&
-        iter->pos == pos && iter->lookahead == lookahead)
+    if (iter->rule == rule && iter->pos == pos &&
+        iter->lookahead == lookahead)
       return 1;
   }
 
@@ -592,8 +471,7 @@ int cc_set_is_subset(LR1El *set, LR1El *potential_subset)
 {
   LR1El *iter;
   for (iter = potential_subset; iter != NULL; iter = iter->next) {
-    if (!(cc_set_contains(set, iter->rule->sym, iter->rule->sym_l, iter->pos,
-            iter->lookahead, iter->rule->num_symbols))) {
+    if (!(cc_set_contains(set, iter->rule, iter->pos, iter->lookahead))) {
       return 0;
     }
   }
@@ -605,17 +483,18 @@ int cc_set_equal(LR1El *a, LR1El *b)
   return (cc_set_is_subset(a, b) && cc_set_is_subset(b, a));
 }
 
-LR1El *cc_set_append(LR1El *set, const char *sym, char *sym_l[],
-                    int pos, TokType lookahead, int num_rule_items)
+LR1El *cc_set_append(CCBuild *build, LR1El *set, int rule, int pos,
+    TokType lookahead)
 {
-  if (cc_set_contains(set, sym, sym_l,
-        pos, lookahead, num_rule_items)) {
+  if (cc_set_contains(set, rule, pos, lookahead)) {
     return set;
   }
-  LR1El *new = malloc(sizeof(LR1El));
-  new->rule = ProdRule_generate(sym);
-  new->rule->num_symbols = num_rule_items;
-  string_set_copy(sym_l, new->rule->sym_l, num_rule_items);
+  LR1El *new = build->free_items;
+  if (new != NULL)
+    build->free_items = new->next;
+  else
+    new = arena_alloc(build->arena, MEM_CC_ITEMS, sizeof(LR1El));
+  new->rule = rule;
   new->pos = pos;
   new->lookahead = lookahead;
   new->next = NULL;
@@ -625,33 +504,35 @@ LR1El *cc_set_append(LR1El *set, const char *sym, char *sym_l[],
   APPEND(set, last, new);
 }
 
-void cc_set_free(LR1El *set)
+// the items are kept for the next sets
+void cc_set_free(CCBuild *build, LR1El *set)
 {
-  LR1El *next;
-  int i;
+  LR1El *last;
 
-  for (; set != NULL; set = next) {
-    next = set->next;
-    ProdRule_free(set->rule);
-    free(set);
-  }
+  if (set == NULL)
+    return;
+  for (last = set; last->next != NULL; last = last->next);
+  last->next = build->free_items;
+  build->free_items = set;
 }
 
-void cc_set_print(LR1El *set)
+void cc_set_print(Grammar *g, LR1El *set)
 {
+  const int *rhs;
   int i;
 
   printf("{\n");
   for (; set != NULL; set = set->next) {
-    printf("[%s -> ", set->rule->sym);
-    for (i = 0; i < set->rule->num_symbols; i++) {
+    rhs = GRAMMAR_RULE_RHS(g, set->rule);
+    printf("[%s -> ", Grammar_name(g, g->rule_lhs[set->rule]));
+    for (i = 0; i < GRAMMAR_RULE_LEN(g, set->rule); i++) {
       if (set->pos == i)
         printf(" o");
-      printf(" %s", set->rule->sym_l[i]);
+      printf(" %s", Grammar_name(g, rhs[i]));
     }
     if (set->pos == i)
       printf(" o");
-    printf(", %s]\n", terminals[set->lookahead]);
+    printf(", %s]\n", Grammar_name(g, set->lookahead));
 
   }
   printf("}\n");
@@ -661,56 +542,56 @@ void cc_set_print(LR1El *set)
 
 // compute complete set of LR1 elements by trying to expand all of the
 // LR1 elements in set at the parsing position to get further LR1 elements
-LR1El *closure_set(LR1El *set, HashMap *fmap, HashMap *gmap)
+// the lookaheads of the new elements are FIRST of the rest of the rule after
+// the expanded symbol, and the lookahead of the element if all of the rest
+// is nullable
+LR1El *closure_set(CCBuild *build, Grammar *g, LR1El *set)
 {
   LR1El *iter;
-  ProdRule *rule, **gmap_get_out;
-  FirstSetEl *found;
-  int lookahead, i;
-  int counter = 0;
-
+  const unsigned *first;
+  const int *rhs;
+  int len, sym, i;
 
   for (iter = set; iter != NULL; iter = iter->next) {
-    if (iter->pos < iter->rule->num_symbols &&
-        (gmap_get_out =
-         (ProdRule **)HashMap_get(gmap, iter->rule->sym_l[iter->pos], NULL)) != NULL) {
-      rule = *gmap_get_out;
-      for (; rule != NULL; rule = rule->next) {
-        // go over all FIRST elements of
-        if (iter->pos + 1 < iter->rule->num_symbols &&
-            (found = fmap_get(fmap, iter->rule->sym_l[iter->pos + 1])) != NULL) {
-          for (; found != NULL; found = found->next) {
-            // insert into set
-            // note that this function will not allow duplicates to be inserted
-            set = cc_set_append(set, iter->rule->sym_l[iter->pos], rule->sym_l,
-                  0, found->token_type, rule->num_symbols);
-          }
-        } else {
-          set = cc_set_append(set, iter->rule->sym_l[iter->pos], rule->sym_l,
-                0, iter->lookahead, rule->num_symbols);
+    rhs = GRAMMAR_RULE_RHS(g, iter->rule);
+    len = GRAMMAR_RULE_LEN(g, iter->rule);
+    if (iter->pos == len || GRAMMAR_IS_TERM(g, rhs[iter->pos]))
+      continue;
+    sym = rhs[iter->pos];
+    for (int r = g->sym_rules[sym]; r < g->sym_rules[sym + 1]; r++) {
+      for (i = iter->pos + 1; i < len; i++) {
+        first = Grammar_first(g, rhs[i]);
+        for (int t = 0; t < g->num_terms; t++) {
+          // note that this function will not allow duplicates to be inserted
+          if (GRAMMAR_IN_SET(first, t))
+            set = cc_set_append(build, set, r, 0, t);
         }
+        if (!g->nullable[rhs[i]])
+          break;
       }
+      if (i == len)
+        set = cc_set_append(build, set, r, 0, iter->lookahead);
     }
   }
 
   return set;
 }
 
-LR1El *goto_set(LR1El *set, const char *sym, HashMap *fmap, HashMap *gmap)
+LR1El *goto_set(CCBuild *build, Grammar *g, LR1El *set, int sym)
 {
   LR1El *out = NULL;
 
   for (; set != NULL; set = set->next) {
     // if parsing position has already reached end of rule can't go anywhere
-    if (set->pos + 1 <= set->rule->num_symbols &&
+    if (set->pos < GRAMMAR_RULE_LEN(g, set->rule) &&
         // check if goto_set symbol follows current parsing position
-        strcmp(set->rule->sym_l[set->pos], sym) == 0) {
-      out = cc_set_append(out, set->rule->sym, set->rule->sym_l, set->pos + 1, set->lookahead,
-          set->rule->num_symbols);
+        GRAMMAR_RULE_RHS(g, set->rule)[set->pos] == sym) {
+      out = cc_set_append(build, out, set->rule, set->pos + 1,
+          set->lookahead);
     }
   }
 
-  return closure_set(out, fmap, gmap);
+  return closure_set(build, g, out);
 }
 
 
@@ -719,13 +600,14 @@ LR1El *goto_set(LR1El *set, const char *sym, HashMap *fmap, HashMap *gmap)
 /******************************************************************************/
 
 
-CC *CC_insert(CC *cc, int state_no, LR1El *cc_set)
+CC *CC_insert(CCBuild *build, CC *cc, int state_no, LR1El *cc_set)
 {
-  CC *out = malloc(sizeof(CC));
+  CC *out = arena_alloc(build->arena, MEM_CC_STATES, sizeof(CC));
   out->state_no = state_no;
   out->cc_set = cc_set;
 
-  out->goto_map = HashMap_construct(sizeof(CC *));
+  out->goto_map = HashMap_construct_in(build->arena, sizeof(CC *),
+      MEM_CC_GOTO);
 
   out->next = cc;
   return out;
@@ -742,61 +624,49 @@ CC *CC_find(CC *cc, LR1El *cc_set)
   return NULL;
 }
 
-void CC_deconstruct(CC *root)
-{
-  CC *next;
-  for (; root != NULL; root = next) {
-    next = root->next;
-    HashMap_deconstruct(root->goto_map);
-    cc_set_free(root->cc_set);
-    free(root);
-  }
-}
-
-CC *CC_construct(HashMap *gmap, HashMap *fmap, const char *root)
+// Everything is allocated in 'arena', the collection lives until the arena
+// is freed.
+CC *CC_construct(Grammar *g, Arena *arena)
 {
-  CC *out, *workset, *goto_target;
+  CC *out, *goto_target;
+  CC workset;
   CCStack *workstack;  
   LR1El *cc_set, *iter_set;
-  ProdRule *rule, **gmap_get_out;
-  int state_no;
+  int state_no, sym;
+  CCBuild build = {arena, NULL};
 
   out = NULL;
   workstack = NULL;
   cc_set = NULL; // empty set
   state_no = 0;
-  workset = malloc(sizeof(CC));
 
-  // get first item in grammar map
-  if ((gmap_get_out = (ProdRule **)HashMap_get(gmap, root, NULL)) != NULL) {
-    rule = *gmap_get_out;
-    for (; rule != NULL; rule = rule->next) {
-      cc_set = cc_set_append(cc_set, root, rule->sym_l, 0, NONE, rule->num_symbols);
-    }
+  // the rules of the root
+  for (int r = g->sym_rules[g->start]; r < g->sym_rules[g->start + 1]; r++) {
+    cc_set = cc_set_append(&build, cc_set, r, 0, NONE);
   }
-  cc_set = closure_set(cc_set, fmap, gmap);
-  out = CC_insert(out, state_no, cc_set);
+  cc_set = closure_set(&build, g, cc_set);
+  out = CC_insert(&build, out, state_no, cc_set);
 
-  workstack = CCStack_push(workstack, out);
+  workstack = CCStack_push(&build, workstack, out);
   while (workstack != NULL) {
-    workstack = CCStack_pop(workstack, workset);
-    for (iter_set = workset->cc_set; iter_set != NULL; iter_set = iter_set->next) {
-      if (iter_set->pos < iter_set->rule->num_symbols) {
-        cc_set = goto_set(workset->cc_set, iter_set->rule->sym_l[iter_set->pos], fmap, gmap);
+    workstack = CCStack_pop(workstack, &workset);
+    for (iter_set = workset.cc_set; iter_set != NULL; iter_set = iter_set->next) {
+      if (iter_set->pos < GRAMMAR_RULE_LEN(g, iter_set->rule)) {
+        sym = GRAMMAR_RULE_RHS(g, iter_set->rule)[iter_set->pos];
+        cc_set = goto_set(&build, g, workset.cc_set, sym);
         if ((goto_target = CC_find(out, cc_set)) == NULL) {
-          out = CC_insert(out, ++state_no, cc_set);
-          workstack = CCStack_push(workstack, out);
+          out = CC_insert(&build, out, ++state_no, cc_set);
+          workstack = CCStack_push(&build, workstack, out);
           goto_target = out;
         } else {
-          cc_set_free(cc_set);
+          cc_set_free(&build, cc_set);
         }
-        HashMap_set(workset->goto_map, iter_set->rule->sym_l[iter_set->pos],
+        HashMap_set(workset.goto_map, Grammar_name(g, sym),
             (void *)&goto_target);
       }
     }
   }
 
-  free(workset);
   return out;
 }
 
@@ -806,11 +676,11 @@ static void conn_print(const char *key, void *val, void *_)
   printf("if '%s' -> %d\n", key, conn_item->state_no);
 }
 
-void CC_print(CC *cc)
+void CC_print(Grammar *g, CC *cc)
 {
   for (; cc != NULL; cc = cc->next) {
     printf("State %d: ", cc->state_no);
-    cc_set_print(cc->cc_set);
+    cc_set_print(g, cc->cc_set);
     printf("Connected to these states over these connections: [\n");
     HashMap_iter(cc->goto_map, conn_print, NULL);
     printf("]\n\n");
@@ -819,9 +689,9 @@ void CC_print(CC *cc)
 
 
 
-CCStack *CCStack_push(CCStack *stack, CC *cc)
+CCStack *CCStack_push(CCBuild *build, CCStack *stack, CC *cc)
 {
-  CCStack *new = malloc(sizeof(CCStack));
+  CCStack *new = arena_alloc(build->arena, MEM_CC_STATES, sizeof(CCStack));
   new->cc = cc;
   new->next = stack;
   return new;
@@ -830,16 +700,5 @@ CCStack *CCStack_push(CCStack *stack, CC *cc)
 CCStack *CCStack_pop(CCStack *stack, CC *out)
 {
   memcpy(out, stack->cc, sizeof(CC));
-  CCStack *new_first = stack->next;
-  free(stack);
-  return new_first;
-}
-
-void CCStack_free(CCStack *stack)
-{
-  CCStack *next;
-  for (; stack != NULL; stack = next) {
-    next = stack->next;
-    free(stack);
-  }
+  return stack->next;
 }
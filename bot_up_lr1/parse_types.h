@@ -1,8 +1,10 @@
 #ifndef PARSE_TYPES_H
 #define PARSE_TYPES_H
 
+#include <stdio.h>
 #include "parser.h"
 #include "util_types.h"
+#include "grammar.h"
 
 #define APPEND(LIST, LAST, NEW) ({\
   if (LIST != NULL) {\
@@ -14,27 +16,11 @@
   }\
 })
 
-#define TOK_LEN 50
-#define MAX_TERMS_PER_RULE 10
-
-typedef struct _ProdRule {
-  char *sym;
-  int num_symbols;
-  char *sym_l[MAX_TERMS_PER_RULE];
-  struct _ProdRule *next;
-} ProdRule;
-
-
-typedef struct _FirstSetEl {
-  TokType token_type;
-  struct _FirstSetEl *next;
-} FirstSetEl;
-
-
 // LR1 element to make up linked list representing a set in the
-// canonical collection of sets
+// canonical collection of sets, 'rule' is the number of a rule of the
+// compiled grammar
 typedef struct _LR1El {
-  ProdRule *rule;
+  int rule;
   int pos;
   TokType lookahead;
   struct _LR1El *next;
@@ -53,13 +39,21 @@ typedef struct _CCStack {
   struct _CCStack *next;
 } CCStack;
 
+// Memory the canonical collection is built in. Nothing is freed on its own,
+// the arena goes as a whole once the parse table is built. Items of sets
+// that turn out to be in the collection already are used again.
+typedef struct _CCBuild {
+  Arena *arena;
+  LR1El *free_items;
+} CCBuild;
+
 
 
 typedef enum _ActionType {SHIFT, REDUCE, ACCEPT} ActionType;
 
 typedef union _ActionInstr {
   int state_no;
-  ProdRule *red_rule;
+  int red_rule; // rule of the compiled grammar
 } ActionInstr;
 
 typedef struct _Action {
@@ -68,21 +62,51 @@ typedef struct _Action {
 } Action;
 
 
+// all actions of a cell that has more than one
+typedef struct _ActionList {
+  Action *acts;
+  int size;
+  int capacity;
+} ActionList;
+
+// room for the state number, the space and the '\0' of a table key
+#define PTABLE_KEY_EXTRA 16
+
 typedef struct _PTable {
+  Grammar *g; // the rules the reduce actions refer to
+  int key_len; // buffer length for the keys of this table
   HashMap *action_t;
   HashMap *goto_t;
+  // cells with conflicting actions map to an ActionList here as well, the
+  // action_t entry is the action the plain LR driver takes
+  HashMap *conflict_t;
+  int num_conflicts;
 } PTable;
 
 
-typedef struct _GotoParams {
-  CC *cc;
-  HashMap *goto_t;
-} GotoParams;
+// shifts needed after an error before the next error is reported
+#define ERR_RECOVERY_SHIFTS 3
+#define DEFAULT_MAX_ERRORS 100
+
+typedef struct _ParseError {
+  long offset;
+  int length;
+  TokType found; // LEX_ERROR if the lexer could not match the input
+  TokType *expected; // terminals with an action in the state of the error
+  int num_expected;
+} ParseError;
 
+typedef struct _ParseErrors {
+  ParseError *errs;
+  int size;
+  int capacity;
+  int max_errors;
+} ParseErrors;
 
 
+// symbols are not copied, they point into the grammar
 typedef struct _ParseStack {
-  char *sym;
+  const char *sym;
   int state_no;
   struct _ParseStack *next;
 } ParseStack;
@@ -91,80 +115,58 @@ typedef struct _ParseStack {
 
 
 
-int is_terminal(const char *name);
-TokType terminal_name_to_type(const char *name);
-
-int get_token(FILE *in, char *buf);
-void unget_token(FILE *in, char *token);
-
-void key_gen(char *buf, int state_no, const char *token_type);
-PTable PTable_construct(const char *root, CC *cc, HashMap *gmap);
-void add_to_goto(const char *key, void *val, void *params);
+void key_gen(char *buf, int len, int state_no, const char *token_type);
+PTable PTable_construct(Grammar *g, CC *cc);
 void act_table_free_el(const char *key, void *val, void *_);
 void *state_list_reduce(const char *key, void *_, void *list);
 void *non_terminals_list_reduce(const char *key, void *_, void *list);
-void Action_print(Action act);
+Action *action_get(PTable table, int state_no, TokType tt);
+Action *action_get_all(PTable table, int state_no, TokType tt, int *num_out);
+void Action_print(Grammar *g, Action act);
 void PTable_print(PTable table);
 void PTable_free(PTable table);
 
 
+ParseErrors *ParseErrors_construct(int max_errors);
+void ParseErrors_grow(ParseErrors *errs);
+int ParseErrors_add(ParseErrors *errs, PTable table, int state_no,
+    TokType found, long offset, int length);
+int ParseErrors_add_expected(ParseErrors *errs, const char *expected,
+    int num_terminals, TokType found, long offset, int length);
+void ParseErrors_fprint(FILE *out, Grammar *g, ParseErrors *errs);
+void ParseErrors_print(Grammar *g, ParseErrors *errs);
+void ParseErrors_clear(ParseErrors *errs);
+void ParseErrors_free(ParseErrors *errs);
+
+
 ParseStack *ParseStack_push(ParseStack *stack, const char *sym, int state_no);
 ParseStack *ParseStack_pop(ParseStack *stack);
 void ParseStack_free(ParseStack *stack);
 void ParseStack_print(ParseStack *stack);
 
 
-ProdRule *ProdRule_generate();
-ProdRule *ProdRule_append(ProdRule *list, ProdRule *rule);
-ProdRule *ProdRule_generate(const char *sym);
-ProdRule *ProdRule_generate_list(FILE *g_file, const char *sym);
-HashMap *gmap_generate(FILE *g_file, char *root_out);
-void ProdRule_print(ProdRule *rule);
-void ProdRule_print_list(ProdRule *list);
-void gmap_print(HashMap *gmap);
-
-void ProdRule_free(ProdRule *rule);
-void ProdRule_free_list(ProdRule *prod_l);
-void gmap_free(HashMap *gmap);
-
-
-FirstSetEl *fmap_get(HashMap *fmap, const char *name);
-HashMap *fmap_generate(HashMap *gmap, const char *root);
-void fmap_generate_here(HashMap *map, const char *name, HashMap *gmap);
-void fmap_print(HashMap *fmap);
-void fmap_free(HashMap *fmap);
-
-
-FirstSetEl *fset_insert(FirstSetEl *start, TokType t);
-void fset_free(const char *_1, void *val, void *_2);
-
-int cc_set_contains(LR1El *set, const char *sym, char *sym_l[],
-      int pos, TokType lookahead, int num_rule_items);
+void rule_print(Grammar *g, int rule);
 
+int cc_set_contains(LR1El *set, int rule, int pos, TokType lookahead);
 int cc_set_equal(LR1El *a, LR1El *b);
 int cc_set_is_subset(LR1El *set, LR1El *potential_subset);
-
-LR1El *cc_set_append(LR1El *set, const char *sym, char *sym_l[],
-      int pos, TokType lookahead, int num_rule_items);
-
-void cc_set_free(LR1El *set);
-
-void cc_set_print(LR1El *set);
+LR1El *cc_set_append(CCBuild *build, LR1El *set, int rule, int pos,
+    TokType lookahead);
+void cc_set_free(CCBuild *build, LR1El *set);
+void cc_set_print(Grammar *g, LR1El *set);
 
 
-CCStack *CCStack_push(CCStack *stack, CC *cc);
+CCStack *CCStack_push(CCBuild *build, CCStack *stack, CC *cc);
 CCStack *CCStack_pop(CCStack *stack, CC *out);
-void CCStack_free(CCStack *stack);
 
 
-LR1El *closure_set(LR1El *set, HashMap *fmap, HashMap *gmap);
-LR1El *goto_set(LR1El *set, const char *sym, HashMap *fmap, HashMap *gmap);
+LR1El *closure_set(CCBuild *build, Grammar *g, LR1El *set);
+LR1El *goto_set(CCBuild *build, Grammar *g, LR1El *set, int sym);
 
-CC *CC_insert(CC *cc, int state_no, LR1El *cc_set);
+CC *CC_insert(CCBuild *build, CC *cc, int state_no, LR1El *cc_set);
 CC *CC_find(CC *cc, LR1El *cc_set);
-void CC_deconstruct(CC *root);
-CC *CC_construct(HashMap *gmap, HashMap *fmap, const char *root);
-void CC_print(CC *cc);
+CC *CC_construct(Grammar *g, Arena *arena);
+void CC_print(Grammar *g, CC *cc);
 
 
 #endif
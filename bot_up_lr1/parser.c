@@ -1,85 +1,419 @@
 #include <stdio.h>
 #include <stdlib.h> // for exit
 #include <string.h>
+#include <time.h> // for clock_gettime
+#include <unistd.h> // for sysconf
+#include <getopt.h>
 
 #include "parser.h"
 #include "parse_types.h"
 #include "util_types.h"
+#include "tok_buf.h"
+#include "dfa_lex.h"
+#include "driver.h"
+#include "incr_parse.h"
+#include "glr.h"
+#include "opp.h"
+#include "eval.h"
+#include "server.h"
+#include "registry.h"
 
 
-int check_grammar(PTable ptable, const char *root)
+static void usage()
 {
-  ParseStack *pstack = ParseStack_push(NULL, root, 0);
-  TokType tt = yylex();
-  Action *act;
-  int *goto_state;
-  char buf[FORMAT_BUFLEN];
-  int out = 0;
-
-  while (1) {
-    key_gen(buf, pstack->state_no, terminals[tt]);
-    act = (Action *)HashMap_get(ptable.action_t, buf, NULL);
-    if (act == NULL) {
-      break;
-    } else if (act->act_type == REDUCE) {
-      for (int i = 0; i < act->act_instr.red_rule->num_symbols; i++) {
-        pstack = ParseStack_pop(pstack);
-      }
-      key_gen(buf, pstack->state_no, act->act_instr.red_rule->sym);
-      if ((goto_state = (int *)HashMap_get(ptable.goto_t, buf, NULL)) == NULL) {
-        error("state %d needs to have a goto state for symbol '%s'",
-            pstack->state_no, act->act_instr.red_rule->sym);
-      }
-      pstack = ParseStack_push(pstack, act->act_instr.red_rule->sym, *goto_state);
-    } else if (act->act_type == SHIFT) {
-      pstack = ParseStack_push(pstack, terminals[tt], act->act_instr.state_no);
-      tt = yylex();
-    } else if (act->act_type == ACCEPT && tt == NONE) {
-      out = 1;
-      break;
+  fprintf(stderr, "Usage: parser [-j lexer_threads] [-e max_errors] "
+      "[-l lexer_tables] [-D lexer_tables_out] [--mem-report]\n"
+      "              grammar_file [parse_file]\n"
+      "       parser -i [options] grammar_file parse_file < edits\n"
+      "       parser -g [-f] [options] grammar_file [parse_file]\n"
+      "       parser -O [-f] [options] grammar_file [parse_file]\n"
+      "       parser -v [options] grammar_file [parse_file]\n"
+      "       parser -b [options] grammar_file [parse_file]\n"
+      "       parser -B rounds [options] grammar_file [parse_file]\n"
+      "       parser -S socket [-v] [-j workers] [options] grammar_file...\n");
+  exit(1);
+}
+
+static void print_result(int correct)
+{
+  if (correct) {
+    printf("Grammar correct\n");
+  } else {
+    printf("Grammar incorrect\n");
+  }
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parse the same tokens 'rounds' times with the LR(1) table, with the LR(1)
+// table computing the value and with the operator precedence table and
+// compare the time per parse.
+static void benchmark(PTable ptable, const char *root, OpTable *optable,
+    EvalTable *evaltable, TokBuf *toks, int rounds, int max_errors)
+{
+  ParseErrors *errs;
+  int lr_correct = 0, eval_correct = 0, opp_correct = 0;
+  double start, lr_time, eval_time, opp_time, value;
+
+  start = seconds();
+  for (int i = 0; i < rounds; i++) {
+    errs = ParseErrors_construct(max_errors);
+    lr_correct = check_grammar(ptable, root, toks, errs);
+    ParseErrors_free(errs);
+  }
+  lr_time = (seconds() - start) / rounds;
+
+  start = seconds();
+  for (int i = 0; i < rounds; i++) {
+    errs = ParseErrors_construct(max_errors);
+    eval_correct = lr_eval(ptable, evaltable, toks, errs, &value);
+    ParseErrors_free(errs);
+  }
+  eval_time = (seconds() - start) / rounds;
+
+  start = seconds();
+  for (int i = 0; i < rounds; i++) {
+    errs = ParseErrors_construct(max_errors);
+    opp_correct = opp_parse(optable, toks, errs, NULL, NULL);
+    ParseErrors_free(errs);
+  }
+  opp_time = (seconds() - start) / rounds;
+
+  printf("%d tokens, %d rounds\n", toks->size, rounds);
+  printf("LR(1):               %10.3f ms per parse, %d table entries\n",
+      lr_time * 1e3, ptable.action_t->size + ptable.goto_t->size);
+  printf("LR(1) with values:   %10.3f ms per parse\n", eval_time * 1e3);
+  printf("operator precedence: %10.3f ms per parse, %d table entries\n",
+      opp_time * 1e3, 4 * optable->num_terminals);
+  if (lr_correct != opp_correct || lr_correct != eval_correct) {
+    printf("the parsers disagree on the input\n");
+  }
+  print_result(lr_correct);
+}
+
+// Evaluate every line of the input as an expression of its own. Lines are
+// compiled to bytecode once per distinct text and then all of them are
+// evaluated in batches of the same shape. Every line is compiled and gets
+// its value or 'error', only the errors listed are limited by 'max_errors'.
+static void batch_eval(PTable ptable, EvalTable *evaltable, Dfa *dfa,
+    Input in, int max_errors)
+{
+  EvalCache *cache = EvalCache_construct(evaltable);
+  ParseErrors *errs = ParseErrors_construct(max_errors);
+  // errors of the lines after the budget is used up, never listed
+  ParseErrors *unlisted = ParseErrors_construct(max_errors);
+  int cap = EVAL_PROG_INIT_CAP, num = 0, correct = 0, num_unlisted = 0;
+  int *progs = malloc(cap * sizeof(int));
+  double *values;
+  const char *nl;
+  long start, end;
+
+  for (start = 0; start < in.len; start = end + 1) {
+    nl = memchr(in.data + start, '\n', in.len - start);
+    end = (nl != NULL) ? nl - in.data : in.len;
+    if (num == cap) {
+      cap *= 2;
+      progs = realloc(progs, cap * sizeof(int));
+    }
+    if (errs->size < max_errors) {
+      progs[num] = EvalCache_compile(cache, ptable, dfa, in.data, start, end,
+          errs);
     } else {
-      break;
+      progs[num] = EvalCache_compile(cache, ptable, dfa, in.data, start, end,
+          unlisted);
+      num_unlisted += (progs[num] < 0);
+      ParseErrors_clear(unlisted);
     }
+    correct += (progs[num] >= 0);
+    num++;
+  }
+
+  // lines with errors are left out of the batch
+  int *ok = malloc(num * sizeof(int));
+  int num_ok = 0;
+  for (int i = 0; i < num; i++) {
+    if (progs[i] >= 0)
+      ok[num_ok++] = progs[i];
   }
-  ParseStack_free(pstack);
-  return out;
+  values = malloc(num_ok * sizeof(double));
+  eval_batch(cache, ok, num_ok, values);
+
+  ParseErrors_print(ptable.g, errs);
+  if (num_unlisted > 0)
+    printf("%d more lines with errors are not listed\n", num_unlisted);
+  for (int i = 0, j = 0; i < num; i++) {
+    if (progs[i] >= 0)
+      printf("%.15g\n", values[j++]);
+    else
+      printf("error\n");
+  }
+  printf("%d expressions, %d compiled (%d from the cache), %d shapes\n",
+      num, cache->num_progs, cache->hits, cache->num_shapes);
+  print_result(correct == num && errs->size == 0);
+
+  free(values);
+  free(ok);
+  free(progs);
+  ParseErrors_free(unlisted);
+  ParseErrors_free(errs);
+  EvalCache_free(cache);
 }
 
-int main(int argc, char *argv[])
+// Apply edits read from stdin to the parse file and reparse incrementally.
+// Every line is '<offset> <old_len> <text>' and replaces old_len bytes at
+// offset by text, in which '\\n' stands for a newline and '\\\\' for a
+// backslash.
+static void incremental(IncrParse *ip)
 {
-  if (argc < 2) {
-    fprintf(stderr, "Usage: parser grammar_file [parse_file]\n");
-    exit(1);
-  }
+  char *line = NULL, *text, *p, *q;
+  size_t cap = 0;
+  ssize_t n;
+  long start, old_len;
+  int used;
 
-  FILE *grammar_f;
-  if (!(grammar_f = fopen(argv[1], "r"))) {
-    error("can't open file '%s'", argv[1]);
+  while ((n = getline(&line, &cap, stdin)) > 0) {
+    if (line[n - 1] == '\n')
+      line[--n] = '\0';
+    if (sscanf(line, "%ld %ld%n", &start, &old_len, &used) != 2) {
+      fprintf(stderr, "bad edit '%s'\n", line);
+      continue;
+    }
+    // exactly one space separates the text so it can start with spaces
+    text = line + used + (line[used] == ' ');
+    for (p = q = text; *p != '\0'; p++) {
+      if (*p == '\\' && p[1] == 'n') {
+        *q++ = '\n';
+        p++;
+      } else if (*p == '\\' && p[1] == '\\') {
+        *q++ = '\\';
+        p++;
+      } else {
+        *q++ = *p;
+      }
+    }
+    IncrParse_edit(ip, start, old_len, text, q - text);
+    ParseErrors_print(ip->ptable.g, ip->errs);
+    print_result(IncrParse_correct(ip));
+    printf("relexed %d tokens, reparsed %d of %d tokens\n",
+        ip->relexed, ip->reparsed, ip->toks->size);
   }
+  free(line);
+}
 
-  char root[TOK_LEN];
-  
-  HashMap *gmap = gmap_generate(grammar_f, root);
-  gmap_print(gmap);
-  fclose(grammar_f);
+int main(int argc, char *argv[])
+{
+  int opt;
+  int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_errors = DEFAULT_MAX_ERRORS;
+  char *lex_tables_in = NULL, *lex_tables_out = NULL, *socket_path = NULL;
+  int incr = 0, glr = 0, print_forest = 0, opp = 0, eval = 0, batch = 0;
+  int rounds = 0, mem_report_on = 0;
+  static struct option long_opts[] = {
+    {"mem-report", no_argument, NULL, 'M'},
+    {NULL, 0, NULL, 0}
+  };
 
-  HashMap *fmap = fmap_generate(gmap, root);
+  while ((opt = getopt_long(argc, argv, "j:e:l:D:igfOvbB:S:", long_opts, NULL))
+      != -1) {
+    switch (opt) {
+      case 'i':
+        incr = 1;
+        break;
+      case 'g':
+        glr = 1;
+        break;
+      case 'f':
+        print_forest = 1;
+        break;
+      case 'O':
+        opp = 1;
+        break;
+      case 'v':
+        eval = 1;
+        break;
+      case 'b':
+        batch = 1;
+        break;
+      case 'B':
+        rounds = atoi(optarg);
+        if (rounds < 1)
+          usage();
+        break;
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 'e':
+        max_errors = atoi(optarg);
+        if (max_errors < 1)
+          usage();
+        break;
+      case 'l':
+        lex_tables_in = optarg;
+        break;
+      case 'D':
+        lex_tables_out = optarg;
+        break;
+      case 'S':
+        socket_path = optarg;
+        break;
+      case 'M':
+        mem_report_on = 1;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc || (incr && optind + 1 >= argc) ||
+      (incr + glr + opp + eval + batch + (rounds > 0) > 1) || (print_forest && !glr && !opp) ||
+      // the daemon takes -v to also serve values, the memory accounting
+      // is not made for threads
+      (socket_path != NULL && (incr + glr + opp + batch + (rounds > 0) > 0 ||
+                               mem_report_on)) ||
+      // the daemon takes any number of grammars, but lexer tables are for
+      // one of them
+      (socket_path != NULL && optind + 1 < argc &&
+       (lex_tables_in != NULL || lex_tables_out != NULL))) {
+    usage();
+  }
+  // before anything is allocated, a block must be freed the way it was
+  // allocated
+  if (mem_report_on)
+    mem_accounting_start();
 
+  // the daemon serves every grammar file given, the other modes the first;
+  // lexer tables are either compiled from the patterns in the grammar file
+  // or mapped from a file written with -D before
+  Registry *reg = Registry_construct(socket_path != NULL && eval);
+  for (int i = optind; i < ((socket_path != NULL) ? argc : optind + 1); i++) {
+    Language *l = Registry_get(reg, Registry_load(reg, argv[i],
+          lex_tables_in));
+    Grammar_print(l->g);
+    if (l->ptable.num_conflicts > 0 && !glr && !opp) {
+      fprintf(stderr, "warning: %d cells of the parse table have conflicting "
+          "actions, only one of them is used (use -g to try all)\n",
+          l->ptable.num_conflicts);
+    }
+    if (l->no_values != NULL) {
+      fprintf(stderr, "warning: %s: %s, value requests for it are refused\n",
+          argv[i], l->no_values);
+    }
+  }
+  Language *lang = Registry_get(reg, 0);
+  Grammar *grammar = lang->g;
+  PTable ptable = lang->ptable;
+  const char *root = lang->root;
+  Dfa *dfa = lang->dfa;
+  if (lex_tables_out != NULL) {
+    Dfa_write(dfa, lex_tables_out);
+  }
 
-  CC *cc = CC_construct(gmap, fmap, root);
+  if (socket_path != NULL) {
+    // serves until it is stopped and does not return
+    Server_run(reg, max_errors, socket_path, num_threads);
+  }
 
-  PTable ptable = PTable_construct(root, cc, gmap);
+  Input in = Input_read((optind + 1 < argc) ? argv[optind + 1] : NULL);
 
-  if (check_grammar(ptable, root)) {
-    printf("Grammar correct\n");
+  if (incr) {
+    // the document is copied so it can be edited, the file stays as it is
+    IncrParse *ip = IncrParse_construct(ptable, root, dfa, in.data, in.len,
+        num_threads, max_errors);
+    Input_free(in);
+    ParseErrors_print(ip->ptable.g, ip->errs);
+    print_result(IncrParse_correct(ip));
+    incremental(ip);
+    IncrParse_free(ip);
+  } else if (glr) {
+    TokBuf *toks = lex_parallel(dfa, in.data, in.len, num_threads, NULL);
+    ParseErrors *errs = ParseErrors_construct(max_errors);
+    Glr *g = glr_parse(ptable, toks, errs);
+    ParseErrors_print(grammar, errs);
+    if (g->root_node != NULL) {
+      int num_nodes;
+      SppfNode **forest = Sppf_collect(g->root_node, &num_nodes);
+      if (print_forest)
+        Sppf_print(forest, num_nodes);
+      printf("parse forest: %d nodes, %d ambiguous, "
+          "%d of %d positions parsed on a single stack\n",
+          num_nodes, Sppf_num_ambiguous(forest, num_nodes),
+          g->det_levels, g->det_levels + g->forked_levels);
+      free(forest);
+    }
+    print_result(g->root_node != NULL);
+    Glr_free(g);
+    ParseErrors_free(errs);
+    TokBuf_free(toks);
+    Input_free(in);
+  } else if (opp) {
+    OpTable *optable = OpTable_construct(grammar);
+    OpTable_print(optable);
+    TokBuf *toks = lex_parallel(dfa, in.data, in.len, num_threads, NULL);
+    ParseErrors *errs = ParseErrors_construct(max_errors);
+    int *postfix = malloc(toks->size * sizeof(int));
+    int len;
+    int correct = opp_parse(optable, toks, errs, postfix, &len);
+    ParseErrors_print(grammar, errs);
+    if (correct && print_forest)
+      opp_print_postfix(toks, in.data, postfix, len);
+    print_result(correct);
+    free(postfix);
+    ParseErrors_free(errs);
+    TokBuf_free(toks);
+    OpTable_free(optable);
+    Input_free(in);
+  } else if (eval) {
+    EvalTable *evaltable = EvalTable_construct(grammar);
+    TokBuf *toks = lex_parallel(dfa, in.data, in.len, num_threads,
+        evaltable->numeric);
+    ParseErrors *errs = ParseErrors_construct(max_errors);
+    double value;
+    int correct = lr_eval(ptable, evaltable, toks, errs, &value);
+    ParseErrors_print(grammar, errs);
+    if (correct)
+      printf("value: %.15g\n", value);
+    print_result(correct);
+    ParseErrors_free(errs);
+    TokBuf_free(toks);
+    EvalTable_free(evaltable);
+    Input_free(in);
+  } else if (batch) {
+    EvalTable *evaltable = EvalTable_construct(grammar);
+    batch_eval(ptable, evaltable, dfa, in, max_errors);
+    EvalTable_free(evaltable);
+    Input_free(in);
+  } else if (rounds > 0) {
+    OpTable *optable = OpTable_construct(grammar);
+    EvalTable *evaltable = EvalTable_construct(grammar);
+    TokBuf *toks = lex_parallel(dfa, in.data, in.len, num_threads,
+        evaltable->numeric);
+    benchmark(ptable, root, optable, evaltable, toks, rounds, max_errors);
+    TokBuf_free(toks);
+    EvalTable_free(evaltable);
+    OpTable_free(optable);
+    Input_free(in);
   } else {
-    printf("Grammar incorrect\n");
+    TokBuf *toks = lex_parallel(dfa, in.data, in.len, num_threads, NULL);
+    ParseErrors *errs = ParseErrors_construct(max_errors);
+    int correct = check_grammar(ptable, root, toks, errs);
+    ParseErrors_print(grammar, errs);
+    print_result(correct);
+    ParseErrors_free(errs);
+    TokBuf_free(toks);
+    Input_free(in);
+  }
+
+  if (mem_report_on) {
+    mem_report();
+    fprintf(stderr, "compiled grammar: %.1f kB in one block, not counted "
+        "above\n", grammar->data_len / 1024.0);
   }
 
-  CC_deconstruct(cc);
-  PTable_free(ptable);
-  fmap_free(fmap);
-  gmap_free(gmap);
+  Registry_free(reg);
 }
 
 
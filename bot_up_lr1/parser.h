@@ -1,20 +1,11 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#define NUM_TERMINALS 7
+// dense id of a terminal declared with '%token' or '%lex' in the grammar file,
+// the same as its symbol id in the compiled grammar
+// id 0 is always the end of input
+typedef int TokType;
 
-typedef enum type {
-  NONE = 0,
-  T_PLUS = 1,
-  T_MINUS = 2,
-  T_TIMES = 3,
-  T_LBRACKET = 4,
-  T_RBRACKET = 5,
-  T_NUMBER = 6
-} TokType;
-
-extern char *terminals[];
-
-extern int yylex();
+#define NONE 0
 
 #endif
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+
+
+// read exactly 'len' bytes, returns 0 if the other side closed the
+// connection or there was an error before that
+int proto_read(int fd, void *buf, long len)
+{
+  char *p = buf;
+  long n;
+
+  while (len > 0) {
+    if ((n = read(fd, p, len)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+int proto_write(int fd, const void *buf, long len)
+{
+  const char *p = buf;
+  long n;
+
+  while (len > 0) {
+    if ((n = write(fd, p, len)) < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static int proto_address(const char *path, struct sockaddr_un *addr)
+{
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "error: socket path '%s' is too long\n", path);
+    return 0;
+  }
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return 1;
+}
+
+// a socket left behind by a daemon that did not stop cleanly is replaced,
+// returns -1 on errors
+int proto_listen(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (!proto_address(path, &addr))
+    return -1;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int proto_connect(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (!proto_address(path, &addr))
+    return -1;
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
@@ -0,0 +1,42 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Requests and replies between the parse daemon (parser -S) and its clients.
+// Both are a fixed header followed by 'len' bytes, in the byte order of the
+// machine since the socket is a local one. A connection carries any number
+// of requests, one after the other, every request gets one reply.
+
+// what a request asks for
+#define PROTO_CHECK 0 // is the input in the language of the grammar
+#define PROTO_EVAL 1 // and if it is, what its value is (daemon started with -v)
+
+// status of a reply
+#define PROTO_ACCEPT 0
+#define PROTO_REJECT 1 // the errors are in the text of the reply
+#define PROTO_BAD_REQUEST 2 // the text says why
+
+// longer input is refused and the connection is closed
+#define PROTO_MAX_INPUT (64 << 20)
+
+// followed by the input
+typedef struct _ProtoRequest {
+  int op;
+  int grammar; // handle, the position of the grammar file on the command line
+  int len;
+} ProtoRequest;
+
+// followed by the errors, one per line like parser prints them
+typedef struct _ProtoReply {
+  int status;
+  int num_errors;
+  int len;
+  double value; // only for PROTO_EVAL and PROTO_ACCEPT
+} ProtoReply;
+
+
+int proto_read(int fd, void *buf, long len);
+int proto_write(int fd, const void *buf, long len);
+int proto_listen(const char *path);
+int proto_connect(const char *path);
+
+#endif
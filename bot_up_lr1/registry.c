@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "driver.h"
+#include "registry.h"
+
+
+/******************************************************************************/
+/* Grammar registry                                                           */
+/* Nothing about a grammar is global: the names of the terminals are the      */
+/* names in the compiled grammar, the keys of the parse table are as long as  */
+/* its own longest name and the lexer is built from its own patterns. So any  */
+/* number of grammars can be loaded and used at the same time.                */
+/******************************************************************************/
+
+Registry *Registry_construct(int values)
+{
+  Registry *out = malloc(sizeof(Registry));
+
+  out->capacity = REGISTRY_INIT_CAP;
+  out->size = 0;
+  out->langs = malloc(out->capacity * sizeof(Language));
+  out->values = values;
+  return out;
+}
+
+// Compile or map the grammar file and build its tables, the lexer is mapped
+// from 'lex_tables' if it is given. Returns the handle of the grammar.
+int Registry_load(Registry *reg, const char *path, const char *lex_tables)
+{
+  Language *lang;
+  Arena *cc_arena;
+  char why[ERR_MSG_LEN];
+  CC *cc;
+
+  if (reg->size == reg->capacity) {
+    reg->capacity *= 2;
+    reg->langs = realloc(reg->langs, reg->capacity * sizeof(Language));
+  }
+  lang = &reg->langs[reg->size];
+  lang->path = path;
+  // a grammar file written by grammarc is mmap'd, a text one is compiled
+  lang->g = Grammar_open(path);
+  lang->root = Grammar_name(lang->g, lang->g->start);
+
+  cc_arena = Arena_construct();
+  cc = CC_construct(lang->g, cc_arena);
+  lang->ptable = PTable_construct(lang->g, cc);
+  // the canonical collection is only needed to build the table
+  Arena_free(cc_arena);
+
+  lang->dfa = (lex_tables != NULL) ?
+    Dfa_map(lex_tables, lang->g) : Dfa_from_grammar(lang->g);
+  // a grammar that is not an expression grammar can still be parsed
+  lang->evaltable = NULL;
+  lang->no_values = NULL;
+  if (reg->values &&
+      (lang->evaltable = EvalTable_try(lang->g, why, sizeof(why))) == NULL)
+    lang->no_values = strdup(why);
+  return reg->size++;
+}
+
+// NULL if there is no grammar with the handle
+Language *Registry_get(Registry *reg, int handle)
+{
+  if (handle < 0 || handle >= reg->size)
+    return NULL;
+  return &reg->langs[handle];
+}
+
+// Lex and parse the input with the grammar 'handle', which has to exist.
+// 'toks' and 'errs' are emptied first so they can be kept from one call to
+// the next, whatever grammar it is for. If 'value' is given the value of the
+// input is computed as well, which needs the grammar to have an EvalTable.
+// Returns 1 if the input is correct.
+int Registry_parse(Registry *reg, int handle, const char *in, long len,
+    TokBuf *toks, ParseErrors *errs, double *value)
+{
+  Language *lang = &reg->langs[handle];
+
+  // values are only decoded when they are needed
+  TokBuf_reset(toks, (value != NULL) ? lang->evaltable->numeric : NULL);
+  Dfa_scan(lang->dfa, in, 0, len, toks);
+  TokBuf_append(toks, NONE, len, 0);
+  ParseErrors_clear(errs);
+
+  if (value != NULL)
+    return lr_eval(lang->ptable, lang->evaltable, toks, errs, value);
+  return check_grammar(lang->ptable, lang->root, toks, errs);
+}
+
+void Registry_free(Registry *reg)
+{
+  Language *lang;
+
+  for (int i = 0; i < reg->size; i++) {
+    lang = &reg->langs[i];
+    if (lang->evaltable != NULL)
+      EvalTable_free(lang->evaltable);
+    free(lang->no_values);
+    Dfa_free(lang->dfa);
+    PTable_free(lang->ptable);
+    Grammar_free(lang->g);
+  }
+  free(reg->langs);
+  free(reg);
+}
@@ -0,0 +1,41 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include "parse_types.h"
+#include "tok_buf.h"
+#include "dfa_lex.h"
+#include "eval.h"
+
+#define REGISTRY_INIT_CAP 8
+
+// A grammar with everything needed to parse with it. The symbol ids, the
+// parse table and the lexer belong to this grammar alone.
+typedef struct _Language {
+  const char *path; // of the grammar file
+  Grammar *g;
+  const char *root;
+  PTable ptable;
+  Dfa *dfa;
+  EvalTable *evaltable; // NULL unless the registry computes values
+  char *no_values; // why there is no EvalTable although there should be
+} Language;
+
+// All grammars of the process, a grammar is referred to by its handle, the
+// position in the order they were loaded in. The grammars share nothing
+// but the allocator and whatever threads parse with them.
+typedef struct _Registry {
+  Language *langs;
+  int size;
+  int capacity;
+  int values; // every grammar gets an EvalTable
+} Registry;
+
+
+Registry *Registry_construct(int values);
+int Registry_load(Registry *reg, const char *path, const char *lex_tables);
+Language *Registry_get(Registry *reg, int handle);
+int Registry_parse(Registry *reg, int handle, const char *in, long len,
+    TokBuf *toks, ParseErrors *errs, double *value);
+void Registry_free(Registry *reg);
+
+#endif
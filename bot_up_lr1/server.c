@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "parser.h"
+#include "parse_types.h"
+#include "util_types.h"
+#include "driver.h"
+#include "server.h"
+
+
+/******************************************************************************/
+/* Parse daemon                                                               */
+/* The tables are built once, then the worker threads take one request at a  */
+/* time from whichever connection has one, so a client that keeps its        */
+/* connection open does not hold on to a worker between its requests.        */
+/* Every request names the grammar it is for. Workers only read the tables,   */
+/* each has its own token buffer, error list and input buffer that are reused */
+/* from one request to the next, whatever grammar the request is for.         */
+/******************************************************************************/
+
+static int reply(int fd, ProtoReply *rep, const char *text)
+{
+  rep->len = (text != NULL) ? strlen(text) : 0;
+  return proto_write(fd, rep, sizeof(ProtoReply)) &&
+    proto_write(fd, text, rep->len);
+}
+
+static int bad_request(int fd, const char *why)
+{
+  ProtoReply rep;
+
+  memset(&rep, 0, sizeof(ProtoReply));
+  rep.status = PROTO_BAD_REQUEST;
+  return reply(fd, &rep, why);
+}
+
+// serve the next request on the connection, returns 0 once the connection
+// should be closed
+static int serve(Worker *w, int fd)
+{
+  Server *server = w->server;
+  ProtoRequest req;
+  ProtoReply rep;
+  Language *lang;
+  char why[ERR_MSG_LEN + 32];
+  char *text = NULL;
+  size_t text_len;
+  FILE *out;
+  int correct, ok;
+
+  if (!proto_read(fd, &req, sizeof(ProtoRequest)))
+    return 0;
+  if (req.len < 0 || req.len > PROTO_MAX_INPUT) {
+    bad_request(fd, "input too long\n");
+    return 0;
+  }
+  if (req.len > w->in_cap) {
+    while (req.len > w->in_cap)
+      w->in_cap *= 2;
+    w->in = realloc(w->in, w->in_cap);
+  }
+  if (!proto_read(fd, w->in, req.len))
+    return 0;
+  w->requests++;
+
+  if (req.op == PROTO_EVAL && !server->reg->values)
+    return bad_request(fd, "the daemon was started without -v\n");
+  if (req.op != PROTO_CHECK && req.op != PROTO_EVAL)
+    return bad_request(fd, "unknown request\n");
+  if ((lang = Registry_get(server->reg, req.grammar)) == NULL) {
+    snprintf(why, sizeof(why), "no grammar %d\n", req.grammar);
+    return bad_request(fd, why);
+  }
+  if (req.op == PROTO_EVAL && lang->evaltable == NULL) {
+    snprintf(why, sizeof(why), "grammar %d: %s\n", req.grammar,
+        lang->no_values);
+    return bad_request(fd, why);
+  }
+
+  memset(&rep, 0, sizeof(ProtoReply));
+  correct = Registry_parse(server->reg, req.grammar, w->in, req.len, w->toks,
+      w->errs, (req.op == PROTO_EVAL) ? &rep.value : NULL);
+  rep.status = correct ? PROTO_ACCEPT : PROTO_REJECT;
+  rep.num_errors = w->errs->size;
+  if (w->errs->size > 0) {
+    out = open_memstream(&text, &text_len);
+    ParseErrors_fprint(out, lang->g, w->errs);
+    fclose(out);
+  }
+  ok = reply(fd, &rep, text);
+  free(text);
+  return ok;
+}
+
+// wait for the next request of 'fd' again, the events are one shot so only
+// one worker at a time gets a connection
+static int rearm(Server *server, int fd, int op)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.fd = fd;
+  return epoll_ctl(server->epoll_fd, op, fd, &ev) == 0;
+}
+
+// Every worker waits on the same epoll set: a new connection is accepted
+// and added to it, a connection with input gets one request served and
+// then goes back into the set or is closed.
+static void *worker_run(void *arg)
+{
+  Worker *w = (Worker *)arg;
+  Server *server = w->server;
+  struct epoll_event ev;
+  int fd;
+
+  while (1) {
+    if (epoll_wait(server->epoll_fd, &ev, 1, -1) < 1)
+      continue;
+    if (ev.data.fd == server->listen_fd) {
+      // the listening socket does not block, the connection may be gone
+      if ((fd = accept(server->listen_fd, NULL, NULL)) < 0) {
+        if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+          perror("accept");
+      } else if (!rearm(server, fd, EPOLL_CTL_ADD)) {
+        perror("epoll_ctl");
+        close(fd);
+      }
+      rearm(server, server->listen_fd, EPOLL_CTL_MOD);
+      continue;
+    }
+    fd = ev.data.fd;
+    if (!serve(w, fd) || !rearm(server, fd, EPOLL_CTL_MOD))
+      close(fd);
+  }
+  return NULL;
+}
+
+// Serve requests for the grammars of 'reg' on the Unix socket 'path' with
+// 'num_workers' threads until the process gets SIGINT or SIGTERM. Then the
+// socket is removed and the process ends, the tables are not freed.
+void Server_run(Registry *reg, int max_errors, const char *path,
+    int num_workers)
+{
+  Server server;
+  sigset_t stop;
+  long requests = 0;
+  int sig;
+
+  server.reg = reg;
+  server.max_errors = max_errors;
+  server.path = path;
+  server.num_workers = (num_workers > 0) ? num_workers : 1;
+  if ((server.listen_fd = proto_listen(path)) < 0)
+    error("can't listen on '%s'", path);
+  fcntl(server.listen_fd, F_SETFL, O_NONBLOCK);
+  if ((server.epoll_fd = epoll_create1(0)) < 0 ||
+      !rearm(&server, server.listen_fd, EPOLL_CTL_ADD))
+    error("can't wait for connections on '%s'", path);
+
+  // a client that goes away must not end the daemon, and only this thread
+  // waits for the signals that do
+  signal(SIGPIPE, SIG_IGN);
+  sigemptyset(&stop);
+  sigaddset(&stop, SIGINT);
+  sigaddset(&stop, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stop, NULL);
+
+  server.workers = malloc(server.num_workers * sizeof(Worker));
+  for (int i = 0; i < server.num_workers; i++) {
+    Worker *w = &server.workers[i];
+    w->server = &server;
+    w->toks = TokBuf_construct(0, NULL);
+    w->errs = ParseErrors_construct(max_errors);
+    w->in_cap = SERVER_INPUT_INIT_CAP;
+    w->in = malloc(w->in_cap);
+    w->requests = 0;
+    if (pthread_create(&w->thread, NULL, worker_run, w) != 0)
+      error("can't create worker thread %d", i);
+  }
+  fprintf(stderr, "listening on %s with %d workers for %d grammars\n", path,
+      server.num_workers, reg->size);
+
+  sigwait(&stop, &sig);
+  unlink(path);
+  for (int i = 0; i < server.num_workers; i++)
+    requests += server.workers[i].requests;
+  fprintf(stderr, "stopped after %ld requests\n", requests);
+  exit(0);
+}
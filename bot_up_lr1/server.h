@@ -0,0 +1,42 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <pthread.h>
+
+#include "parse_types.h"
+#include "tok_buf.h"
+#include "registry.h"
+#include "protocol.h"
+
+#define SERVER_INPUT_INIT_CAP 4096
+
+struct _Server;
+
+// Everything a worker needs for a request, allocated once and used for all
+// requests the worker serves.
+typedef struct _Worker {
+  struct _Server *server;
+  pthread_t thread;
+  TokBuf *toks;
+  ParseErrors *errs;
+  char *in;
+  int in_cap;
+  long requests;
+} Worker;
+
+// grammars shared by all workers, they are only read while serving
+typedef struct _Server {
+  Registry *reg; // without values PROTO_EVAL requests are refused
+  int max_errors;
+  const char *path;
+  int listen_fd;
+  int epoll_fd; // the listening socket and every connection, one shot each
+  Worker *workers;
+  int num_workers;
+} Server;
+
+
+void Server_run(Registry *reg, int max_errors, const char *path,
+    int num_workers);
+
+#endif
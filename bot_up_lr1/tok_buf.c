@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tok_buf.h"
+#include "util_types.h"
+#include "dfa_lex.h"
+
+static void *lex_job_run(void *arg);
+
+/******************************************************************************/
+/* Input                                                                      */
+/* Files are mmap'd, stdin is read into a buffer that doubles when full       */
+/******************************************************************************/
+
+Input Input_read(const char *path)
+{
+  Input out;
+  struct stat st;
+  int fd;
+  long cap, n;
+
+  out.data = NULL;
+  out.len = 0;
+  out.is_mapped = 0;
+
+  if (path != NULL) {
+    if ((fd = open(path, O_RDONLY)) < 0) {
+      error("can't open file '%s'", path);
+    }
+    if (fstat(fd, &st) < 0) {
+      error("can't stat file '%s'", path);
+    }
+    out.len = st.st_size;
+    // mmap refuses zero length mappings so empty files are just empty input
+    if (out.len > 0) {
+      out.data = mmap(NULL, out.len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (out.data == MAP_FAILED) {
+        error("can't mmap file '%s'", path);
+      }
+      madvise(out.data, out.len, MADV_SEQUENTIAL);
+      out.is_mapped = 1;
+    }
+    close(fd);
+    return out;
+  }
+
+  cap = LEX_BLOCK_SIZE;
+  out.data = malloc(cap);
+  while ((n = fread(out.data + out.len, 1, cap - out.len, stdin)) > 0) {
+    out.len += n;
+    if (out.len == cap) {
+      cap *= 2;
+      out.data = realloc(out.data, cap);
+    }
+  }
+  return out;
+}
+
+void Input_free(Input in)
+{
+  if (in.is_mapped)
+    munmap(in.data, in.len);
+  else
+    free(in.data);
+}
+
+
+/******************************************************************************/
+/* Token buffer                                                               */
+/******************************************************************************/
+
+TokBuf *TokBuf_construct(int capacity, const char *numeric)
+{
+  TokBuf *out = malloc(sizeof(TokBuf));
+  out->capacity = (capacity > 0) ? capacity : TOK_BUF_INIT_CAP;
+  out->size = 0;
+  out->types = malloc(out->capacity * sizeof(TokType));
+  out->offsets = malloc(out->capacity * sizeof(long));
+  out->lengths = malloc(out->capacity * sizeof(int));
+  out->numeric = numeric;
+  out->values = (numeric != NULL) ?
+    malloc(out->capacity * sizeof(double)) : NULL;
+  return out;
+}
+
+// empty the buffer for the next input, 'numeric' is the same as for
+// TokBuf_construct
+void TokBuf_reset(TokBuf *buf, const char *numeric)
+{
+  buf->size = 0;
+  buf->numeric = numeric;
+  if (numeric != NULL && buf->values == NULL)
+    buf->values = malloc(buf->capacity * sizeof(double));
+}
+
+void TokBuf_append(TokBuf *buf, TokType type, long offset, int length)
+{
+  if (buf->size == buf->capacity) {
+    buf->capacity *= 2;
+    buf->types = realloc(buf->types, buf->capacity * sizeof(TokType));
+    buf->offsets = realloc(buf->offsets, buf->capacity * sizeof(long));
+    buf->lengths = realloc(buf->lengths, buf->capacity * sizeof(int));
+    if (buf->values != NULL)
+      buf->values = realloc(buf->values, buf->capacity * sizeof(double));
+  }
+  buf->types[buf->size] = type;
+  buf->offsets[buf->size] = offset;
+  buf->lengths[buf->size] = length;
+  if (buf->values != NULL)
+    buf->values[buf->size] = 0;
+  buf->size++;
+}
+
+// value of the text of a numeric token, plain integers that fit into a
+// double exactly are converted on the spot, anything else goes to strtod
+double lex_number(const char *s, int len)
+{
+  char buf[LEX_NUMBER_BUFLEN];
+  char *copy = buf;
+  double out = 0;
+  int i;
+
+  for (i = 0; i < len && s[i] >= '0' && s[i] <= '9'; i++)
+    out = out * 10 + (s[i] - '0');
+  if (i == len && len < 16)
+    return out;
+
+  // the token is not '\0' terminated in the input
+  if (len >= LEX_NUMBER_BUFLEN)
+    copy = malloc(len + 1);
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  out = strtod(copy, NULL);
+  if (copy != buf)
+    free(copy);
+  return out;
+}
+
+void TokBuf_print(TokBuf *buf, Grammar *g)
+{
+  for (int i = 0; i < buf->size; i++) {
+    printf("<%s, %ld, %d> ",
+        (buf->types[i] < 0) ? "ERROR" : Grammar_name(g, buf->types[i]),
+        buf->offsets[i], buf->lengths[i]);
+  }
+  printf("\n");
+}
+
+void TokBuf_free(TokBuf *buf)
+{
+  free(buf->types);
+  free(buf->offsets);
+  free(buf->lengths);
+  free(buf->values);
+  free(buf);
+}
+
+
+/******************************************************************************/
+/* Chunked lexing                                                             */
+/******************************************************************************/
+
+// first position >= pos at which it is safe to start scanning
+// only used if the lexer DFA guarantees that no token contains whitespace so
+// every position right after a whitespace character is a token boundary
+long lex_safe_boundary(const char *in, long len, long pos)
+{
+  if (pos <= 0)
+    return 0;
+  if (pos >= len)
+    return len;
+  for (; pos < len && !isspace((unsigned char)in[pos - 1]); pos++);
+  return pos;
+}
+
+static void *lex_job_run(void *arg)
+{
+  LexJob *job = (LexJob *)arg;
+  Dfa_scan(job->dfa, job->in, job->start, job->end, job->out);
+  return NULL;
+}
+
+// split the input into one chunk per thread, lex the chunks concurrently
+// and concatenate the results into one buffer terminated by a NONE token,
+// the values of the 'numeric' terminals are decoded on the way if it is set
+TokBuf *lex_parallel(Dfa *dfa, const char *in, long len, int num_threads,
+    const char *numeric)
+{
+  LexJob *jobs;
+  pthread_t *threads;
+  TokBuf *out;
+  long chunk_len, start;
+  int i, total;
+
+  if (num_threads > len / LEX_BLOCK_SIZE + 1)
+    num_threads = len / LEX_BLOCK_SIZE + 1;
+  if (num_threads < 1 || !dfa->split_on_space)
+    num_threads = 1;
+
+  if (num_threads == 1) {
+    out = TokBuf_construct(0, numeric);
+    Dfa_scan(dfa, in, 0, len, out);
+    TokBuf_append(out, NONE, len, 0);
+    return out;
+  }
+
+  jobs = malloc(num_threads * sizeof(LexJob));
+  threads = malloc(num_threads * sizeof(pthread_t));
+  chunk_len = len / num_threads;
+  start = 0;
+  for (i = 0; i < num_threads; i++) {
+    jobs[i].dfa = dfa;
+    jobs[i].in = in;
+    jobs[i].start = start;
+    jobs[i].end = (i == num_threads - 1) ? len :
+      lex_safe_boundary(in, len, start + chunk_len);
+    jobs[i].out = TokBuf_construct(0, numeric);
+    start = jobs[i].end;
+    if (pthread_create(&threads[i], NULL, lex_job_run, &jobs[i]) != 0) {
+      error("can't create lexer thread %d", i);
+    }
+  }
+
+  total = 1;
+  for (i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+    total += jobs[i].out->size;
+  }
+
+  out = TokBuf_construct(total, numeric);
+  for (i = 0; i < num_threads; i++) {
+    memcpy(out->types + out->size, jobs[i].out->types,
+        jobs[i].out->size * sizeof(TokType));
+    memcpy(out->offsets + out->size, jobs[i].out->offsets,
+        jobs[i].out->size * sizeof(long));
+    memcpy(out->lengths + out->size, jobs[i].out->lengths,
+        jobs[i].out->size * sizeof(int));
+    if (numeric != NULL) {
+      memcpy(out->values + out->size, jobs[i].out->values,
+          jobs[i].out->size * sizeof(double));
+    }
+    out->size += jobs[i].out->size;
+    TokBuf_free(jobs[i].out);
+  }
+  TokBuf_append(out, NONE, len, 0);
+
+  free(threads);
+  free(jobs);
+  return out;
+}
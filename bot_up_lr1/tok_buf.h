@@ -0,0 +1,58 @@
+#ifndef TOK_BUF_H
+#define TOK_BUF_H
+
+#include "parser.h"
+#include "grammar.h"
+
+// every lexer thread gets at least this many bytes of input
+#define LEX_BLOCK_SIZE (1 << 20)
+#define TOK_BUF_INIT_CAP 1024
+// longest number lex_number converts without allocating
+#define LEX_NUMBER_BUFLEN 64
+
+struct _Dfa;
+
+// struct-of-arrays token buffer where token i is described by
+// types[i], offsets[i] and lengths[i]
+typedef struct _TokBuf {
+  TokType *types;
+  long *offsets;
+  int *lengths;
+  // if 'numeric' is set the text of every token whose type is flagged in it
+  // is converted while lexing and kept in values[i], NULL otherwise
+  const char *numeric;
+  double *values;
+  int size;
+  int capacity;
+} TokBuf;
+
+typedef struct _Input {
+  char *data;
+  long len;
+  int is_mapped;
+} Input;
+
+typedef struct _LexJob {
+  struct _Dfa *dfa;
+  const char *in;
+  long start;
+  long end;
+  TokBuf *out;
+} LexJob;
+
+
+Input Input_read(const char *path);
+void Input_free(Input in);
+
+TokBuf *TokBuf_construct(int capacity, const char *numeric);
+void TokBuf_reset(TokBuf *buf, const char *numeric);
+void TokBuf_append(TokBuf *buf, TokType type, long offset, int length);
+double lex_number(const char *s, int len);
+void TokBuf_print(TokBuf *buf, Grammar *g);
+void TokBuf_free(TokBuf *buf);
+
+long lex_safe_boundary(const char *in, long len, long pos);
+TokBuf *lex_parallel(struct _Dfa *dfa, const char *in, long len,
+    int num_threads, const char *numeric);
+
+#endif
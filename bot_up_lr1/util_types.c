@@ -24,13 +24,277 @@ void error(char *fmt, ...)
   exit(1);
 }
 
+/******************************************************************************/
+/* Allocation accounting                                                      */
+/* The table and parser types allocate through the mem_ wrappers. Once the    */
+/* accounting is started every block gets a header with its size, subsystem   */
+/* and allocation site, before that the wrappers are plain malloc and free.   */
+/* It has to be started before the first allocation and can't be stopped.    */
+/******************************************************************************/
+
+static const char *mem_tag_names[NUM_MEM_TAGS] = {
+  "cc items", "cc states", "cc goto maps", "action table", "goto table",
+  "conflicts", "parse stack", "errors", "other"
+};
+
+static int mem_accounting = 0;
+static MemStats mem_stats[NUM_MEM_TAGS];
+static MemStats mem_total;
+static MemSite mem_sites[MEM_SITE_SLOTS];
+
+void mem_accounting_start()
+{
+  mem_accounting = 1;
+}
+
+// slot of the allocation site, sites are few and never removed so open
+// addressing on the line number is enough. The wrappers in here are called
+// for every subsystem, so a site is a line and a tag. Once all slots are
+// taken the site is counted with the rest of its subsystem.
+static int mem_site(MemTag tag, const char *file, int line)
+{
+  int idx = (line * COEFF1 + tag) % MEM_MAX_SITES;
+
+  for (int i = 0; i < MEM_MAX_SITES; i++) {
+    MemSite *site = &mem_sites[idx];
+    if (site->file == NULL) {
+      site->file = file;
+      site->line = line;
+      site->tag = tag;
+      return idx;
+    }
+    if (site->line == line && site->tag == tag &&
+        strcmp(site->file, file) == 0)
+      return idx;
+    idx = (idx + 1) % MEM_MAX_SITES;
+  }
+  idx = MEM_MAX_SITES + tag;
+  if (mem_sites[idx].file == NULL) {
+    mem_sites[idx].file = "other sites";
+    mem_sites[idx].line = 0;
+    mem_sites[idx].tag = tag;
+  }
+  return idx;
+}
+
+static void mem_count(MemStats *stats, long size, int blocks)
+{
+  stats->live += size;
+  stats->allocs += blocks;
+  if (stats->live > stats->peak)
+    stats->peak = stats->live;
+}
+
+// count 'size' more bytes (less if it is negative) for the site and its
+// subsystem, 'blocks' is 1 for a new block
+static void mem_add(int site, long size, int blocks)
+{
+  mem_count(&mem_stats[mem_sites[site].tag], size, blocks);
+  mem_count(&mem_total, size, blocks);
+  mem_sites[site].allocs += blocks;
+  mem_sites[site].live += size;
+  if (size > 0)
+    mem_sites[site].bytes += size;
+}
+
+void *mem_alloc_at(MemTag tag, long size, const char *file, int line)
+{
+  MemHeader *hdr;
+  int site;
+
+  if (!mem_accounting)
+    return malloc(size);
+
+  if ((hdr = malloc(sizeof(MemHeader) + size)) == NULL)
+    return NULL;
+  site = mem_site(tag, file, line);
+  hdr->size = size;
+  hdr->tag = tag;
+  hdr->site = site;
+  mem_add(site, size, 1);
+  return hdr + 1;
+}
+
+void *mem_calloc_at(MemTag tag, long num, long size, const char *file,
+    int line)
+{
+  void *out;
+
+  if (!mem_accounting)
+    return calloc(num, size);
+  if ((out = mem_alloc_at(tag, num * size, file, line)) != NULL)
+    memset(out, 0, num * size);
+  return out;
+}
+
+// the block stays with the site that allocated it first
+void *mem_realloc_at(MemTag tag, void *ptr, long size, const char *file,
+    int line)
+{
+  MemHeader *hdr;
+  long diff;
+
+  if (!mem_accounting)
+    return realloc(ptr, size);
+  if (ptr == NULL)
+    return mem_alloc_at(tag, size, file, line);
+
+  hdr = (MemHeader *)ptr - 1;
+  diff = size - hdr->size;
+  if ((hdr = realloc(hdr, sizeof(MemHeader) + size)) == NULL)
+    return NULL;
+  hdr->size = size;
+  mem_add(hdr->site, diff, 0);
+  return hdr + 1;
+}
+
+char *mem_strdup_at(MemTag tag, const char *s, const char *file, int line)
+{
+  long len = strlen(s) + 1;
+  char *out;
+
+  if ((out = mem_alloc_at(tag, len, file, line)) != NULL)
+    memcpy(out, s, len);
+  return out;
+}
+
+void mem_free(void *ptr)
+{
+  MemHeader *hdr;
+
+  if (!mem_accounting || ptr == NULL) {
+    free(ptr);
+    return;
+  }
+  hdr = (MemHeader *)ptr - 1;
+  mem_add(hdr->site, -hdr->size, 0);
+  free(hdr);
+}
+
+static int mem_site_cmp(const void *a, const void *b)
+{
+  long diff = ((MemSite *)b)->bytes - ((MemSite *)a)->bytes;
+  return (diff > 0) - (diff < 0);
+}
+
+// live is what has not been freed at the time of the report, peak the most
+// that was live at once, the sites are ordered by all bytes they allocated
+void mem_report()
+{
+  MemSite sites[MEM_SITE_SLOTS];
+  int num_sites = 0;
+  const char *file;
+  char loc[MEM_LOC_LEN];
+
+  fprintf(stderr, "%-37s %12s %12s %10s\n", "memory by subsystem", "live kB",
+      "peak kB", "allocs");
+  for (int i = 0; i < NUM_MEM_TAGS; i++) {
+    fprintf(stderr, "%-37s %12.1f %12.1f %10ld\n", mem_tag_names[i],
+        mem_stats[i].live / 1024.0, mem_stats[i].peak / 1024.0,
+        mem_stats[i].allocs);
+  }
+  fprintf(stderr, "%-37s %12.1f %12.1f %10ld\n", "total",
+      mem_total.live / 1024.0, mem_total.peak / 1024.0, mem_total.allocs);
+  fprintf(stderr, "without the %d bytes of header every block has\n",
+      (int)sizeof(MemHeader));
+
+  for (int i = 0; i < MEM_SITE_SLOTS; i++) {
+    if (mem_sites[i].file != NULL)
+      sites[num_sites++] = mem_sites[i];
+  }
+  qsort(sites, num_sites, sizeof(MemSite), mem_site_cmp);
+  fprintf(stderr, "\n%-22s %-14s %12s %12s %10s\n", "top allocation sites",
+      "", "live kB", "total kB", "allocs");
+  for (int i = 0; i < num_sites && i < MEM_REPORT_SITES; i++) {
+    file = strrchr(sites[i].file, '/');
+    file = (file != NULL) ? file + 1 : sites[i].file;
+    if (sites[i].line > 0)
+      snprintf(loc, MEM_LOC_LEN, "%s:%d", file, sites[i].line);
+    else
+      snprintf(loc, MEM_LOC_LEN, "%s", file);
+    fprintf(stderr, "%-22s %-14s %12.1f %12.1f %10ld\n", loc,
+        mem_tag_names[sites[i].tag], sites[i].live / 1024.0,
+        sites[i].bytes / 1024.0, sites[i].allocs);
+  }
+}
+
+/******************************************************************************/
+/* Arena                                                                      */
+/* For data that is built up and then thrown away as a whole: allocating is   */
+/* moving a pointer forward and Arena_free only frees the chunks. The report   */
+/* counts the blocks handed out, not the unused rest of the chunks.           */
+/******************************************************************************/
+
+Arena *Arena_construct()
+{
+  Arena *out = malloc(sizeof(Arena));
+
+  out->chunks = NULL;
+  out->site_bytes = mem_accounting ? calloc(MEM_SITE_SLOTS, sizeof(long)) :
+    NULL;
+  return out;
+}
+
+void *arena_alloc_at(Arena *arena, MemTag tag, long size, const char *file,
+    int line)
+{
+  ArenaChunk *chunk = arena->chunks;
+  void *out;
+  int site;
+
+  size = (size + ARENA_ALIGN - 1) & ~(long)(ARENA_ALIGN - 1);
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    chunk = malloc(sizeof(ArenaChunk) +
+        ((size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE));
+    chunk->size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+    chunk->used = 0;
+    // a block bigger than a chunk gets one of its own, the current chunk
+    // stays the one to cut from
+    if (size > ARENA_CHUNK_SIZE && arena->chunks != NULL) {
+      chunk->next = arena->chunks->next;
+      arena->chunks->next = chunk;
+    } else {
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+    }
+  }
+  out = (char *)(chunk + 1) + chunk->used;
+  chunk->used += size;
+
+  if (arena->site_bytes != NULL) {
+    site = mem_site(tag, file, line);
+    mem_add(site, size, 1);
+    arena->site_bytes[site] += size;
+  }
+  return out;
+}
+
+void Arena_free(Arena *arena)
+{
+  ArenaChunk *next;
+
+  for (; arena->chunks != NULL; arena->chunks = next) {
+    next = arena->chunks->next;
+    free(arena->chunks);
+  }
+  if (arena->site_bytes != NULL) {
+    for (int i = 0; i < MEM_SITE_SLOTS; i++) {
+      if (arena->site_bytes[i] > 0)
+        mem_add(i, -arena->site_bytes[i], 0);
+    }
+    free(arena->site_bytes);
+  }
+  free(arena);
+}
+
+
 /******************************************************************************/
 /* Generic linked list                                                        */
 /******************************************************************************/
 
 List *List_insert(List *list, void *val)
 {
-  List *new = malloc(sizeof(List));
+  List *new = mem_alloc(MEM_OTHER, sizeof(List));
   new->val = val;
   new->next = list;
   return new;
@@ -52,8 +316,8 @@ void List_free(List *list, int free_val)
   for (; list != NULL; list = next) {
     next = list->next;
     if (free_val)
-      free(list->val);
-    free(list);
+      mem_free(list->val);
+    mem_free(list);
   }
 }
 
@@ -64,17 +328,44 @@ void List_free(List *list, int free_val)
 /* complicated structs                                                        */
 /******************************************************************************/
 
-HashMap *HashMap_construct(int val_size)
+// a map in an arena gives nothing back before the arena is freed, not even
+// the arrays it had before it grew
+static void *map_calloc(HashMap *map, long num, long size)
+{
+  void *out;
+
+  if (map->arena == NULL)
+    return mem_calloc(map->tag, num, size);
+  out = arena_alloc(map->arena, map->tag, num * size);
+  memset(out, 0, num * size);
+  return out;
+}
+
+static void map_free(HashMap *map, void *ptr)
+{
+  if (map->arena == NULL)
+    mem_free(ptr);
+}
+
+HashMap *HashMap_construct(int val_size, MemTag tag)
+{
+  return HashMap_construct_in(NULL, val_size, tag);
+}
+
+HashMap *HashMap_construct_in(Arena *arena, int val_size, MemTag tag)
 {
   HashMap *out;
 
-  out = malloc(sizeof(HashMap));
-  out->elts = calloc(INIT_CAP, sizeof(HashMapEl));
+  out = (arena != NULL) ? arena_alloc(arena, tag, sizeof(HashMap)) :
+    mem_alloc(tag, sizeof(HashMap));
+  out->tag = tag;
+  out->arena = arena;
+  out->elts = map_calloc(out, INIT_CAP, sizeof(HashMapEl));
   out->capacity = INIT_CAP;
 
   out->val_size = val_size;
   out->size = 0;
-  out->stack_base = calloc(out->capacity, val_size);
+  out->stack_base = map_calloc(out, out->capacity, val_size);
 
   return out;
 }
@@ -86,9 +377,9 @@ void HashMap_expand(HashMap *map)
   HashMapEl *old_elts;
 
   old_elts = map->elts;
-  map->elts = calloc(2 * map->capacity, sizeof(HashMapEl));
+  map->elts = map_calloc(map, 2 * map->capacity, sizeof(HashMapEl));
   old_stack = map->stack_base;
-  map->stack_base = calloc(2 * map->capacity, map->val_size);
+  map->stack_base = map_calloc(map, 2 * map->capacity, map->val_size);
   map->capacity *= 2;
   map->size = 0;
 
@@ -96,11 +387,11 @@ void HashMap_expand(HashMap *map)
   for (int i = 0; i < map->capacity/2; i++) {
     if (old_elts[i].is_used) {
       HashMap_set(map, old_elts[i].key, old_elts[i].val);
-      free(old_elts[i].key);
+      map_free(map, old_elts[i].key);
     }
   }
-  free(old_stack);
-  free(old_elts);
+  map_free(map, old_stack);
+  map_free(map, old_elts);
 }
 
 // store the data stored at the key 'key' in the memory area pointed to by 'out'
@@ -144,7 +435,12 @@ void HashMap_set(HashMap *map, const char *key, void *val)
   if ((HashMap_get(map, key, &idx)) == NULL) { // not found
     map->size++;
     map->elts[idx].is_used = 1;
-    map->elts[idx].key = strdup(key);
+    if (map->arena == NULL) {
+      map->elts[idx].key = mem_strdup(map->tag, key);
+    } else {
+      map->elts[idx].key = arena_alloc(map->arena, map->tag, strlen(key) + 1);
+      strcpy(map->elts[idx].key, key);
+    }
     map->elts[idx].val = map->stack_base + map->size * map->val_size;
   }
   memcpy(map->elts[idx].val, val, map->val_size);
@@ -179,14 +475,16 @@ void *HashMap_reduce(HashMap *map, void *(*fn)(const char *, void *, void *))
 
 void HashMap_deconstruct(HashMap *map)
 {
+  if (map->arena != NULL)
+    return;
   for (int i = 0; i < map->capacity; i++) {
     if (map->elts[i].is_used) {
-      free(map->elts[i].key);
+      mem_free(map->elts[i].key);
     }
   }
-  free(map->elts);
-  free(map->stack_base);
-  free(map);
+  mem_free(map->elts);
+  mem_free(map->stack_base);
+  mem_free(map);
 }
 
 
@@ -226,7 +524,7 @@ int str_equal(void *a, void *b)
 
 void *str_copy(void *s)
 {
-  return (void *)strdup((char *)s);
+  return (void *)mem_strdup(MEM_OTHER, (char *)s);
 }
 
 
@@ -239,7 +537,7 @@ HashMap *si_map_init()
 {
   HashMap *out;
 
-  out = HashMap_construct(sizeof(long));
+  out = HashMap_construct(sizeof(long), MEM_OTHER);
 
   return out;
 }
@@ -282,35 +580,3 @@ void si_map_test()
 
   HashMap_deconstruct(si_map);
 }
-
-
-
-
-/******************************************************************************/
-/* Helper functions for treating array of strings as set                      */
-/******************************************************************************/
-
-void string_set_copy(char *s[], char *out[], int len)
-{
-  int i;
-
-  for (i = 0; i < len; i++) {
-    out[i] = strdup(s[i]);
-  }
-}
-
-int string_set_equal(char *a[], char *b[], int len_a, int len_b)
-{
-  int i;
-
-  if (len_a != len_b)
-    return 0;
-
-  for (i = 0; i < len_a; i++) {
-    if (strcmp(a[i], b[i]) != 0)
-      return 0;
-  }
-
-
-  return 1;
-}
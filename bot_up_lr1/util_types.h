@@ -1,8 +1,6 @@
 #ifndef UTIL_TYPES_H
 #define UTIL_TYPES_H
 
-#define FORMAT_BUFLEN (TOK_LEN + 5)
-
 #define SI_DEFAULT 0
 
 // coefficients for multiplicative hashing
@@ -13,12 +11,87 @@
 #define LOAD_FACTOR 75 // in percent of map capacity
 #define ERR_MSG_LEN 200
 
+// allocation sites the memory report keeps apart, the ones after that are
+// counted as one site per subsystem
+#define MEM_MAX_SITES 256
+#define MEM_REPORT_SITES 10
+#define MEM_LOC_LEN 64
+
+#define mem_alloc(TAG, SIZE) mem_alloc_at(TAG, SIZE, __FILE__, __LINE__)
+#define mem_calloc(TAG, NUM, SIZE) \
+  mem_calloc_at(TAG, NUM, SIZE, __FILE__, __LINE__)
+#define mem_realloc(TAG, PTR, SIZE) \
+  mem_realloc_at(TAG, PTR, SIZE, __FILE__, __LINE__)
+#define mem_strdup(TAG, S) mem_strdup_at(TAG, S, __FILE__, __LINE__)
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 8 // enough for pointers, longs and doubles
+#define arena_alloc(ARENA, TAG, SIZE) \
+  arena_alloc_at(ARENA, TAG, SIZE, __FILE__, __LINE__)
+
+// subsystems the memory report is split into, see mem_tag_names
+typedef enum _MemTag {
+  MEM_CC_ITEMS, // LR(1) items of the canonical collection
+  MEM_CC_STATES, // sets of the canonical collection and the work stack
+  MEM_CC_GOTO, // goto map of every set
+  MEM_ACTION_TABLE,
+  MEM_GOTO_TABLE,
+  MEM_CONFLICTS,
+  MEM_PARSE_STACK,
+  MEM_ERRORS,
+  MEM_OTHER, // lists and maps of the evaluator and the GLR parser
+  NUM_MEM_TAGS
+} MemTag;
+
+// the sites plus the one that counts the rest of every subsystem
+#define MEM_SITE_SLOTS (MEM_MAX_SITES + NUM_MEM_TAGS)
+
+// put in front of every block while the accounting is on, the size keeps
+// the block aligned like malloc does
+typedef struct _MemHeader {
+  long size;
+  MemTag tag;
+  int site;
+} MemHeader;
+
+typedef struct _MemStats {
+  long live; // bytes
+  long peak;
+  long allocs;
+} MemStats;
+
+typedef struct _MemSite {
+  const char *file; // NULL if the slot is empty
+  int line; // 0 for the rest of the sites of the subsystem
+  MemTag tag;
+  long allocs;
+  long bytes; // allocated over the whole run, freed ones included
+  long live;
+} MemSite;
+
+// chunk of an arena, the memory handed out follows the struct
+typedef struct _ArenaChunk {
+  struct _ArenaChunk *next;
+  long size;
+  long used;
+} ArenaChunk;
+
+// Region allocator: blocks are cut from big chunks one after another and
+// can't be freed on their own, all of them go at once with Arena_free.
+typedef struct _Arena {
+  ArenaChunk *chunks; // the first is the one blocks are cut from
+  long *site_bytes; // bytes of every allocation site, only while the
+                    // accounting is on
+} Arena;
+
 typedef struct _HashMap {
   struct _HashMapEl *elts;
   int val_size;
   int capacity;
   int size;
   void *stack_base;
+  MemTag tag; // the slots, values and keys are accounted to this
+  Arena *arena; // where the map is allocated or NULL for malloc
 } HashMap;
 
 typedef struct _HashMapEl {
@@ -32,7 +105,23 @@ typedef struct _List {
   struct _List *next;
 } List;
 
-void error(char *fmt, ...);
+// prints the message and exits
+void error(char *fmt, ...) __attribute__((noreturn));
+
+void mem_accounting_start();
+void *mem_alloc_at(MemTag tag, long size, const char *file, int line);
+void *mem_calloc_at(MemTag tag, long num, long size, const char *file,
+    int line);
+void *mem_realloc_at(MemTag tag, void *ptr, long size, const char *file,
+    int line);
+char *mem_strdup_at(MemTag tag, const char *s, const char *file, int line);
+void mem_free(void *ptr);
+void mem_report();
+
+Arena *Arena_construct();
+void *arena_alloc_at(Arena *arena, MemTag tag, long size, const char *file,
+    int line);
+void Arena_free(Arena *arena);
 
 List *List_insert(List *list, void *val);
 int List_contains(List *list, void *val, int (*comp_fn)(void *, void *));
@@ -42,7 +131,8 @@ void HashMap_expand(HashMap *map);
 void *HashMap_get(HashMap *map, const char *key, unsigned *idx_out);
 void HashMap_set(HashMap *map, const char *key, void *val);
 
-HashMap *HashMap_construct(int val_size);
+HashMap *HashMap_construct(int val_size, MemTag tag);
+HashMap *HashMap_construct_in(Arena *arena, int val_size, MemTag tag);
 
 void HashMap_iter(
     HashMap *map, void (*fn)(const char *, void *, void *), void *arg);
@@ -53,9 +143,6 @@ void HashMap_deconstruct(HashMap *map);
 int str_equal(void *a, void *b);
 void *str_copy(void *s);
 
-void string_set_copy(char *s[], char *out[], int len);
-int string_set_equal(char *a[], char *b[], int len_a, int len_b);
-
 HashMap *si_map_init();
 void si_map_set(HashMap *map, char *key, long val);
 long si_map_get(HashMap *map, char *key);
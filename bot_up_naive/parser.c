@@ -1,80 +1,47 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h> // for exit
-#include <ctype.h> // for isspace
 
 #include "parser.h"
+#include "grammar.h"
 
-#define TOK_LEN 50
-#define MAX_TERMS_PER_RULE 10
 #define FSIZE 1000
 
-#define APPEND(LIST, LAST, NEW) ({\
-  if (list != NULL) {\
-    for (last = list; last->next != NULL; last = last->next);\
-      last->next = new;\
-    return list;\
-  } else {\
-    return new;\
-  }\
-})
-
-typedef struct _prod_rule {
-  int num_symbols;
-  char* sym_l[MAX_TERMS_PER_RULE];
-} prod_rule;
-
-typedef struct _symbol {
-  char* name;
-  int num_prod_rules;
-  int prod_rule_sel;
-  struct _prod_rule_l* prod_l;
-} symbol;
-
-typedef struct _prod_rule_l {
-  struct _prod_rule* rule;
-  struct _prod_rule_l* next;
-} prod_rule_l;
-
-// top level list containing one item for every non-terminal definition
-typedef struct _symbol_l {
-  struct _symbol* sym;
-  struct _symbol_l* next;
-} symbol_l;
-
-
-typedef struct _str_stack {
-  char* str;
-  struct _str_stack* next;
-} str_stack;
-
-
-int get_token(FILE* in, char *buf);
-void unget_token(FILE* in, char* token);
-
-symbol* generate_symbol(char* name);
-prod_rule* generate_prod_rule();
-prod_rule_l* append_prod_rule_l(prod_rule_l* list, prod_rule* rule);
-symbol_l* append_symbol_l(symbol_l* list, symbol* sym);
-void generate_prod_rule_list(FILE* g_file, symbol* sym);
-symbol_l* generate_grammar_map(FILE* g_file);
-void print_prod_rule_list(prod_rule_l* list);
-void print_grammar_map(symbol_l* gmap);
-
-void free_prod_l(prod_rule_l* prod_l);
-void free_grammar_map(symbol_l* gmap);
+// symbol ids: the terminals have their token type as id, the non-terminals
+// follow in the order of the grammar file (the compiled grammar numbers its
+// symbols differently, see naive_ids)
+typedef struct _sym_stack {
+  int* syms;
+  int size;
+  int capacity;
+} sym_stack;
 
+// Right hand sides of all rules inserted back to front, so walking down from
+// the root with the symbols from the top of the stack downwards passes the
+// node of every rule that matches the top of the stack.
+typedef struct _handle_trie {
+  int num_ids; // number of symbol ids, children per node
+  int num_nodes;
+  int capacity;
+  int* next; // child of node n for id i is next[n * num_ids + i], 0 if none
+  int* rule_idx; // first rule (in grammar order) that ends at a node or -1
+  int* lhs; // non-terminal of that rule
+} handle_trie;
+
+
+int* naive_ids(Grammar* g);
 
-//ptree_node* parse_tree_gen(const char* in, symbol_l* sym_list);
-int grammar_check(symbol_l* sym_list);
 
-void free_str_stack(str_stack* stack);
+//ptree_node* parse_tree_gen(const char* in, symbol_l* sym_list);
+int grammar_check(int root, handle_trie* trie);
 
-str_stack* push_str_stack(str_stack* stack, const char* str);
-char* pop_str_stack(str_stack** stack);
+void push_sym_stack(sym_stack* stack, int sym);
 
-int check_for_handle(str_stack* stack, symbol_l* sym_list, char* nt_name);
-int match_rule(str_stack* stack, prod_rule* rule);
+handle_trie* generate_handle_trie(Grammar* g, int* ids);
+void insert_handle(handle_trie* trie, const int* rhs, int len, int* ids,
+    int rule_idx, int lhs);
+void free_handle_trie(handle_trie* trie);
+int check_for_handle(sym_stack* stack, handle_trie* trie, int* lhs);
 
 char *terminals[] = {"NONE", "T_PLUS", "T_MINUS", "T_TIMES", "T_LBRACKET",
     "T_RBRACKET", "T_NUMBER"};
@@ -89,307 +56,167 @@ int main(int argc, char* argv[])
     exit(1);
   }
 
-  FILE* grammar_f;
-  if (!(grammar_f = fopen(argv[1], "r"))) {
-    fprintf(stderr, "Error: can't open file '%s'\n", argv[1]);
-    exit(1);
-  }
+  Grammar* g = Grammar_open(argv[1]);
+  Grammar_print(g);
+  int* ids = naive_ids(g);
+  handle_trie* trie = generate_handle_trie(g, ids);
 
-  symbol_l* sym_list = generate_grammar_map(grammar_f);
-  print_grammar_map(sym_list);
-
-  if (grammar_check(sym_list)) {
+  if (grammar_check(ids[g->start], trie)) {
     printf("Grammar correct\n");
   } else {
     printf("Grammar incorrect\n");
   }
 
-  free_grammar_map(sym_list);
-
-  fclose(grammar_f);
+  free_handle_trie(trie);
+  free(ids);
+  Grammar_free(g);
 }
 
 
-char* pop_str_stack(str_stack** stack)
+void push_sym_stack(sym_stack* stack, int sym)
 {
-  if (*stack == NULL) {
-    return NULL;
+  if (stack->size == stack->capacity) {
+    stack->capacity *= 2;
+    stack->syms = realloc(stack->syms, stack->capacity * sizeof(int));
   }
-  char* out = (*stack)->str;
-  str_stack* next = (*stack)->next;
-  fprintf(stderr, "popping: '%s'\n", out);
-  free((*stack)->str);
-  free(*stack);
-  *stack = next;
-  return out;
+  stack->syms[stack->size++] = sym;
 }
 
-str_stack* push_str_stack(str_stack* stack, const char* str)
+int grammar_check(int root, handle_trie* trie)
 {
-  str_stack* new = malloc(sizeof(str_stack));
-  new->str = strdup(str);
-  new->next = stack;
-  return new;
-}
-
-int grammar_check(symbol_l* sym_list)
-{
-  str_stack* stack;
+  sym_stack stack;
   tok_type_t tok_t;
   int handle_len;
-  char nt_name[TOK_LEN];
-  char debug[TOK_LEN];
+  int lhs;
+  int out;
 
-  stack = push_str_stack(NULL, "invalid");
+  stack.capacity = 64;
+  stack.size = 0;
+  stack.syms = malloc(stack.capacity * sizeof(int));
   tok_t = yylex();
-  while (strcmp(stack->str, sym_list->sym->name) != 0 || tok_t != NONE) {
-    if (handle_len = check_for_handle(stack, sym_list, nt_name)) {
-      while (handle_len--) {
-        pop_str_stack(&stack);
-      }
-      stack = push_str_stack(stack, nt_name);
+  while (stack.size == 0 || stack.syms[stack.size-1] != root || tok_t != NONE) {
+    if (handle_len = check_for_handle(&stack, trie, &lhs)) {
+      stack.size -= handle_len;
+      push_sym_stack(&stack, lhs);
     } else if (tok_t != NONE) {
-      stack = push_str_stack(stack, terminals[tok_t]);
+      push_sym_stack(&stack, tok_t);
       tok_t = yylex();
     } else {
-      free_str_stack(stack);
+      free(stack.syms);
       return 0;
     }
   }
 
   // check whether stack is empty
-  if (stack->next != NULL && strcmp(stack->next->str, "invalid") == 0) {
-    free_str_stack(stack);
-    return 1;
-  } else {
-    free_str_stack(stack);
-    return 0;
-  }
-}
-
-int check_for_handle(str_stack* stack, symbol_l* sym_list, char* nt_name)
-{
-  symbol_l* sym_iter;
-  prod_rule_l* rule_iter;
-  for (sym_iter = sym_list; sym_iter != NULL; sym_iter = sym_iter->next) {
-    for (rule_iter = sym_iter->sym->prod_l; rule_iter != NULL; rule_iter = rule_iter->next) {
-      if (match_rule(stack, rule_iter->rule)) {
-        strncpy(nt_name, sym_iter->sym->name, TOK_LEN);
-        return rule_iter->rule->num_symbols;
-      }
-    }
-  }
-  return 0;
-}
-
-int match_rule(str_stack* stack, prod_rule* rule)
-{
-  str_stack* stack_iter;
-  int i;
-
-  stack_iter = stack;
-  for (i = rule->num_symbols-1; i >= 0 && strcmp(stack_iter->str, "invalid") != 0;
-      i--, stack_iter = stack_iter->next) {
-    if (strcmp(rule->sym_l[i], stack_iter->str) != 0) {
-      break;
-    }
-  }
-
-  return (i == -1);
-}
-
-void free_str_stack(str_stack* stack)
-{
-  str_stack* next;
-  for (; stack != NULL; stack = next) {
-    next = stack->next;
-    free(stack->str);
-    free(stack);
-  }
+  out = (stack.size == 1);
+  free(stack.syms);
+  return out;
 }
 
-void print_grammar_map(symbol_l* gmap)
+handle_trie* generate_handle_trie(Grammar* g, int* ids)
 {
-  symbol_l* sym_iter;
-  for (sym_iter = gmap; sym_iter != NULL; sym_iter = sym_iter->next) {
-    printf("Non-terminal: '%s'\n", sym_iter->sym->name);
-    print_prod_rule_list(sym_iter->sym->prod_l);
-  }
-}
+  handle_trie* out = malloc(sizeof(handle_trie));
 
-void print_prod_rule_list(prod_rule_l* list)
-{
-  prod_rule_l* rule_iter;
-  int i;
+  out->num_ids = NUM_TERMINALS + g->num_syms - g->num_terms;
+  out->capacity = 16;
+  out->next = calloc(out->capacity * out->num_ids, sizeof(int));
+  out->rule_idx = malloc(out->capacity * sizeof(int));
+  out->lhs = malloc(out->capacity * sizeof(int));
+  out->num_nodes = 1;
+  out->rule_idx[0] = -1;
 
-  for (rule_iter = list; rule_iter != NULL; rule_iter = rule_iter->next) {
-    printf("Rule: ");
-    for (i = 0; i < rule_iter->rule->num_symbols; i++) {
-      printf(" '%s' ", rule_iter->rule->sym_l[i]);
-    }
-    printf("\n");
+  // rules are numbered in grammar order
+  for (int r = 0; r < g->num_rules; r++) {
+    insert_handle(out, g->rhs + g->rule_off[r],
+        g->rule_off[r + 1] - g->rule_off[r], ids, r, ids[g->rule_lhs[r]]);
   }
+  return out;
 }
 
-
-void free_prod_l(prod_rule_l* prod_l)
+void insert_handle(handle_trie* trie, const int* rhs, int len, int* ids,
+    int rule_idx, int lhs)
 {
-  prod_rule_l* next;
+  int node = 0;
   int i;
 
-  for (; prod_l != NULL; prod_l = next) {
-    next = prod_l->next;
-    for (i = 0; i < prod_l->rule->num_symbols; i++) {
-      free(prod_l->rule->sym_l[i]);
+  // a rule with a terminal the lexer doesn't know can never be on the stack
+  for (i = 0; i < len; i++) {
+    if (ids[rhs[i]] < 0)
+      return;
+  }
+
+  for (i = len-1; i >= 0; i--) {
+    int* child = &trie->next[node * trie->num_ids + ids[rhs[i]]];
+    if (*child == 0) {
+      if (trie->num_nodes == trie->capacity) {
+        trie->capacity *= 2;
+        trie->next = realloc(trie->next,
+            trie->capacity * trie->num_ids * sizeof(int));
+        memset(trie->next + trie->num_nodes * trie->num_ids, 0,
+            (trie->capacity - trie->num_nodes) * trie->num_ids * sizeof(int));
+        trie->rule_idx = realloc(trie->rule_idx, trie->capacity * sizeof(int));
+        trie->lhs = realloc(trie->lhs, trie->capacity * sizeof(int));
+        child = &trie->next[node * trie->num_ids + ids[rhs[i]]];
+      }
+      trie->rule_idx[trie->num_nodes] = -1;
+      *child = trie->num_nodes++;
     }
-    free(prod_l->rule);
-    free(prod_l);
+    node = *child;
   }
-}
-
-void free_grammar_map(symbol_l* gmap)
-{
-  symbol_l* next;
-  for (; gmap != NULL; gmap = next) {
-    next = gmap->next;
-    free_prod_l(gmap->sym->prod_l);
-    free(gmap->sym->name);
-    free(gmap->sym);
-    free(gmap);
+  // the first rule in the grammar wins if two have the same right side
+  if (trie->rule_idx[node] < 0) {
+    trie->rule_idx[node] = rule_idx;
+    trie->lhs[node] = lhs;
   }
 }
 
-
-// initialize symbol with no production rules
-symbol* generate_symbol(char* name)
+void free_handle_trie(handle_trie* trie)
 {
-  symbol* out = malloc(sizeof(symbol));
-  out->name = strdup(name);
-  out->num_prod_rules = 0;
-  out->prod_rule_sel = -1;
-  out->prod_l = NULL;
-  return out;
-}
-
-// initialize empty production rule
-prod_rule* generate_prod_rule()
-{
-  prod_rule* out = malloc(sizeof(prod_rule));
-  out->num_symbols = 0;
-  return out;
+  free(trie->next);
+  free(trie->rule_idx);
+  free(trie->lhs);
+  free(trie);
 }
 
-prod_rule_l* append_prod_rule_l(prod_rule_l* list, prod_rule* rule)
+// Length of the handle on top of the stack and its non-terminal in 'lhs', 0
+// if there is none. Like trying every rule in grammar order, the first rule
+// that matches wins even if a longer one matches too.
+int check_for_handle(sym_stack* stack, handle_trie* trie, int* lhs)
 {
-  prod_rule_l* last;
-  prod_rule_l* new = malloc(sizeof(prod_rule_l));
-  new->rule = rule;
-  new->next = NULL;
+  int node = 0;
+  int best = -1;
+  int out = 0;
 
-  APPEND(list, last, new);
-}
-
-symbol_l* append_symbol_l(symbol_l* list, symbol* sym)
-{
-  symbol_l* last;
-  symbol_l* new = malloc(sizeof(symbol_l));
-  new->sym = sym;
-  new->next = NULL;
-  
-  APPEND(list, last, new);
-}
-
-
-void generate_prod_rule_list(FILE* g_file, symbol* sym)
-{
-  char token[TOK_LEN];
-  prod_rule* tmp_rule;
-  
-  sym->num_prod_rules = 0;
-  sym->prod_l = NULL;
-
-  tmp_rule = generate_prod_rule();
-
-  while (get_token(g_file, token) != EOF && token[strlen(token)-1] != ':') {
-    if (token[0] != '|') {
-      if (tmp_rule->num_symbols < MAX_TERMS_PER_RULE) {
-        tmp_rule->sym_l[tmp_rule->num_symbols++] = strdup(token);
-      } else {
-        fprintf(stderr, "Grammar parse error: exceeded maximum number of symbols"
-            "per production rule.\n"
-            "Can't be over '%d'\n", MAX_TERMS_PER_RULE);
-        exit(1);
-      }
-    } else {
-      sym->prod_l = append_prod_rule_l(sym->prod_l, tmp_rule);
-      sym->num_prod_rules++;
-      tmp_rule = generate_prod_rule();
-    }
-  }
-  sym->prod_l = append_prod_rule_l(sym->prod_l, tmp_rule);
-  sym->num_prod_rules++;
-  if (token[strlen(token)-1] == ':')
-    unget_token(g_file, token);
-}
-
-
-
-symbol_l* generate_grammar_map(FILE* g_file)
-{
-  char token[TOK_LEN];
-  symbol* tmp_sym;
-  symbol_l* sym_list = NULL;
-  while (get_token(g_file, token) != EOF) {
-    if (token[strlen(token)-1] == ':') {
-      token[strlen(token)-1] = '\0';
-      tmp_sym = generate_symbol(token);
-      generate_prod_rule_list(g_file, tmp_sym);
-      sym_list = append_symbol_l(sym_list, tmp_sym);
-    } else {
-      fprintf(stderr, "syntax error: non-terminals must be defined with a"
-          "':' without spaces separating it from the non-terminal name\n");
-      exit(1);
+  for (int depth = 0; ; depth++) {
+    if (trie->rule_idx[node] >= 0 &&
+        (best < 0 || trie->rule_idx[node] < best)) {
+      best = trie->rule_idx[node];
+      *lhs = trie->lhs[node];
+      out = depth;
     }
+    if (depth == stack->size)
+      break;
+    node = trie->next[node * trie->num_ids + stack->syms[stack->size-1 - depth]];
+    if (node == 0)
+      break;
   }
-  return sym_list;
+  return out;
 }
 
-// assume that all tokens are separated by spaces
-int get_token(FILE* in, char *buf)
+// id on the stack for every symbol of the compiled grammar, -1 for
+// terminals the lexer doesn't know
+int* naive_ids(Grammar* g)
 {
-  char in_c;
-  int buf_idx = 0;
+  int* out = malloc(g->num_syms * sizeof(int));
 
-  while (isspace(in_c = fgetc(in))); // skip all whitespace characters
-
-  if (in_c == EOF)
-    return EOF;
-  else
-    buf[buf_idx++] = in_c;
-
-  do {
-    if (!isspace(in_c = fgetc(in)))
-      buf[buf_idx++] = in_c;
-    else
-      break;
-    if (in_c == EOF)
-      fprintf(stderr, "EOF\n");
-  } while (in_c != EOF);
-
-  buf[buf_idx] = '\0';
-  return (in_c == EOF) ? EOF : buf_idx;
-}
-
-void unget_token(FILE* in, char* token)
-{
-  if (ungetc(' ', in) == EOF) {
-    fprintf(stderr, "couldn't unget character ' '\n");
-    exit(1);
-  }
-  for (int i = strlen(token) - 1; i >= 0; i--) {
-    if (ungetc(token[i], in) == EOF) {
-      fprintf(stderr, "couldn't unget character '%c'\n", token[i]);
-      exit(1);
+  for (int s = 0; s < g->num_terms; s++) {
+    out[s] = -1;
+    for (int i = 0; i < NUM_TERMINALS; i++) {
+      if (strcmp(terminals[i], Grammar_name(g, s)) == 0)
+        out[s] = i;
     }
   }
+  for (int s = g->num_terms; s < g->num_syms; s++)
+    out[s] = NUM_TERMINALS + s - g->num_terms;
+  return out;
 }
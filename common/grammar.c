@@ -0,0 +1,974 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "grammar.h"
+
+// Grammar compiler shared by all parsers
+//
+// The grammar file is mmap'd and split into tokens in one pass, the names
+// stay in the mapped text until the grammar is packed. Every symbol then gets
+// its final id (the end of the input, the terminals, the non-terminals) and
+// everything is packed into one block: the names and a hash table to look
+// them up, the rules as one array of symbol ids, and the nullable flags and
+// FIRST and FOLLOW sets. The block can be written to a file and mmap'd again
+// without compiling the grammar a second time.
+
+static void fail(const char *fmt, ...);
+static void fail_at(GrammarScanner *sc, GrammarToken *tok, const char *fmt,
+    ...);
+
+
+static void fail(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "error: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+// error at the position of 'tok' in the grammar file
+static void fail_at(GrammarScanner *sc, GrammarToken *tok, const char *fmt,
+    ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "%s:%d:%d: error: ", sc->path, tok->line, tok->col);
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+static unsigned name_hash(const char *name, int len)
+{
+  unsigned h = 2166136261u; // FNV-1a
+  for (int i = 0; i < len; i++)
+    h = (h ^ (unsigned char)name[i]) * 16777619u;
+  return h;
+}
+
+// make room for 'need' elements of 'size' bytes in 'p'
+static void *grow(void *p, int *capacity, int need, size_t size)
+{
+  if (need <= *capacity)
+    return p;
+  while (*capacity < need)
+    *capacity *= 2;
+  return realloc(p, *capacity * size);
+}
+
+
+/******************************************************************************/
+/* Splitting the grammar file into tokens                                     */
+/******************************************************************************/
+
+static int is_space(char c)
+{
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+      c == '\f';
+}
+
+static void scanner_init(GrammarScanner *sc, const char *path,
+    const char *text, long len)
+{
+  sc->path = path;
+  sc->p = text;
+  sc->end = text + len;
+  sc->line_start = text;
+  sc->line = 1;
+}
+
+// all tokens are separated by whitespace, returns 0 at the end of the file
+// with 'tok' at the end
+static int next_token(GrammarScanner *sc, GrammarToken *tok)
+{
+  const char *p = sc->p;
+
+  for (; p < sc->end && is_space(*p); p++) {
+    if (*p == '\n') {
+      sc->line++;
+      sc->line_start = p + 1;
+    }
+  }
+  tok->s = p;
+  tok->line = sc->line;
+  tok->col = p - sc->line_start + 1;
+  while (p < sc->end && !is_space(*p))
+    p++;
+  tok->len = p - tok->s;
+  sc->p = p;
+  return tok->len > 0;
+}
+
+static int token_is(GrammarToken *tok, const char *word)
+{
+  return tok->len == (int)strlen(word) && memcmp(tok->s, word, tok->len) == 0;
+}
+
+static void need_token(GrammarScanner *sc, GrammarToken *tok,
+    const char *what)
+{
+  if (!next_token(sc, tok))
+    fail_at(sc, tok, "missing %s", what);
+}
+
+
+/******************************************************************************/
+/* Reading the grammar file                                                   */
+/******************************************************************************/
+
+static void builder_init(GrammarBuilder *b)
+{
+  memset(b, 0, sizeof(GrammarBuilder));
+  b->names_cap = b->rules_cap = b->rhs_cap = b->lex_cap = GRAMMAR_INIT_CAP;
+  b->names = malloc(b->names_cap * sizeof(char *));
+  b->name_len = malloc(b->names_cap * sizeof(int));
+  b->line = malloc(b->names_cap * sizeof(int));
+  b->col = malloc(b->names_cap * sizeof(int));
+  b->decl = malloc(b->names_cap * sizeof(int));
+  b->def = malloc(b->names_cap * sizeof(int));
+  b->hash_cap = 2 * GRAMMAR_INIT_CAP;
+  b->hash = malloc(b->hash_cap * sizeof(int));
+  memset(b->hash, -1, b->hash_cap * sizeof(int));
+  b->start = -1;
+  b->lhs = malloc(b->rules_cap * sizeof(int));
+  b->off = malloc(b->rules_cap * sizeof(int));
+  b->off[0] = 0;
+  b->rhs = malloc(b->rhs_cap * sizeof(int));
+  b->lex_sym = malloc(b->lex_cap * sizeof(int));
+  b->lex_pattern = malloc(b->lex_cap * sizeof(char *));
+  b->lex_len = malloc(b->lex_cap * sizeof(int));
+}
+
+static void builder_free(GrammarBuilder *b)
+{
+  free(b->names);
+  free(b->name_len);
+  free(b->line);
+  free(b->col);
+  free(b->decl);
+  free(b->def);
+  free(b->hash);
+  free(b->lhs);
+  free(b->off);
+  free(b->rhs);
+  free(b->lex_sym);
+  free(b->lex_pattern);
+  free(b->lex_len);
+}
+
+static int *hash_slot(GrammarBuilder *b, int *hash, int capacity,
+    const char *name, int len)
+{
+  unsigned i = name_hash(name, len) & (capacity - 1);
+
+  while (hash[i] >= 0 && (b->name_len[hash[i]] != len ||
+        memcmp(b->names[hash[i]], name, len) != 0)) {
+    i = (i + 1) & (capacity - 1);
+  }
+  return &hash[i];
+}
+
+// number of the name 'tok' without its last 'trim' characters, a new one if
+// it wasn't seen yet
+static int intern(GrammarBuilder *b, GrammarToken *tok, int trim)
+{
+  int len = tok->len - trim;
+  int *slot = hash_slot(b, b->hash, b->hash_cap, tok->s, len);
+
+  if (*slot >= 0)
+    return *slot;
+  if (2 * (b->num_names + 1) > b->hash_cap) {
+    free(b->hash);
+    b->hash_cap *= 2;
+    b->hash = malloc(b->hash_cap * sizeof(int));
+    memset(b->hash, -1, b->hash_cap * sizeof(int));
+    for (int i = 0; i < b->num_names; i++) {
+      *hash_slot(b, b->hash, b->hash_cap, b->names[i], b->name_len[i]) = i;
+    }
+    slot = hash_slot(b, b->hash, b->hash_cap, tok->s, len);
+  }
+  if (b->num_names == b->names_cap) {
+    b->names_cap *= 2;
+    b->names = realloc(b->names, b->names_cap * sizeof(char *));
+    b->name_len = realloc(b->name_len, b->names_cap * sizeof(int));
+    b->line = realloc(b->line, b->names_cap * sizeof(int));
+    b->col = realloc(b->col, b->names_cap * sizeof(int));
+    b->decl = realloc(b->decl, b->names_cap * sizeof(int));
+    b->def = realloc(b->def, b->names_cap * sizeof(int));
+  }
+  b->names[b->num_names] = tok->s;
+  b->name_len[b->num_names] = len;
+  b->line[b->num_names] = tok->line;
+  b->col[b->num_names] = tok->col;
+  b->decl[b->num_names] = -1;
+  b->def[b->num_names] = -1;
+  *slot = b->num_names;
+  return b->num_names++;
+}
+
+static int declare(GrammarBuilder *b, GrammarToken *tok)
+{
+  int n = intern(b, tok, 0);
+
+  if (b->decl[n] < 0)
+    b->decl[n] = b->num_decl++;
+  return n;
+}
+
+static void add_lex(GrammarBuilder *b, int name, GrammarToken *pattern)
+{
+  b->lex_sym = grow(b->lex_sym, &b->lex_cap, b->num_lex + 1, sizeof(int));
+  b->lex_pattern = realloc(b->lex_pattern, b->lex_cap * sizeof(char *));
+  b->lex_len = realloc(b->lex_len, b->lex_cap * sizeof(int));
+  b->lex_sym[b->num_lex] = name;
+  b->lex_pattern[b->num_lex] = pattern->s;
+  b->lex_len[b->num_lex++] = pattern->len;
+}
+
+// start a new rule for 'lhs', the symbols are added with add_symbol
+static void add_rule(GrammarBuilder *b, int lhs)
+{
+  if (b->num_rules + 2 > b->rules_cap) {
+    b->rules_cap *= 2;
+    b->lhs = realloc(b->lhs, b->rules_cap * sizeof(int));
+    b->off = realloc(b->off, b->rules_cap * sizeof(int));
+  }
+  b->lhs[b->num_rules++] = lhs;
+  b->off[b->num_rules] = b->num_rhs;
+}
+
+static void add_symbol(GrammarBuilder *b, int name)
+{
+  b->rhs = grow(b->rhs, &b->rhs_cap, b->num_rhs + 1, sizeof(int));
+  b->rhs[b->num_rhs++] = name;
+  b->off[b->num_rules] = b->num_rhs;
+}
+
+static void read_grammar(GrammarBuilder *b, GrammarScanner *sc)
+{
+  GrammarToken tok;
+  int more = next_token(sc, &tok);
+  int lhs = -1;
+
+  // declarations have to come before the first rule
+  while (more && tok.s[0] == '%') {
+    if (token_is(&tok, "%start")) {
+      if (b->start >= 0)
+        fail_at(sc, &tok, "second '%%start' declaration");
+      need_token(sc, &tok, "root of grammar name after '%start'");
+      b->start = intern(b, &tok, 0);
+      b->start_tok = tok;
+    } else if (token_is(&tok, "%token")) {
+      while ((more = next_token(sc, &tok)) && tok.s[0] != '%' &&
+          tok.s[tok.len-1] != ':') {
+        declare(b, &tok);
+      }
+      continue;
+    } else if (token_is(&tok, "%lex")) {
+      need_token(sc, &tok, "terminal name after '%lex'");
+      lhs = declare(b, &tok);
+      need_token(sc, &tok, "pattern after '%lex'");
+      add_lex(b, lhs, &tok);
+    } else if (token_is(&tok, "%ignore")) {
+      need_token(sc, &tok, "pattern after '%ignore'");
+      add_lex(b, -1, &tok);
+    } else {
+      fail_at(sc, &tok, "unknown declaration '%.*s'", tok.len, tok.s);
+    }
+    more = next_token(sc, &tok);
+  }
+
+  lhs = -1;
+  for (; more; more = next_token(sc, &tok)) {
+    if (tok.s[tok.len-1] == ':') {
+      if (tok.len == 1)
+        fail_at(sc, &tok, "syntax: ':' without a non-terminal name");
+      // more rules for a non-terminal that was defined before are added
+      // to its old ones
+      lhs = intern(b, &tok, 1);
+      if (b->decl[lhs] >= 0) {
+        fail_at(sc, &tok, "'%.*s' is declared as a terminal but has rules",
+            tok.len - 1, tok.s);
+      }
+      if (b->def[lhs] < 0)
+        b->def[lhs] = b->num_def++;
+      add_rule(b, lhs);
+    } else if (lhs < 0) {
+      fail_at(sc, &tok, "syntax: '%.*s' before the first non-terminal, "
+          "non-terminals must be defined with a ':' without spaces "
+          "separating it from the non-terminal name", tok.len, tok.s);
+    } else if (token_is(&tok, "|")) {
+      add_rule(b, lhs);
+    } else {
+      add_symbol(b, intern(b, &tok, 0));
+    }
+  }
+}
+
+
+/******************************************************************************/
+/* Packing the grammar into one block                                         */
+/******************************************************************************/
+
+static long block_size(GrammarHeader *hdr)
+{
+  int set_words = (hdr->num_terms + 31) / 32;
+
+  return sizeof(GrammarHeader) + sizeof(int) * ((long)hdr->num_syms +
+      hdr->hash_cap + hdr->num_syms + 1 + hdr->num_rules +
+      hdr->num_rules + 1 + hdr->num_rhs + 2L * hdr->num_lex +
+      2L * hdr->num_syms * set_words) + hdr->num_syms + hdr->names_len;
+}
+
+// point all arrays of 'g' into 'data', which starts with the header
+static void layout(Grammar *g, void *data, long data_len)
+{
+  GrammarHeader *hdr = data;
+  const int *p = (const int *)(hdr + 1);
+
+  g->num_syms = hdr->num_syms;
+  g->num_terms = hdr->num_terms;
+  g->start = hdr->start;
+  g->num_rules = hdr->num_rules;
+  g->num_rhs = hdr->num_rhs;
+  g->num_lex = hdr->num_lex;
+  g->hash_cap = hdr->hash_cap;
+  g->set_words = (g->num_terms + 31) / 32;
+
+  g->name_off = p;
+  g->hash = (p += g->num_syms);
+  g->sym_rules = (p += g->hash_cap);
+  g->rule_lhs = (p += g->num_syms + 1);
+  g->rule_off = (p += g->num_rules);
+  g->rhs = (p += g->num_rules + 1);
+  g->lex_sym = (p += g->num_rhs);
+  g->lex_pattern = (p += g->num_lex);
+  p += g->num_lex;
+  g->first = (const unsigned *)p;
+  g->follow = g->first + g->num_syms * g->set_words;
+  g->nullable = (const char *)(g->follow + g->num_syms * g->set_words);
+  g->names = g->nullable + g->num_syms;
+  g->data = data;
+  g->data_len = data_len;
+}
+
+// add all terminals in 'from' to 'to'
+static void set_union(unsigned *to, const unsigned *from, int words)
+{
+  for (int i = 0; i < words; i++)
+    to[i] |= from[i];
+}
+
+// edges from[i] -> to[i] as lists of successors: the successors of node v
+// are adj[off[v]] to adj[off[v + 1] - 1]
+static void make_adj(int num_nodes, int num_edges, const int *from,
+    const int *to, int **off_out, int **adj_out)
+{
+  int *off = calloc(num_nodes + 1, sizeof(int));
+  int *adj = malloc((num_edges + 1) * sizeof(int));
+  int *next = malloc((num_nodes + 1) * sizeof(int));
+
+  for (int e = 0; e < num_edges; e++)
+    off[from[e] + 1]++;
+  for (int v = 0; v < num_nodes; v++)
+    off[v + 1] += off[v];
+  memcpy(next, off, (num_nodes + 1) * sizeof(int));
+  for (int e = 0; e < num_edges; e++)
+    adj[next[from[e]]++] = to[e];
+  free(next);
+  *off_out = off;
+  *adj_out = adj;
+}
+
+// Add the set of every node to the sets of all nodes it can be reached
+// from. The strongly connected components are found with Tarjan's algorithm
+// (without recursion, the chains in a big grammar are long), which finishes
+// a component only after all components it has edges to. So all nodes of a
+// component get the same set, made from their own sets and the finished
+// sets of their successors, and every edge is looked at once.
+static void propagate(unsigned *sets, int words, int num_nodes,
+    const int *off, const int *adj)
+{
+  int *index = malloc(num_nodes * sizeof(int));
+  int *low = malloc(num_nodes * sizeof(int));
+  int *comp = malloc(num_nodes * sizeof(int)); // -1 while on the stack
+  int *stack = malloc(num_nodes * sizeof(int));
+  int *calls = malloc(num_nodes * sizeof(int)); // nodes being visited
+  int *edge = malloc(num_nodes * sizeof(int)); // next edge of each of them
+  int top = 0, depth, counter = 0, num_comps = 0;
+  int v, u, m, first;
+
+  memset(index, -1, num_nodes * sizeof(int));
+  for (int root = 0; root < num_nodes; root++) {
+    if (index[root] >= 0)
+      continue;
+    depth = 0;
+    calls[depth] = root;
+    edge[depth++] = off[root];
+    index[root] = low[root] = counter++;
+    comp[root] = -1;
+    stack[top++] = root;
+
+    while (depth > 0) {
+      v = calls[depth - 1];
+      if (edge[depth - 1] < off[v + 1]) {
+        u = adj[edge[depth - 1]++];
+        if (index[u] < 0) {
+          index[u] = low[u] = counter++;
+          comp[u] = -1;
+          stack[top++] = u;
+          calls[depth] = u;
+          edge[depth++] = off[u];
+        } else if (comp[u] < 0 && index[u] < low[v]) {
+          low[v] = index[u];
+        }
+        continue;
+      }
+
+      depth--;
+      if (depth > 0 && low[v] < low[calls[depth - 1]])
+        low[calls[depth - 1]] = low[v];
+      if (low[v] != index[v])
+        continue;
+      // v is the first node of a component, the rest is above it
+      for (first = top - 1; stack[first] != v; first--);
+      for (int i = first; i < top; i++)
+        comp[stack[i]] = num_comps;
+      for (int i = first; i < top; i++) {
+        m = stack[i];
+        if (m != v)
+          set_union(sets + v * words, sets + m * words, words);
+        for (int e = off[m]; e < off[m + 1]; e++) {
+          if (comp[adj[e]] != num_comps)
+            set_union(sets + v * words, sets + adj[e] * words, words);
+        }
+      }
+      for (int i = first; i < top; i++) {
+        if (stack[i] != v)
+          memcpy(sets + stack[i] * words, sets + v * words,
+              words * sizeof(unsigned));
+      }
+      top = first;
+      num_comps++;
+    }
+  }
+
+  free(index);
+  free(low);
+  free(comp);
+  free(stack);
+  free(calls);
+  free(edge);
+}
+
+// A non-terminal is nullable once one of its rules has only nullable
+// symbols. Every rule counts the symbols that aren't known to be nullable
+// yet, and a symbol that becomes nullable counts down the rules it is in.
+static void compute_nullable(Grammar *g, char *nullable)
+{
+  int *left = malloc((g->num_rules + 1) * sizeof(int));
+  int *in_rule = malloc((g->num_rhs + 1) * sizeof(int));
+  int *todo = malloc(g->num_syms * sizeof(int));
+  int *uses_off, *uses;
+  int num_todo = 0, s, r;
+
+  for (r = 0; r < g->num_rules; r++) {
+    left[r] = g->rule_off[r + 1] - g->rule_off[r];
+    for (int i = g->rule_off[r]; i < g->rule_off[r + 1]; i++)
+      in_rule[i] = r;
+    if (left[r] == 0 && !nullable[g->rule_lhs[r]]) {
+      nullable[g->rule_lhs[r]] = 1;
+      todo[num_todo++] = g->rule_lhs[r];
+    }
+  }
+  make_adj(g->num_syms, g->num_rhs, g->rhs, in_rule, &uses_off, &uses);
+
+  while (num_todo > 0) {
+    s = todo[--num_todo];
+    for (int e = uses_off[s]; e < uses_off[s + 1]; e++) {
+      r = uses[e];
+      if (--left[r] == 0 && !nullable[g->rule_lhs[r]]) {
+        nullable[g->rule_lhs[r]] = 1;
+        todo[num_todo++] = g->rule_lhs[r];
+      }
+    }
+  }
+
+  free(left);
+  free(in_rule);
+  free(todo);
+  free(uses_off);
+  free(uses);
+}
+
+// FIRST(s): terminals that can start something derived from s
+// FOLLOW(s): terminals that can come right after s
+// Both are what a symbol gets directly from the rules plus the sets of the
+// symbols it depends on, so they are built as a graph of these dependencies
+// and solved with propagate in time linear in the size of the grammar.
+static void compute_sets(Grammar *g, unsigned *first, unsigned *follow,
+    char *nullable)
+{
+  int w = g->set_words;
+  int *from = malloc((g->num_rhs + 1) * sizeof(int));
+  int *to = malloc((g->num_rhs + 1) * sizeof(int));
+  unsigned *suffix = malloc(w * sizeof(unsigned)); // FIRST of the rest
+  int *off, *adj;
+  int num_edges, lhs, s, rest_nullable;
+
+  compute_nullable(g, nullable);
+
+  // FIRST(lhs) has FIRST of every symbol up to the first not nullable one
+  for (int t = 0; t < g->num_terms; t++)
+    first[t * w + t / 32] |= 1u << (t % 32);
+  num_edges = 0;
+  for (int r = 0; r < g->num_rules; r++) {
+    lhs = g->rule_lhs[r];
+    for (int i = g->rule_off[r]; i < g->rule_off[r + 1]; i++) {
+      s = g->rhs[i];
+      from[num_edges] = lhs;
+      to[num_edges++] = s;
+      if (!nullable[s])
+        break;
+    }
+  }
+  make_adj(g->num_syms, num_edges, from, to, &off, &adj);
+  propagate(first, w, g->num_syms, off, adj);
+  free(off);
+  free(adj);
+
+  // FOLLOW(s) has FIRST of the rest of the rule after s, and FOLLOW(lhs) if
+  // the rest is nullable
+  follow[g->start * w + GRAMMAR_END / 32] |= 1u << (GRAMMAR_END % 32);
+  num_edges = 0;
+  for (int r = 0; r < g->num_rules; r++) {
+    lhs = g->rule_lhs[r];
+    memset(suffix, 0, w * sizeof(unsigned));
+    rest_nullable = 1;
+    for (int i = g->rule_off[r + 1] - 1; i >= g->rule_off[r]; i--) {
+      s = g->rhs[i];
+      set_union(follow + s * w, suffix, w);
+      if (rest_nullable) {
+        from[num_edges] = s;
+        to[num_edges++] = lhs;
+      }
+      if (nullable[s]) {
+        set_union(suffix, first + s * w, w);
+      } else {
+        memcpy(suffix, first + s * w, w * sizeof(unsigned));
+        rest_nullable = 0;
+      }
+    }
+  }
+  make_adj(g->num_syms, num_edges, from, to, &off, &adj);
+  propagate(follow, w, g->num_syms, off, adj);
+  free(off);
+  free(adj);
+
+  free(from);
+  free(to);
+  free(suffix);
+}
+
+// with declarations every other name has to have rules
+static void check_symbols(GrammarBuilder *b, GrammarScanner *sc)
+{
+  GrammarToken tok;
+  int n;
+
+  if (b->start >= 0 && b->decl[b->start] >= 0) {
+    fail_at(sc, &b->start_tok, "root of grammar '%.*s' is declared as a "
+        "terminal", b->start_tok.len, b->start_tok.s);
+  }
+  if (b->start >= 0 && b->def[b->start] < 0) {
+    fail_at(sc, &b->start_tok, "root of grammar '%.*s' has no rules",
+        b->start_tok.len, b->start_tok.s);
+  }
+  if (b->num_decl == 0)
+    return;
+  for (int i = 0; i < b->num_rhs; i++) {
+    n = b->rhs[i];
+    if (b->decl[n] < 0 && b->def[n] < 0) {
+      tok.line = b->line[n];
+      tok.col = b->col[n];
+      fail_at(sc, &tok, "symbol '%.*s' is neither a declared terminal nor a "
+          "non-terminal", b->name_len[n], b->names[n]);
+    }
+  }
+}
+
+// Give every name its symbol id: GRAMMAR_END, then the declared terminals
+// in the order of their declarations (or, if there are none, every name
+// without rules in the order it was first seen), then the non-terminals in
+// the order of the grammar file.
+static int *assign_ids(GrammarBuilder *b, int *num_terms, int *num_syms)
+{
+  int *ids = malloc(b->num_names * sizeof(int));
+
+  *num_terms = 1;
+  for (int n = 0; n < b->num_names; n++) {
+    ids[n] = -1;
+    if (b->decl[n] >= 0)
+      ids[n] = 1 + b->decl[n];
+    else if (b->num_decl == 0 && b->def[n] < 0)
+      ids[n] = (*num_terms)++;
+  }
+  if (b->num_decl > 0)
+    *num_terms = 1 + b->num_decl;
+  for (int n = 0; n < b->num_names; n++) {
+    if (b->def[n] >= 0)
+      ids[n] = *num_terms + b->def[n];
+  }
+  *num_syms = *num_terms + b->num_def;
+  return ids;
+}
+
+static Grammar *builder_finish(GrammarBuilder *b, GrammarScanner *sc)
+{
+  Grammar *out = malloc(sizeof(Grammar));
+  GrammarHeader hdr;
+  int *ids, *name_off, *hash, *sym_rules, *rule_lhs, *rule_off, *rhs;
+  int *lex_sym, *lex_pattern, *next, *order;
+  char *names;
+  void *data;
+  int num_terms, num_syms, start, pos, h;
+
+  check_symbols(b, sc);
+  ids = assign_ids(b, &num_terms, &num_syms);
+  start = (b->start >= 0) ? b->start : b->lhs[0];
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, GRAMMAR_MAGIC, 4);
+  hdr.num_syms = num_syms;
+  hdr.num_terms = num_terms;
+  hdr.start = ids[start];
+  hdr.num_rules = b->num_rules;
+  hdr.num_rhs = b->num_rhs;
+  hdr.num_lex = b->num_lex;
+  for (hdr.hash_cap = 16; hdr.hash_cap < 2 * num_syms; hdr.hash_cap *= 2);
+  hdr.names_len = strlen("$end") + 1;
+  for (int n = 0; n < b->num_names; n++) {
+    if (ids[n] >= 0)
+      hdr.names_len += b->name_len[n] + 1;
+  }
+  for (int i = 0; i < b->num_lex; i++)
+    hdr.names_len += b->lex_len[i] + 1;
+
+  data = calloc(1, block_size(&hdr));
+  memcpy(data, &hdr, sizeof(hdr));
+  layout(out, data, block_size(&hdr));
+  out->mapped = 0;
+  name_off = (int *)out->name_off;
+  hash = (int *)out->hash;
+  sym_rules = (int *)out->sym_rules;
+  rule_lhs = (int *)out->rule_lhs;
+  rule_off = (int *)out->rule_off;
+  rhs = (int *)out->rhs;
+  lex_sym = (int *)out->lex_sym;
+  lex_pattern = (int *)out->lex_pattern;
+  names = (char *)out->names;
+
+  // names, with the symbol ids in the hash table
+  memset(hash, -1, hdr.hash_cap * sizeof(int));
+  pos = 0;
+  name_off[GRAMMAR_END] = pos;
+  strcpy(names + pos, "$end");
+  pos += strlen("$end") + 1;
+  for (int n = 0; n < b->num_names; n++) {
+    if (ids[n] < 0)
+      continue;
+    name_off[ids[n]] = pos;
+    memcpy(names + pos, b->names[n], b->name_len[n]);
+    pos += b->name_len[n] + 1;
+  }
+  for (int s = 0; s < num_syms; s++) {
+    h = name_hash(names + name_off[s], strlen(names + name_off[s])) &
+        (hdr.hash_cap - 1);
+    while (hash[h] >= 0)
+      h = (h + 1) & (hdr.hash_cap - 1);
+    hash[h] = s;
+  }
+  for (int i = 0; i < b->num_lex; i++) {
+    lex_sym[i] = (b->lex_sym[i] < 0) ? GRAMMAR_IGNORE : ids[b->lex_sym[i]];
+    lex_pattern[i] = pos;
+    memcpy(names + pos, b->lex_pattern[i], b->lex_len[i]);
+    pos += b->lex_len[i] + 1;
+  }
+
+  // rules sorted by their non-terminal, in file order for each of them
+  for (int i = 0; i < b->num_rules; i++)
+    sym_rules[ids[b->lhs[i]] + 1]++;
+  for (int s = 0; s < num_syms; s++)
+    sym_rules[s + 1] += sym_rules[s];
+  next = malloc(num_syms * sizeof(int));
+  memcpy(next, sym_rules, num_syms * sizeof(int));
+  order = malloc(b->num_rules * sizeof(int)); // rule number in the file
+  for (int i = 0; i < b->num_rules; i++)
+    order[next[ids[b->lhs[i]]]++] = i;
+  pos = 0;
+  for (int r = 0; r < b->num_rules; r++) {
+    rule_lhs[r] = ids[b->lhs[order[r]]];
+    rule_off[r] = pos;
+    for (int i = b->off[order[r]]; i < b->off[order[r] + 1]; i++)
+      rhs[pos++] = ids[b->rhs[i]];
+  }
+  rule_off[b->num_rules] = pos;
+  free(next);
+  free(order);
+  free(ids);
+
+  compute_sets(out, (unsigned *)out->first, (unsigned *)out->follow,
+      (char *)out->nullable);
+  return out;
+}
+
+// The file is mapped instead of read, the tokens and names are only
+// pointers into it until the block is packed.
+Grammar *Grammar_compile(const char *path)
+{
+  GrammarBuilder b;
+  GrammarScanner sc;
+  Grammar *out;
+  struct stat st;
+  char *text = "";
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    fail("can't open file '%s'", path);
+  if (st.st_size > 0) {
+    text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (text == MAP_FAILED)
+      fail("can't mmap file '%s'", path);
+    madvise(text, st.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  scanner_init(&sc, path, text, st.st_size);
+  builder_init(&b);
+  read_grammar(&b, &sc);
+  if (b.num_rules == 0)
+    fail("grammar file '%s' has no rules", path);
+  out = builder_finish(&b, &sc);
+  builder_free(&b);
+  if (st.st_size > 0)
+    munmap(text, st.st_size);
+  return out;
+}
+
+
+/******************************************************************************/
+/* Compiled grammar files                                                     */
+/******************************************************************************/
+
+void Grammar_write(Grammar *g, const char *path)
+{
+  FILE *f;
+
+  if ((f = fopen(path, "wb")) == NULL)
+    fail("can't open file '%s' for writing", path);
+  if (fwrite(g->data, 1, g->data_len, f) != (size_t)g->data_len)
+    fail("can't write grammar to '%s'", path);
+  fclose(f);
+}
+
+// the counts in the header decide where the arrays are, all of them have to
+// be usable before the size of the block is computed from them
+static int header_ok(GrammarHeader *hdr)
+{
+  return hdr->num_terms >= 1 && hdr->num_terms <= hdr->num_syms &&
+    hdr->num_rules >= 0 && hdr->num_rhs >= 0 && hdr->num_lex >= 0 &&
+    hdr->hash_cap > hdr->num_syms &&
+    (hdr->hash_cap & (hdr->hash_cap - 1)) == 0 && hdr->names_len >= 1;
+}
+
+static int in_range(int x, int lo, int hi)
+{
+  return x >= lo && x < hi;
+}
+
+// Every id and offset in the block is in range and the rules of every
+// symbol are where sym_rules says, so nothing that reads the grammar can
+// index past the block or loop forever in the hash table.
+static int block_ok(Grammar *g, int names_len)
+{
+  int empty = 0;
+
+  if (!in_range(g->start, g->num_terms, g->num_syms) ||
+      g->names[names_len - 1] != '\0')
+    return 0;
+  for (int s = 0; s < g->num_syms; s++) {
+    if (!in_range(g->name_off[s], 0, names_len))
+      return 0;
+  }
+  for (int i = 0; i < g->hash_cap; i++) {
+    if (g->hash[i] < 0)
+      empty++;
+    else if (g->hash[i] >= g->num_syms)
+      return 0;
+  }
+  if (empty == 0 || g->sym_rules[0] != 0 ||
+      g->sym_rules[g->num_syms] != g->num_rules)
+    return 0;
+  for (int s = 0; s < g->num_syms; s++) {
+    if (g->sym_rules[s] > g->sym_rules[s + 1] ||
+        (s < g->num_terms && g->sym_rules[s] != g->sym_rules[s + 1]))
+      return 0;
+  }
+  if (g->rule_off[0] != 0 || g->rule_off[g->num_rules] != g->num_rhs)
+    return 0;
+  for (int r = 0; r < g->num_rules; r++) {
+    if (!in_range(g->rule_lhs[r], g->num_terms, g->num_syms) ||
+        !in_range(r, g->sym_rules[g->rule_lhs[r]],
+          g->sym_rules[g->rule_lhs[r] + 1]) ||
+        g->rule_off[r] > g->rule_off[r + 1])
+      return 0;
+  }
+  for (int i = 0; i < g->num_rhs; i++) {
+    if (!in_range(g->rhs[i], 0, g->num_syms))
+      return 0;
+  }
+  for (int i = 0; i < g->num_lex; i++) {
+    if ((g->lex_sym[i] != GRAMMAR_IGNORE &&
+          !in_range(g->lex_sym[i], 1, g->num_terms)) ||
+        !in_range(g->lex_pattern[i], 0, names_len))
+      return 0;
+  }
+  return 1;
+}
+
+Grammar *Grammar_map(const char *path)
+{
+  GrammarHeader *hdr;
+  struct stat st;
+  Grammar *out;
+  void *base;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    fail("can't open file '%s'", path);
+  if (st.st_size < (long)sizeof(GrammarHeader))
+    fail("'%s' is not a compiled grammar", path);
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED)
+    fail("can't mmap file '%s'", path);
+  close(fd);
+
+  hdr = base;
+  if (memcmp(hdr->magic, GRAMMAR_MAGIC, 4) != 0)
+    fail("'%s' is not a compiled grammar", path);
+  if (!header_ok(hdr))
+    fail("compiled grammar '%s' is corrupt", path);
+  if (st.st_size != block_size(hdr))
+    fail("compiled grammar '%s' is truncated", path);
+
+  out = malloc(sizeof(Grammar));
+  layout(out, base, st.st_size);
+  out->mapped = 1;
+  if (!block_ok(out, hdr->names_len))
+    fail("compiled grammar '%s' is corrupt", path);
+  return out;
+}
+
+// a grammar file written by Grammar_write is mapped, any other file is
+// compiled
+Grammar *Grammar_open(const char *path)
+{
+  char magic[4];
+  FILE *f;
+  int is_compiled;
+
+  if ((f = fopen(path, "r")) == NULL)
+    fail("can't open file '%s'", path);
+  is_compiled = (fread(magic, 1, 4, f) == 4 &&
+      memcmp(magic, GRAMMAR_MAGIC, 4) == 0);
+  fclose(f);
+  return is_compiled ? Grammar_map(path) : Grammar_compile(path);
+}
+
+void Grammar_free(Grammar *g)
+{
+  if (g->mapped)
+    munmap(g->data, g->data_len);
+  else
+    free(g->data);
+  free(g);
+}
+
+
+/******************************************************************************/
+/* Symbols                                                                    */
+/******************************************************************************/
+
+// id of the symbol called 'name' or -1 if it isn't in the grammar
+int Grammar_find(Grammar *g, const char *name)
+{
+  unsigned i = name_hash(name, strlen(name)) & (g->hash_cap - 1);
+
+  while (g->hash[i] >= 0) {
+    if (strcmp(g->names + g->name_off[g->hash[i]], name) == 0)
+      return g->hash[i];
+    i = (i + 1) & (g->hash_cap - 1);
+  }
+  return -1;
+}
+
+const char *Grammar_name(Grammar *g, int sym)
+{
+  return g->names + g->name_off[sym];
+}
+
+const unsigned *Grammar_first(Grammar *g, int sym)
+{
+  return g->first + sym * g->set_words;
+}
+
+const unsigned *Grammar_follow(Grammar *g, int sym)
+{
+  return g->follow + sym * g->set_words;
+}
+
+void Grammar_print(Grammar *g)
+{
+  for (int s = g->num_terms; s < g->num_syms; s++) {
+    printf("Non-terminal: '%s'\n", Grammar_name(g, s));
+    for (int r = g->sym_rules[s]; r < g->sym_rules[s + 1]; r++) {
+      printf("Rule: ");
+      for (int i = g->rule_off[r]; i < g->rule_off[r + 1]; i++)
+        printf(" '%s' ", Grammar_name(g, g->rhs[i]));
+      printf("\n");
+    }
+  }
+}
+
+static void print_set(Grammar *g, const unsigned *set)
+{
+  printf("{");
+  for (int t = 0; t < g->num_terms; t++) {
+    if (GRAMMAR_IN_SET(set, t))
+      printf(" %s", Grammar_name(g, t));
+  }
+  printf(" }");
+}
+
+void Grammar_print_sets(Grammar *g)
+{
+  for (int s = g->num_terms; s < g->num_syms; s++) {
+    printf("%s%s: FIRST ", Grammar_name(g, s),
+        g->nullable[s] ? " (nullable)" : "");
+    print_set(g, Grammar_first(g, s));
+    printf(" FOLLOW ");
+    print_set(g, Grammar_follow(g, s));
+    printf("\n");
+  }
+}
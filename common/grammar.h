@@ -0,0 +1,137 @@
+#ifndef GRAMMAR_H
+#define GRAMMAR_H
+
+#define GRAMMAR_MAGIC "GIR1"
+#define GRAMMAR_INIT_CAP 64
+
+// symbol id of the end of the input, the terminals follow it and the
+// non-terminals come after all terminals
+#define GRAMMAR_END 0
+// terminal of a '%ignore' pattern
+#define GRAMMAR_IGNORE -1
+
+#define GRAMMAR_IS_TERM(G, S) ((S) < (G)->num_terms)
+// number of symbols on the right side of rule 'R' and the first of them
+#define GRAMMAR_RULE_LEN(G, R) ((G)->rule_off[(R) + 1] - (G)->rule_off[(R)])
+#define GRAMMAR_RULE_RHS(G, R) ((G)->rhs + (G)->rule_off[(R)])
+// terminal 'T' is in the bitset 'SET'
+#define GRAMMAR_IN_SET(SET, T) (((SET)[(T) / 32] >> ((T) % 32)) & 1)
+
+
+// header of the binary format written by Grammar_write, followed by
+// name_off[num_syms], hash[hash_cap], sym_rules[num_syms + 1],
+// rule_lhs[num_rules], rule_off[num_rules + 1], rhs[num_rhs],
+// lex_sym[num_lex], lex_pattern[num_lex], first[num_syms * set_words],
+// follow[num_syms * set_words], nullable[num_syms] and names[names_len]
+typedef struct _GrammarHeader {
+  char magic[4];
+  int num_syms;
+  int num_terms;
+  int start;
+  int num_rules;
+  int num_rhs;
+  int num_lex;
+  int hash_cap;
+  int names_len;
+} GrammarHeader;
+
+// Compiled grammar. Everything is in one block laid out like the file, so
+// the same struct works for a grammar compiled from text and one mmap'd
+// from a file written before.
+typedef struct _Grammar {
+  int num_syms;
+  int num_terms; // including GRAMMAR_END
+  int start; // non-terminal the whole input has to be derived from
+  int num_rules;
+  int num_rhs;
+  int num_lex;
+  int hash_cap;
+  int set_words; // unsigned words per terminal bitset
+
+  const int *name_off; // offset of the name of every symbol in names
+  const int *hash; // open addressing table of symbol ids, -1 if empty
+  // rules of symbol s are sym_rules[s] to sym_rules[s + 1] - 1, grouped by
+  // non-terminal in the order of the grammar file
+  const int *sym_rules;
+  const int *rule_lhs;
+  const int *rule_off; // right side of rule r is rhs[rule_off[r]] to
+                       // rhs[rule_off[r + 1] - 1]
+  const int *rhs;
+  const int *lex_sym; // terminal of every '%lex' or GRAMMAR_IGNORE
+  const int *lex_pattern; // offset of the pattern in names
+  const unsigned *first; // FIRST of every symbol
+  const unsigned *follow; // FOLLOW of every symbol, GRAMMAR_END after start
+  const char *nullable;
+  const char *names;
+
+  void *data;
+  long data_len;
+  int mapped; // data is mmap'd
+} Grammar;
+
+// a word of the grammar text, names have any length
+typedef struct _GrammarToken {
+  const char *s; // points into the mapped file, not '\0' terminated
+  int len;
+  int line;
+  int col;
+} GrammarToken;
+
+// splits the mapped grammar file into tokens in one pass
+typedef struct _GrammarScanner {
+  const char *path;
+  const char *p; // next character
+  const char *end;
+  const char *line_start;
+  int line;
+} GrammarScanner;
+
+// what Grammar_compile collects from the text before the ids are assigned,
+// names are numbered in the order they are first seen
+typedef struct _GrammarBuilder {
+  const char **names; // point into the grammar text
+  int *name_len;
+  int *line; // where the name was first seen
+  int *col;
+  int *decl; // position among the declared terminals or -1
+  int *def; // position among the non-terminals or -1 if it has no rules
+  int num_names;
+  int names_cap;
+  int *hash; // open addressing table of name numbers, -1 if empty
+  int hash_cap;
+  int num_decl;
+  int num_def;
+  int start; // name given with '%start' or -1
+  GrammarToken start_tok;
+
+  // rules in the order of the file, as name numbers
+  int *lhs;
+  int *off;
+  int num_rules;
+  int rules_cap;
+  int *rhs;
+  int num_rhs;
+  int rhs_cap;
+
+  int *lex_sym;
+  const char **lex_pattern;
+  int *lex_len;
+  int num_lex;
+  int lex_cap;
+} GrammarBuilder;
+
+
+Grammar *Grammar_compile(const char *path);
+Grammar *Grammar_map(const char *path);
+Grammar *Grammar_open(const char *path);
+void Grammar_write(Grammar *g, const char *path);
+void Grammar_free(Grammar *g);
+
+int Grammar_find(Grammar *g, const char *name);
+const char *Grammar_name(Grammar *g, int sym);
+const unsigned *Grammar_first(Grammar *g, int sym);
+const unsigned *Grammar_follow(Grammar *g, int sym);
+void Grammar_print(Grammar *g);
+void Grammar_print_sets(Grammar *g);
+
+#endif
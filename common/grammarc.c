@@ -0,0 +1,23 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "grammar.h"
+
+// Compile a grammar file once so the parsers can mmap it instead of reading
+// and analysing the text every time they start.
+int main(int argc, char *argv[])
+{
+  Grammar *g;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: grammarc grammar_file [compiled_file]\n");
+    exit(1);
+  }
+  g = Grammar_open(argv[1]);
+  printf("%d terminals, %d non-terminals, %d rules, %ld bytes\n",
+      g->num_terms - 1, g->num_syms - g->num_terms, g->num_rules, g->data_len);
+  Grammar_print(g);
+  Grammar_print_sets(g);
+  if (argc == 3)
+    Grammar_write(g, argv[2]);
+  Grammar_free(g);
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tree.h"
+
+// Flat parse trees shared by all parsers
+//
+// A tree is an array of nodes in postorder, each one just a symbol id, the
+// span of tokens it covers and its number of children. Written to a file the
+// nodes become a few varints each, the spans relative to the node before,
+// so a node usually takes four or five bytes. Nothing in the file is a
+// pointer, so it is mmap'd and read with a cursor as it is.
+
+static void fail(const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  fprintf(stderr, "error: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  exit(1);
+}
+
+
+/******************************************************************************/
+/* Trees in memory                                                            */
+/******************************************************************************/
+
+Tree *Tree_construct(int capacity)
+{
+  Tree *out = malloc(sizeof(Tree));
+  out->capacity = (capacity > 0) ? capacity : TREE_INIT_CAP;
+  out->nodes = malloc(out->capacity * sizeof(TreeNode));
+  out->num_nodes = 0;
+  return out;
+}
+
+// append a node, its 'num_kids' children have to be the last subtrees added
+void Tree_add(Tree *t, int sym, long start, long end, int num_kids)
+{
+  TreeNode *node;
+
+  if (t->num_nodes == t->capacity) {
+    t->capacity *= 2;
+    t->nodes = realloc(t->nodes, t->capacity * sizeof(TreeNode));
+  }
+  node = &t->nodes[t->num_nodes++];
+  node->sym = sym;
+  node->num_kids = num_kids;
+  node->start = start;
+  node->end = end;
+}
+
+// Every node with the names of its children, then the subtrees of the
+// children in order. The walk keeps its own stack so deep trees are fine.
+void Tree_print(Tree *t, Grammar *g)
+{
+  int n = t->num_nodes;
+  int *size = malloc(n * sizeof(int));
+  int *stack = malloc(n * sizeof(int));
+  int *kids = malloc(n * sizeof(int));
+  int top = 0, num_kids, i, k, c;
+
+  // the children of a node are the subtrees right before it
+  for (i = 0; i < n; i++) {
+    size[i] = 1;
+    for (k = 0; k < t->nodes[i].num_kids; k++)
+      size[i] += size[stack[--top]];
+    stack[top++] = i;
+  }
+
+  top = 0;
+  if (n > 0)
+    stack[top++] = n - 1;
+  while (top > 0) {
+    i = stack[--top];
+    num_kids = t->nodes[i].num_kids;
+    for (k = num_kids - 1, c = i - 1; k >= 0; k--, c -= size[c])
+      kids[k] = c;
+    printf("Node: %s\n", Grammar_name(g, t->nodes[i].sym));
+    for (k = 0; k < num_kids; k++)
+      printf("Child node: %s\n", Grammar_name(g, t->nodes[kids[k]].sym));
+    for (k = num_kids - 1; k >= 0; k--)
+      stack[top++] = kids[k];
+  }
+  free(size);
+  free(stack);
+  free(kids);
+}
+
+void Tree_free(Tree *t)
+{
+  free(t->nodes);
+  free(t);
+}
+
+
+/******************************************************************************/
+/* Tree files                                                                 */
+/******************************************************************************/
+
+static unsigned char *put_varint(unsigned char *p, unsigned long v)
+{
+  while (v >= 0x80) {
+    *p++ = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static unsigned long get_varint(TreeCursor *c)
+{
+  unsigned long out = 0;
+  int shift = 0;
+
+  do {
+    if (c->p == c->end || shift > 63)
+      fail("tree file is corrupt");
+    out |= (unsigned long)(*c->p & 0x7f) << shift;
+    shift += 7;
+  } while (*c->p++ & 0x80);
+  return out;
+}
+
+// small differences of either sign become small numbers
+static unsigned long zigzag(long v)
+{
+  return ((unsigned long)v << 1) ^ (unsigned long)(v >> 63);
+}
+
+static long unzigzag(unsigned long v)
+{
+  return (long)(v >> 1) ^ -(long)(v & 1);
+}
+
+void Tree_write(Tree *t, Grammar *g, const char *path)
+{
+  long cap = TREE_INIT_CAP * TREE_NODE_MAX_BYTES;
+  unsigned char *data = malloc(cap);
+  unsigned char *p = data;
+  TreeHeader hdr;
+  TreeNode *node;
+  long prev_start = 0, len;
+  FILE *f;
+
+  for (int i = 0; i < t->num_nodes; i++) {
+    if ((p - data) + TREE_NODE_MAX_BYTES > cap) {
+      len = p - data;
+      cap *= 2;
+      data = realloc(data, cap);
+      p = data + len;
+    }
+    node = &t->nodes[i];
+    p = put_varint(p, node->sym);
+    p = put_varint(p, node->num_kids);
+    p = put_varint(p, zigzag(node->start - prev_start));
+    p = put_varint(p, node->end - node->start);
+    prev_start = node->start;
+  }
+
+  memcpy(hdr.magic, TREE_MAGIC, 4);
+  hdr.num_nodes = t->num_nodes;
+  hdr.num_syms = g->num_syms;
+  hdr.data_len = p - data;
+  if ((f = fopen(path, "wb")) == NULL)
+    fail("can't open file '%s' for writing", path);
+  if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+      fwrite(data, 1, hdr.data_len, f) != (size_t)hdr.data_len)
+    fail("can't write tree to '%s'", path);
+  fclose(f);
+  free(data);
+}
+
+// map a file written by Tree_write for a tree of grammar 'g'
+TreeFile *TreeFile_map(const char *path, Grammar *g)
+{
+  const TreeHeader *hdr;
+  struct stat st;
+  TreeFile *out;
+  void *base;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    fail("can't open file '%s'", path);
+  if (st.st_size < (long)sizeof(TreeHeader))
+    fail("'%s' is not a tree file", path);
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED)
+    fail("can't mmap file '%s'", path);
+  close(fd);
+  madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+  hdr = base;
+  if (memcmp(hdr->magic, TREE_MAGIC, 4) != 0)
+    fail("'%s' is not a tree file", path);
+  if (st.st_size != (long)sizeof(TreeHeader) + hdr->data_len)
+    fail("tree file '%s' is truncated", path);
+  if (hdr->num_syms != g->num_syms)
+    fail("tree file '%s' belongs to a different grammar", path);
+  // the count decides how much is allocated and read, it has to fit the data
+  if (hdr->num_nodes < 0 ||
+      hdr->num_nodes > hdr->data_len / TREE_NODE_MIN_BYTES)
+    fail("tree file is corrupt");
+
+  out = malloc(sizeof(TreeFile));
+  out->data = base;
+  out->data_len = st.st_size;
+  out->hdr = hdr;
+  return out;
+}
+
+TreeCursor TreeFile_cursor(TreeFile *f)
+{
+  TreeCursor out;
+
+  out.p = (const unsigned char *)(f->hdr + 1);
+  out.end = out.p + f->hdr->data_len;
+  out.left = f->hdr->num_nodes;
+  out.start = 0;
+  return out;
+}
+
+// decode the next node in postorder into 'out', returns 0 after the root
+int TreeCursor_next(TreeCursor *c, TreeNode *out)
+{
+  if (c->left == 0)
+    return 0;
+  out->sym = get_varint(c);
+  out->num_kids = get_varint(c);
+  out->start = c->start + unzigzag(get_varint(c));
+  out->end = out->start + get_varint(c);
+  c->start = out->start;
+  c->left--;
+  return 1;
+}
+
+// all nodes of the file as a tree in memory
+Tree *TreeFile_read(TreeFile *f)
+{
+  Tree *out = Tree_construct(f->hdr->num_nodes);
+  TreeCursor c = TreeFile_cursor(f);
+  TreeNode *node;
+  long subtrees = 0; // complete subtrees so far
+
+  while (TreeCursor_next(&c, node = &out->nodes[out->num_nodes])) {
+    if (node->num_kids < 0 || node->num_kids > subtrees ||
+        node->sym < 0 || node->sym >= f->hdr->num_syms)
+      fail("tree file is corrupt");
+    subtrees += 1 - node->num_kids;
+    out->num_nodes++;
+  }
+  if (out->num_nodes > 0 && subtrees != 1)
+    fail("tree file is corrupt");
+  return out;
+}
+
+void TreeFile_free(TreeFile *f)
+{
+  munmap(f->data, f->data_len);
+  free(f);
+}
@@ -0,0 +1,70 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include "grammar.h"
+
+#define TREE_MAGIC "TRE1"
+#define TREE_INIT_CAP 1024
+// longest encoding of one node: four varints of up to 10 bytes
+#define TREE_NODE_MAX_BYTES 40
+// and the shortest, one byte each
+#define TREE_NODE_MIN_BYTES 4
+
+// one node of a parse tree, 'sym' is its id in the compiled grammar and it
+// covers the tokens start to end - 1
+typedef struct _TreeNode {
+  int sym;
+  int num_kids;
+  long start;
+  long end;
+} TreeNode;
+
+// Parse tree of any of the parsers as one array in postorder: the children
+// of a node come right before it, the last child right before the node, so
+// the tree needs no pointers at all. The root is the last node.
+typedef struct _Tree {
+  TreeNode *nodes;
+  int num_nodes;
+  int capacity;
+} Tree;
+
+// header of the file written by Tree_write, followed by the nodes in
+// postorder, every one as the varints sym, num_kids, the zigzag encoded
+// difference between its start and the start of the node before it, and
+// end - start
+typedef struct _TreeHeader {
+  char magic[4];
+  int num_nodes;
+  int num_syms; // of the grammar the tree belongs to
+  long data_len; // bytes after the header
+} TreeHeader;
+
+// a tree file mapped as it is, the nodes are decoded while reading them
+typedef struct _TreeFile {
+  void *data;
+  long data_len;
+  const TreeHeader *hdr;
+} TreeFile;
+
+// position in a mapped tree file
+typedef struct _TreeCursor {
+  const unsigned char *p;
+  const unsigned char *end;
+  int left; // nodes not read yet
+  long start; // of the node read last
+} TreeCursor;
+
+
+Tree *Tree_construct(int capacity);
+void Tree_add(Tree *t, int sym, long start, long end, int num_kids);
+void Tree_print(Tree *t, Grammar *g);
+void Tree_write(Tree *t, Grammar *g, const char *path);
+void Tree_free(Tree *t);
+
+TreeFile *TreeFile_map(const char *path, Grammar *g);
+TreeCursor TreeFile_cursor(TreeFile *f);
+int TreeCursor_next(TreeCursor *c, TreeNode *out);
+Tree *TreeFile_read(TreeFile *f);
+void TreeFile_free(TreeFile *f);
+
+#endif
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "parser.h"
+
+// Arena for the parse tree
+//
+// Tree nodes, edges and the entries of the stack of pending nodes are
+// allocated by bumping an offset in a list of chunks and never freed one by
+// one. A mark remembers the chunk and the offset, resetting to it throws
+// away everything allocated after the mark at once. The chunks behind the
+// current one are kept and reused by later allocations.
+
+
+static arena_chunk* gen_arena_chunk(long size)
+{
+  arena_chunk* out = malloc(sizeof(arena_chunk) + size);
+  out->next = NULL;
+  out->size = size;
+  return out;
+}
+
+arena* generate_arena()
+{
+  arena* out = malloc(sizeof(arena));
+  out->first = gen_arena_chunk(ARENA_CHUNK_SIZE);
+  out->cur = out->first;
+  out->used = 0;
+  return out;
+}
+
+void* arena_alloc(arena* a, long size)
+{
+  arena_chunk* chunk;
+  void* out;
+
+  size = (size + 7) & ~7L; // keep everything 8 byte aligned
+  if (a->used + size > a->cur->size) {
+    if (a->cur->next == NULL || a->cur->next->size < size) {
+      // a chunk that is too small stays behind the new one for later
+      chunk = gen_arena_chunk((size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE);
+      chunk->next = a->cur->next;
+      a->cur->next = chunk;
+    }
+    a->cur = a->cur->next;
+    a->used = 0;
+  }
+  out = a->cur->data + a->used;
+  a->used += size;
+  return out;
+}
+
+arena_mark arena_get_mark(arena* a)
+{
+  arena_mark out;
+  out.chunk = a->cur;
+  out.used = a->used;
+  return out;
+}
+
+void arena_reset(arena* a, arena_mark mark)
+{
+  a->cur = mark.chunk;
+  a->used = mark.used;
+}
+
+void free_arena(arena* a)
+{
+  arena_chunk* next;
+
+  for (arena_chunk* chunk = a->first; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  free(a);
+}
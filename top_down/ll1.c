@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h> // for exit
+
+#include "parser.h"
+
+// LL(1) prediction table built from FIRST and FOLLOW sets
+//
+// FIRST(A): terminals that can start something derived from A
+// FOLLOW(A): terminals that can come right after A (or the end of the input)
+// Both come with the compiled grammar.
+// A rule A -> alpha is predicted for every terminal in FIRST(alpha) and, if
+// alpha can derive the empty string, for every terminal in FOLLOW(A).
+// A non-terminal with two rules for the same terminal has a conflict and is
+// parsed by backtracking instead.
+
+
+// FIRST of the right side of 'rule' as flags in 'out', returns 1 if the
+// rule can derive the empty string
+static int first_of_rule(Grammar* g, prod_rule* rule, char* out)
+{
+  const unsigned* first;
+
+  for (int i = 0; i < rule->num_symbols; i++) {
+    first = Grammar_first(g, rule->ids[i]);
+    for (int t = 0; t < g->num_terms; t++) {
+      if (GRAMMAR_IN_SET(first, t))
+        out[t] = 1;
+    }
+    if (!g->nullable[rule->ids[i]])
+      return 0;
+  }
+  return 1;
+}
+
+static void set_prediction(ll1_table* table, symbol* sym, int t,
+    prod_rule* rule)
+{
+  prod_rule** cell = &table->rules[sym->id * table->num_terms + t];
+
+  if (*cell != NULL && *cell != rule)
+    sym->ll1_conflict = 1;
+  else
+    *cell = rule;
+}
+
+ll1_table* generate_ll1_table(Grammar* g, symbol_l* sym_list)
+{
+  ll1_table* out = malloc(sizeof(ll1_table));
+  symbol_l* sym_iter;
+  prod_rule_l* rule_iter;
+  const unsigned* follow;
+  char* first;
+  int nullable, i;
+
+  out->num_terms = g->num_terms;
+  out->num_syms = 0;
+  for (sym_iter = sym_list; sym_iter != NULL; sym_iter = sym_iter->next)
+    out->num_syms++;
+  out->syms = malloc(out->num_syms * sizeof(symbol*));
+  for (i = 0, sym_iter = sym_list; sym_iter != NULL;
+      i++, sym_iter = sym_iter->next) {
+    out->syms[i] = sym_iter->sym;
+    sym_iter->sym->ll1_conflict = 0;
+  }
+
+  out->rules = calloc(out->num_syms * out->num_terms, sizeof(prod_rule*));
+  first = malloc(out->num_terms * sizeof(char));
+  for (i = 0; i < out->num_syms; i++) {
+    follow = Grammar_follow(g, g->num_terms + out->syms[i]->id);
+    for (rule_iter = out->syms[i]->prod_l; rule_iter != NULL;
+        rule_iter = rule_iter->next) {
+      memset(first, 0, out->num_terms);
+      nullable = first_of_rule(g, rule_iter->rule, first);
+      for (int t = 0; t < out->num_terms; t++) {
+        if (first[t] || (nullable && GRAMMAR_IN_SET(follow, t)))
+          set_prediction(out, out->syms[i], t, rule_iter->rule);
+      }
+    }
+  }
+  free(first);
+
+  return out;
+}
+
+// rule to expand 'sym' with if the next input token is 'tok', NULL if no
+// rule can match
+prod_rule* ll1_predict(ll1_table* table, symbol* sym, int tok)
+{
+  if (tok < 0)
+    return NULL;
+  return table->rules[sym->id * table->num_terms + tok];
+}
+
+void print_ll1_conflicts(ll1_table* table)
+{
+  for (int i = 0; i < table->num_syms; i++) {
+    if (table->syms[i]->ll1_conflict) {
+      fprintf(stderr, "'%s' is not LL(1), its rules are tried in order\n",
+          table->syms[i]->name);
+    }
+  }
+}
+
+void free_ll1_table(ll1_table* table)
+{
+  free(table->syms);
+  free(table->rules);
+  free(table);
+}
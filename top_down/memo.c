@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h> // for exit
+
+#include "parser.h"
+
+// Packrat cache for the backtracking parser
+//
+// Whether a non-terminal matches at some input index (and how far) only
+// depends on the non-terminal and the index: the parser never backtracks into
+// a non-terminal once it matched, it only tries the next rule of one of its
+// parents. So the first result for (non-terminal, index) can be reused
+// whenever the parser gets there again after backtracking.
+// Matched subtrees are copied into the cache, the copies are never changed
+// and are shared by every tree that uses them.
+
+
+// the index has to go through the multiplication as well, otherwise
+// consecutive indices of a symbol end up in consecutive slots and the
+// linear probing in memo_slot walks ever longer runs
+static unsigned memo_hash(int sym_id, long idx)
+{
+  unsigned long h = (unsigned long)sym_id * 2654435761u;
+  return ((unsigned long)idx ^ h) * 0x9e3779b97f4a7c15ul >> 32;
+}
+
+// With a prediction table only non-terminals with an LL(1) conflict are
+// cached: the others never try a second rule, so they are only parsed again
+// at the same index when a parent with a conflict is and are hardly ever
+// found in the cache.
+memo_table* generate_memo_table(long max_bytes, int conflicts_only)
+{
+  memo_table* out = malloc(sizeof(memo_table));
+  out->capacity = MEMO_INIT_CAP;
+  out->size = 0;
+  out->entries = malloc(out->capacity * sizeof(memo_entry));
+  for (int i = 0; i < out->capacity; i++)
+    out->entries[i].sym_id = -1;
+  out->nodes_capacity = MEMO_INIT_CAP;
+  out->num_nodes = 0;
+  out->nodes = malloc(out->nodes_capacity * sizeof(ptree_node*));
+  out->bytes = out->capacity * sizeof(memo_entry);
+  out->max_bytes = max_bytes;
+  out->hits = 0;
+  out->conflicts_only = conflicts_only;
+  return out;
+}
+
+static memo_entry* memo_slot(memo_entry* entries, int capacity, int sym_id,
+    long idx)
+{
+  unsigned i = memo_hash(sym_id, idx) & (capacity - 1);
+
+  while (entries[i].sym_id != -1 &&
+      (entries[i].sym_id != sym_id || entries[i].idx != idx))
+    i = (i + 1) & (capacity - 1);
+  return &entries[i];
+}
+
+static void memo_expand(memo_table* memo)
+{
+  memo_entry* old = memo->entries;
+  int old_capacity = memo->capacity;
+
+  memo->capacity *= 2;
+  memo->entries = malloc(memo->capacity * sizeof(memo_entry));
+  for (int i = 0; i < memo->capacity; i++)
+    memo->entries[i].sym_id = -1;
+  for (int i = 0; i < old_capacity; i++) {
+    if (old[i].sym_id != -1)
+      *memo_slot(memo->entries, memo->capacity, old[i].sym_id, old[i].idx) =
+        old[i];
+  }
+  memo->bytes += (memo->capacity - old_capacity) * sizeof(memo_entry);
+  free(old);
+}
+
+memo_entry* memo_lookup(memo_table* memo, symbol* sym, long idx)
+{
+  memo_entry* out;
+
+  if (memo->conflicts_only && !sym->ll1_conflict)
+    return NULL;
+  out = memo_slot(memo->entries, memo->capacity, sym->id, idx);
+
+  if (out->sym_id == -1)
+    return NULL;
+  memo->hits++;
+  return out;
+}
+
+// remember that 'sym' matched [idx, end) as 'tree' or failed if end is -1
+void memo_store(memo_table* memo, symbol* sym, long idx, long end,
+    ptree_node* tree)
+{
+  memo_entry* slot;
+
+  if (memo->bytes >= memo->max_bytes ||
+      (memo->conflicts_only && !sym->ll1_conflict))
+    return;
+  if (2 * (memo->size + 1) > memo->capacity)
+    memo_expand(memo);
+  slot = memo_slot(memo->entries, memo->capacity, sym->id, idx);
+  if (slot->sym_id != -1)
+    return;
+  slot->sym_id = sym->id;
+  slot->idx = idx;
+  slot->end = end;
+  slot->tree = tree;
+  memo->size++;
+}
+
+// Copy of a matched node for the cache whose children are the copies of its
+// children. Returns NULL if the cache is full or a child could not be copied.
+// When only conflicts are cached a node outside of every non-terminal with a
+// conflict is not copied, no copy of it would ever be stored.
+ptree_node* memo_copy_node(memo_table* memo, ptree_node* node)
+{
+  ptree_node* out;
+  ptree_edge* iter;
+  ptree_edge** last;
+
+  if (node->memo_copy != NULL)
+    return node->memo_copy;
+  if (memo->bytes >= memo->max_bytes ||
+      (memo->conflicts_only && !node->in_conflict))
+    return NULL;
+  for (iter = node->edge_l; iter != NULL; iter = iter->next) {
+    if (iter->node->memo_copy == NULL)
+      return NULL;
+  }
+
+  out = malloc(sizeof(ptree_node));
+  out->name = node->name;
+  out->sym = node->sym;
+  out->term_id = node->term_id;
+  out->idx_old = node->idx_old;
+  out->next_rule = NULL;
+  out->parent = NULL; // shared, so there is no single parent
+  out->pending = 0;
+  out->memo_copy = out;
+  out->is_memo = 1;
+  out->in_conflict = 1;
+  out->edge_l = NULL;
+  memo->bytes += sizeof(ptree_node);
+  // keep the order of the children
+  last = &out->edge_l;
+  for (iter = node->edge_l; iter != NULL; iter = iter->next) {
+    *last = malloc(sizeof(ptree_edge));
+    (*last)->node = iter->node->memo_copy;
+    (*last)->next = NULL;
+    last = &(*last)->next;
+    memo->bytes += sizeof(ptree_edge);
+  }
+
+  if (memo->num_nodes == memo->nodes_capacity) {
+    memo->nodes_capacity *= 2;
+    memo->nodes = realloc(memo->nodes, memo->nodes_capacity * sizeof(ptree_node*));
+  }
+  memo->nodes[memo->num_nodes++] = out;
+  node->memo_copy = out;
+  return out;
+}
+
+void free_memo_table(memo_table* memo)
+{
+  ptree_edge* edge;
+  ptree_edge* next_edge;
+
+  for (int i = 0; i < memo->num_nodes; i++) {
+    for (edge = memo->nodes[i]->edge_l; edge != NULL; edge = next_edge) {
+      next_edge = edge->next;
+      free(edge);
+    }
+    free(memo->nodes[i]);
+  }
+  free(memo->nodes);
+  free(memo->entries);
+  free(memo);
+}
@@ -1,135 +1,121 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h> // for exit
-#include <ctype.h> // for isspace
-
-#define TOK_LEN 50
-#define MAX_TERMS_PER_RULE 10
-#define FSIZE 1000
-
-#define APPEND(LIST, LAST, NEW) ({\
-  if (list != NULL) {\
-    for (last = list; last->next != NULL; last = last->next);\
-    last->next = new;\
-    return list;\
-  } else {\
-    return new;\
-  }\
-})
-
-typedef struct prod_rule {
-  int num_symbols;
-  char* sym_l[MAX_TERMS_PER_RULE];
-} prod_rule;
-
-typedef struct symbol {
-  char* name;
-  int num_prod_rules;
-  int prod_rule_sel;
-  struct prod_rule_l* prod_l;
-} symbol;
-
-typedef struct prod_rule_l {
-  struct prod_rule* rule;
-  struct prod_rule_l* next;
-} prod_rule_l;
-
-// top level list containing one item for every non-terminal definition
-typedef struct symbol_l {
-  struct symbol* sym;
-  struct symbol_l* next;
-} symbol_l;
-
-
-typedef struct ptree_node {
-  char *name;
-  int idx_old;
-  struct prod_rule_l* next_rule;
-  struct ptree_node* parent;
-  struct ptree_edge* edge_l;
-} ptree_node;
-
-typedef struct ptree_edge {
-  struct ptree_node* node;
-  struct ptree_edge* next;
-} ptree_edge;
-
-typedef struct node_l {
-  struct ptree_node* node;
-  struct node_l* next;
-} node_l;
-
-
-
-int is_terminal(const char* token, symbol_l* sym_list);
-int get_token(FILE* in, char *buf);
-void unget_token(FILE* in, char* token);
-int get_token_from_string(const char* in, char* buf, int* isend);
-
-symbol* generate_symbol(char* name);
-prod_rule* generate_prod_rule();
-prod_rule_l* append_prod_rule_l(prod_rule_l* list, prod_rule* rule);
-symbol_l* append_symbol_l(symbol_l* list, symbol* sym);
-void generate_prod_rule_list(FILE* g_file, symbol* sym);
-symbol_l* generate_grammar_map(FILE* g_file);
-void print_prod_rule_list(prod_rule_l* list);
-void print_grammar_map(symbol_l* gmap);
-
-void free_prod_l(prod_rule_l* prod_l);
-void free_grammar_map(symbol_l* gmap);
-
-prod_rule* get_prod_rule_by_idx(prod_rule_l* list, int idx);
-symbol* get_symbol_by_name(symbol_l* list, const char* name);
-ptree_node* parse_tree_gen(const char* in, symbol_l* sym_list);
-void cleanup_tree(ptree_node* root, symbol_l* sym_list);
-ptree_edge* insert_edge(ptree_edge* edge, ptree_node* node);
-ptree_node* gen_ptree_node(symbol* sym, ptree_node* parent);
-ptree_node* gen_ptree_node_for_terminal(const char* name, ptree_node* parent);
-ptree_node* pop_node(node_l** stack);
-node_l* remove_from_node_list(node_l* list, ptree_node* node);
-node_l* push_node(node_l* list, ptree_node* node);
-void print_tree(ptree_node* top);
-void free_node_list(node_l* list);
-void free_edges(ptree_edge* edge);
-void free_tree(ptree_node* top);
+#include <unistd.h> // for getopt
+#include <limits.h> // for LONG_MAX
 
+#include "parser.h"
 
-int main(int argc, char* argv[])
+
+static void usage()
 {
-  char file_contents[FSIZE];
+  fprintf(stderr, "Usage: parser [-b] [-p] [-m cache_mb] [-o tree_file] "
+      "grammar_file [parse_file]\n"
+      "       parser -t tree_file grammar_file\n");
+  exit(1);
+}
 
-  if (argc < 2) {
-    fprintf(stderr, "Usage: parser grammar_file [parse_file]\n");
-    exit(1);
+int main(int argc, char* argv[])
+{
+  int opt;
+  int backtrack_only = 0;
+  int packrat = 0;
+  long cache_mb = MEMO_DEFAULT_MB;
+  const char* tree_out = NULL;
+  const char* tree_in = NULL;
+
+  while ((opt = getopt(argc, argv, "bpm:o:t:")) != -1) {
+    switch (opt) {
+      case 'b':
+        backtrack_only = 1;
+        break;
+      case 'p':
+        packrat = 1;
+        break;
+      case 'm':
+        cache_mb = atol(optarg);
+        break;
+      case 'o':
+        tree_out = optarg;
+        break;
+      case 't':
+        tree_in = optarg;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc) {
+    usage();
   }
 
-  FILE* grammar_f;
-  if (!(grammar_f = fopen(argv[1], "r"))) {
-    fprintf(stderr, "Error: can't open file '%s'\n", argv[1]);
-    exit(1);
+  // a grammar file written by grammarc is mmap'd, a text one is compiled
+  Grammar* g = Grammar_open(argv[optind]);
+
+  // a tree written with -o before is mapped and printed without parsing
+  if (tree_in != NULL) {
+    TreeFile* file = TreeFile_map(tree_in, g);
+    Tree* flat = TreeFile_read(file);
+    Tree_print(flat, g);
+    Tree_free(flat);
+    TreeFile_free(file);
+    Grammar_free(g);
+    return 0;
   }
 
-  int num_read = fread(file_contents, sizeof(char), FSIZE, stdin);
-  file_contents[num_read] = '\0';
+  // the input is mmap'd if it is a file, otherwise read from stdin
+  tok_reader* reader = reader_open((optind + 1 < argc) ? argv[optind + 1] : NULL);
 
-  symbol_l* sym_list = generate_grammar_map(grammar_f);
+  symbol_l* sym_list = generate_grammar_map(g);
   //print_grammar_map(sym_list);
+  symbol_l* root = sym_list;
+  while (root->sym->id != g->start - g->num_terms)
+    root = root->next;
+
+  // with -b every non-terminal tries its rules in order like before,
+  // otherwise only the ones with LL(1) conflicts do
+  ll1_table* table = NULL;
+  if (!backtrack_only) {
+    table = generate_ll1_table(g, sym_list);
+    print_ll1_conflicts(table);
+  }
 
-  ptree_node* tree = parse_tree_gen(file_contents, sym_list);
-  cleanup_tree(tree, sym_list);
-  print_tree(tree);
-  free_tree(tree);
-
+  // the packrat cache remembers where a non-terminal matched (or didn't)
+  // so backtracking never has to parse the same thing twice
+  memo_table* memo = NULL;
+  if (packrat)
+    memo = generate_memo_table(cache_mb << 20, table != NULL);
+
+  // the whole tree is allocated from one arena while parsing, only the
+  // flat copy of it is kept
+  arena* tree_arena = generate_arena();
+  tok_stream* in = generate_tok_stream(reader, g);
+  ptree_node* tree = parse_tree_gen(in, root->sym, table, memo, tree_arena);
+  Tree* flat = flatten_tree(tree, g);
+  free_arena(tree_arena);
+  if (tree_out != NULL)
+    Tree_write(flat, g, tree_out);
+  Tree_print(flat, g);
+  Tree_free(flat);
+
+  if (memo != NULL) {
+    fprintf(stderr, "packrat cache: %d entries, %ld hits, %ld kB\n",
+        memo->size, memo->hits, memo->bytes >> 10);
+    free_memo_table(memo);
+  }
+  if (table != NULL)
+    free_ll1_table(table);
   free_grammar_map(sym_list);
-
-  fclose(grammar_f);
+  free_tok_stream(in);
+  reader_close(reader);
+  Grammar_free(g);
 }
 
 
 
-node_l* push_node(node_l* list, ptree_node* node)
+node_l* push_node(node_l* list, ptree_node* node, arena* a)
 {
-  node_l* new = malloc(sizeof(node_l));
+  node_l* new = arena_alloc(a, sizeof(node_l));
   new->node = node;
   new->next = list;
   return new;
@@ -140,114 +126,219 @@ ptree_node* pop_node(node_l** stack)
   if (*stack == NULL) {
     return NULL;
   }
+  // the entry stays in the arena so the stack can be restored from a mark
   ptree_node* out = (*stack)->node;
-  node_l* next = (*stack)->next;
-  free(*stack);
-  *stack = next;
+  *stack = (*stack)->next;
   return out;
 }
 
-ptree_edge* insert_edge(ptree_edge* edge, ptree_node* node)
+ptree_edge* insert_edge(ptree_edge* edge, ptree_node* node, arena* a)
 {
-  ptree_edge* new = malloc(sizeof(ptree_edge));
+  ptree_edge* new = arena_alloc(a, sizeof(ptree_edge));
   new->node = node;
   new->next = edge;
   return new;
 }
 
-ptree_node* gen_ptree_node(symbol* sym, ptree_node* parent)
+ptree_node* gen_ptree_node(symbol* sym, ptree_node* parent, arena* a)
 {
-  ptree_node* out = malloc(sizeof(ptree_node));
+  ptree_node* out = arena_alloc(a, sizeof(ptree_node));
   out->next_rule = sym->prod_l;
-  out->name = strdup(sym->name);
+  out->name = sym->name;
+  out->sym = sym;
+  out->term_id = -1;
+  out->pending = -1;
+  out->memo_copy = NULL;
+  out->is_memo = 0;
+  out->in_conflict = sym->ll1_conflict ||
+    (parent != NULL && parent->in_conflict);
   out->parent = parent;
   if (parent != NULL)
-    parent->edge_l = insert_edge(parent->edge_l, out);
+    parent->edge_l = insert_edge(parent->edge_l, out, a);
   out->edge_l = NULL;
   return out;
 }
 
 
-ptree_node* gen_ptree_node_for_terminal(const char* name, ptree_node* parent)
+ptree_node* gen_ptree_node_for_terminal(const char* name, int term_id,
+    ptree_node* parent, arena* a)
 {
-  ptree_node* out = malloc(sizeof(ptree_node));
+  ptree_node* out = arena_alloc(a, sizeof(ptree_node));
   out->next_rule = NULL;
-  out->name = strdup(name);
+  out->name = name;
+  out->sym = NULL;
+  out->term_id = term_id;
+  out->pending = -1;
+  out->memo_copy = NULL;
+  out->is_memo = 0;
+  out->in_conflict = (parent != NULL && parent->in_conflict);
   out->parent = parent;
   out->edge_l = NULL;
   // insert as child of parent node
   if (parent != NULL)
-    parent->edge_l = insert_edge(parent->edge_l, out);
+    parent->edge_l = insert_edge(parent->edge_l, out, a);
   return out;
 }
 
-ptree_node* parse_tree_gen(const char* in, symbol_l* sym_list)
+// next rule to try for non-terminal node 'focus' or NULL if there is none
+// non-terminals without LL(1) conflicts only get the one rule the table
+// predicts for the lookahead so they are never tried again
+static prod_rule* next_rule(ptree_node* focus, int tok, ll1_table* table)
+{
+  prod_rule* out;
+
+  if (table == NULL || focus->sym->ll1_conflict) {
+    if (focus->next_rule == NULL)
+      return NULL;
+    out = focus->next_rule->rule;
+    focus->next_rule = focus->next_rule->next;
+    return out;
+  }
+  focus->next_rule = NULL;
+  return ll1_predict(table, focus->sym, tok);
+}
+
+// 'node' matched everything up to 'end', which completes its parent too if
+// it was the last child that was still missing
+static void node_matched(ptree_node* node, long end, memo_table* memo)
+{
+  while (node != NULL) {
+    memo_copy_node(memo, node);
+    if (node->sym != NULL && node->memo_copy != NULL)
+      memo_store(memo, node->sym, node->idx_old, end, node->memo_copy);
+    node = node->parent;
+    if (node == NULL || --node->pending > 0)
+      break;
+  }
+}
+
+// use the cached subtree 'tree' as the children of 'node'
+static void attach_memo(ptree_node* node, ptree_node* tree, arena* a)
+{
+  ptree_edge* iter;
+  ptree_edge** last = &node->edge_l;
+
+  for (iter = tree->edge_l; iter != NULL; iter = iter->next) {
+    *last = insert_edge(NULL, iter->node, a);
+    last = &(*last)->next;
+  }
+  node->next_rule = NULL;
+  node->pending = 0;
+  node->memo_copy = tree;
+}
+
+// Backtracking goes back to the closest parent that has rules left to try so
+// no token before the topmost one of them is read again.
+static long backtrack_horizon(ptree_node* focus, long idx)
+{
+  if (focus != NULL && focus->parent != NULL && focus->parent->horizon < idx)
+    return focus->parent->horizon;
+  return idx;
+}
+
+ptree_node* parse_tree_gen(tok_stream* in, symbol* root_sym, ll1_table* table,
+    memo_table* memo, arena* a)
 {
   ptree_node* root;
   ptree_node* focus;
   ptree_node* tmp_node;
-  ptree_edge* tmp_edge;
   node_l* stack;
   prod_rule* rule;
   symbol* sym_tmp;
   int i;
-  char word[TOK_LEN], word_old[TOK_LEN];
-  int isend;
-  int idx, idx_old;
+  int tok; // terminal id of the lookahead
+  long idx; // token index of the lookahead
+  long next_release; // token index at which to release the input again
+  memo_entry* hit;
 
 
   stack = NULL;
-  root = gen_ptree_node(sym_list->sym, NULL); // generate root node with no parent
+  root = gen_ptree_node(root_sym, NULL, a); // generate root node with no parent
   root->idx_old = 0;
   focus = root;
-  idx_old = 0;
-  idx = get_token_from_string(in, word, &isend);
-  strcpy(word_old, word);
+  idx = 0;
+  tok = tok_at(in, 0);
+  next_release = TOK_BLOCK_SIZE / 2;
   while (1) {
-    if (isend && focus == NULL) {
+    // only non-terminals that are not being tried already can be looked up
+    hit = NULL;
+    if (memo != NULL && focus != NULL && focus->sym != NULL &&
+        focus->pending == -1)
+      hit = memo_lookup(memo, focus->sym, focus->idx_old);
+
+    if (focus == NULL && tok == TOK_EOF) {
       return root;
-    } if (focus != NULL && !(is_terminal(focus->name, sym_list))) {
-      rule = focus->next_rule->rule;
-      focus->next_rule = focus->next_rule->next;
+    } if (hit != NULL && hit->end >= 0) {
+      attach_memo(focus, hit->tree, a);
+      node_matched(focus, hit->end, memo);
+      idx = hit->end;
+      tok = tok_at(in, idx);
+
+      focus = pop_node(&stack);
+      if (focus != NULL)
+        focus->idx_old = idx;
+
+    } else if (focus != NULL && focus->sym != NULL && hit == NULL &&
+        (rule = next_rule(focus, tok, table)) != NULL) {
+      focus->pending = rule->num_symbols;
+      // the rules left to try can't change while the children are parsed
+      focus->horizon = (focus->parent != NULL) ? focus->parent->horizon :
+        LONG_MAX;
+      if (focus->next_rule != NULL && focus->idx_old < focus->horizon)
+        focus->horizon = focus->idx_old;
+      focus->mark = arena_get_mark(a);
+      focus->stack_mark = stack;
       if (rule->num_symbols == 0) {
+        if (memo != NULL)
+          node_matched(focus, idx, memo);
         focus = pop_node(&stack);
         if (focus != NULL)
-          focus->idx_old = idx_old;
+          focus->idx_old = idx;
         continue;
       }
 
       // put all symbols except the first one onto the stack
       for (i = rule->num_symbols-1; i >= 1; i--) {
-        sym_tmp = get_symbol_by_name(sym_list, rule->sym_l[i]);
+        sym_tmp = rule->syms[i];
         if (sym_tmp == NULL) { // terminals will not be in the symbol list
                                // insert them as literals
-          tmp_node = gen_ptree_node_for_terminal(rule->sym_l[i], focus);
+          tmp_node = gen_ptree_node_for_terminal(rule->sym_l[i],
+              rule->ids[i], focus, a);
         } else {
-          tmp_node = gen_ptree_node(sym_tmp, focus);
+          tmp_node = gen_ptree_node(sym_tmp, focus, a);
         }
-        stack = push_node(stack, tmp_node);
+        stack = push_node(stack, tmp_node, a);
       }
 
       // has to have at least one symbol
       // choose first symbol in production rule as new focus
-      sym_tmp = get_symbol_by_name(sym_list, rule->sym_l[0]);
+      sym_tmp = rule->syms[0];
       if (sym_tmp == NULL) {
-        focus = gen_ptree_node_for_terminal(rule->sym_l[0], focus);
+        focus = gen_ptree_node_for_terminal(rule->sym_l[0], rule->ids[0],
+            focus, a);
       } else {
-        focus = gen_ptree_node(sym_tmp, focus);
+        focus = gen_ptree_node(sym_tmp, focus, a);
       }
-      focus->idx_old = idx_old;
+      focus->idx_old = idx;
 
-    } else if (focus != NULL && strcmp(focus->name, word) == 0) {
-      strcpy(word_old, word);
-      idx_old = idx;
-      idx += get_token_from_string(in + idx, word, &isend);
+    } else if (focus != NULL && focus->sym == NULL && focus->term_id == tok) {
+      tok = tok_at(in, ++idx);
+      if (memo != NULL)
+        node_matched(focus, idx, memo);
 
       focus = pop_node(&stack);
       if (focus != NULL)
-        focus->idx_old = idx_old;
+        focus->idx_old = idx;
+
+      if (idx >= next_release) {
+        tok_release(in, backtrack_horizon(focus, idx));
+        next_release = idx + TOK_BLOCK_SIZE / 2;
+      }
 
     } else {
+      // a non-terminal gets here if no rule is predicted for the lookahead
+      if (memo != NULL && focus != NULL && focus->sym != NULL)
+        memo_store(memo, focus->sym, focus->idx_old, -1, NULL);
       do {
         if (focus != NULL) {
           focus = focus->parent;
@@ -256,137 +347,75 @@ ptree_node* parse_tree_gen(const char* in, symbol_l* sym_list)
           fprintf(stderr, "Parsing error. Exiting...\n");
           exit(1);
         }
+        // no rule left to try so this non-terminal can't match here
+        if (memo != NULL && focus->next_rule == NULL)
+          memo_store(memo, focus->sym, focus->idx_old, -1, NULL);
+      } while (focus->next_rule == NULL);
 
-        for (tmp_edge = focus->edge_l->next; tmp_edge != NULL; tmp_edge = tmp_edge->next) {
-          stack = remove_from_node_list(stack, tmp_edge->node);
-        }
-        free_edges(focus->edge_l);
-        focus->edge_l = NULL;
+      // drop everything that was built since focus was expanded, its
+      // children are the last thing that was pushed onto the stack
+      arena_reset(a, focus->mark);
+      stack = focus->stack_mark;
+      focus->edge_l = NULL;
 
-        if (focus == NULL) {
-          fprintf(stderr, "Matching error: could not match input with grammar\n");
-          exit(1);
-        }
-      } while (focus->next_rule == NULL);
       idx = focus->idx_old;
-      idx_old = idx;
-      idx += get_token_from_string(in + idx, word, &isend);
+      tok = tok_at(in, idx);
     }
   }
-  free_node_list(stack);
   return root;
 }
 
-void cleanup_tree(ptree_node* root, symbol_l* sym_list)
+// The tree in postorder as a flat Tree. Non-terminals that derived the empty
+// string are left out unless they are the first child. The walk keeps its
+// own stack of the nodes whose children are not done yet.
+Tree* flatten_tree(ptree_node* root, Grammar* g)
 {
-  ptree_edge* tmp_edge;
-  ptree_edge* prev_edge;
-  ptree_edge* next_edge;
-
-  prev_edge = root->edge_l;
-  // it can't be the first node since there has to be at least one child
-  // per non-terminal node and for terminal nodes there are no children
-  // to remove
-  if (root->edge_l != NULL) {
-    cleanup_tree(root->edge_l->node, sym_list);
-    for (tmp_edge = root->edge_l->next; tmp_edge != NULL; tmp_edge = next_edge) {
-      next_edge = tmp_edge->next;
-      if (tmp_edge->node->edge_l == NULL
-          && !(is_terminal(tmp_edge->node->name, sym_list))) {
-        // remove this item from the children's list
-        free(tmp_edge->node->name);
-        free(tmp_edge->node);
-        free(tmp_edge);
-        prev_edge->next = next_edge;
-      } else {
-        cleanup_tree(tmp_edge->node, sym_list);
-        prev_edge = tmp_edge;
-      }
+  Tree* out = Tree_construct(0);
+  int capacity = TREE_INIT_CAP;
+  tree_frame* frames = malloc(capacity * sizeof(tree_frame));
+  tree_frame* top;
+  ptree_edge* edge;
+  ptree_node* kid;
+  int num_frames = 1;
+  long tok = 0;
+
+  frames[0].node = root;
+  frames[0].next = root->edge_l;
+  frames[0].start = 0;
+  frames[0].num_kids = 0;
+  while (num_frames > 0) {
+    top = &frames[num_frames - 1];
+    if (top->next == NULL) {
+      Tree_add(out, top->node->sym->id + g->num_terms, top->start, tok,
+          top->num_kids);
+      num_frames--;
+      continue;
     }
-  }
-}
 
-void print_tree(ptree_node* top)
-{
-  ptree_edge* tmp_edge;
-  
-  if (top != NULL) {
-    printf("Node: %s\n", top->name);
-    for (tmp_edge = top->edge_l; tmp_edge != NULL; tmp_edge = tmp_edge->next) {
-      printf("Child node: %s\n", tmp_edge->node->name);
+    edge = top->next;
+    top->next = edge->next;
+    kid = edge->node;
+    if (edge != top->node->edge_l && kid->sym != NULL && kid->edge_l == NULL)
+      continue;
+    top->num_kids++;
+    if (kid->sym == NULL) {
+      Tree_add(out, kid->term_id, tok, tok + 1, 0);
+      tok++;
+      continue;
     }
-    // do recursion in separate loop to first print all child nodes
-    // which is easier to understand
-    for (tmp_edge = top->edge_l; tmp_edge != NULL; tmp_edge = tmp_edge->next) {
-      print_tree(tmp_edge->node);
-    }
-  }
-}
 
-// this will not free the node pointed to by the list entry
-node_l* remove_from_node_list(node_l* list, ptree_node* node)
-{
-  node_l* out;
-  if (list == NULL) {
-    return NULL;
-  } else if (list->node == node) {
-    out = list->next;
-    free(list);
-    return out;
-  } else {
-    out = list;
-    for (list = out; list->next != NULL; list = list->next) {
-      if (list->next->node == node) {
-        free(list->next);
-        list->next = list->next->next;
-        return out;
-      }
+    if (num_frames == capacity) {
+      capacity *= 2;
+      frames = realloc(frames, capacity * sizeof(tree_frame));
     }
-    return out; // if no match was found
+    top = &frames[num_frames++];
+    top->node = kid;
+    top->next = kid->edge_l;
+    top->start = tok;
+    top->num_kids = 0;
   }
-}
-
-
-void free_node_list(node_l* list)
-{
-  node_l* next;
-  for (; list != NULL; list = next) {
-    next = list->next;
-    free_tree(list->node);
-    free(list);
-  }
-}
-
-void free_edges(ptree_edge* edge)
-{
-  ptree_edge* next_edge;
-
-  for (; edge != NULL; edge = next_edge) {
-    next_edge = edge->next;
-    free_tree(edge->node);
-    free(edge);
-  }
-}
-
-
-void free_tree(ptree_node* top)
-{
-  if (top != NULL) {
-    free_edges(top->edge_l);
-    free(top->name);
-    free(top);
-  }
-}
-
-// check if symbol with name 'name' is in the symbol list 'list'
-symbol* get_symbol_by_name(symbol_l* list, const char* name)
-{
-  symbol_l* iter;
-  for (iter = list; iter != NULL; iter = iter->next) {
-    if (strcmp(iter->sym->name, name) == 0)
-      return iter->sym;
-  }
-  return NULL;
+  free(frames);
+  return out;
 }
 
 prod_rule* get_prod_rule_by_idx(prod_rule_l* list, int idx)
@@ -426,13 +455,9 @@ void print_prod_rule_list(prod_rule_l* list)
 void free_prod_l(prod_rule_l* prod_l)
 {
   prod_rule_l* next;
-  int i;
 
   for (; prod_l != NULL; prod_l = next) {
     next = prod_l->next;
-    for (i = 0; i < prod_l->rule->num_symbols; i++) {
-      free(prod_l->rule->sym_l[i]);
-    }
     free(prod_l->rule);
     free(prod_l);
   }
@@ -444,7 +469,6 @@ void free_grammar_map(symbol_l* gmap)
   for (; gmap != NULL; gmap = next) {
     next = gmap->next;
     free_prod_l(gmap->sym->prod_l);
-    free(gmap->sym->name);
     free(gmap->sym);
     free(gmap);
   }
@@ -452,171 +476,71 @@ void free_grammar_map(symbol_l* gmap)
 
 
 // initialize symbol with no production rules
-symbol* generate_symbol(char* name)
+symbol* generate_symbol(const char* name)
 {
   symbol* out = malloc(sizeof(symbol));
-  out->name = strdup(name);
+  out->name = name;
   out->num_prod_rules = 0;
   out->prod_rule_sel = -1;
   out->prod_l = NULL;
+  out->id = -1;
+  out->ll1_conflict = 0;
   return out;
 }
 
-// initialize empty production rule
-prod_rule* generate_prod_rule()
+// production rule 'rule_idx' of the compiled grammar, the symbols are set
+// by generate_grammar_map
+prod_rule* generate_prod_rule(Grammar* g, int rule_idx)
 {
-  prod_rule* out = malloc(sizeof(prod_rule));
-  out->num_symbols = 0;
+  int n = g->rule_off[rule_idx + 1] - g->rule_off[rule_idx];
+  prod_rule* out = malloc(sizeof(prod_rule) +
+      n * (sizeof(symbol*) + sizeof(const char*)));
+
+  out->num_symbols = n;
+  out->ids = g->rhs + g->rule_off[rule_idx];
+  out->syms = (symbol**)(out + 1);
+  out->sym_l = (const char**)(out->syms + n);
   return out;
 }
 
-prod_rule_l* append_prod_rule_l(prod_rule_l* list, prod_rule* rule)
-{
-  prod_rule_l* last;
-  prod_rule_l* new = malloc(sizeof(prod_rule_l));
-  new->rule = rule;
-  new->next = NULL;
-
-  APPEND(list, last, new);
-}
-
-symbol_l* append_symbol_l(symbol_l* list, symbol* sym)
-{
-  symbol_l* last;
-  symbol_l* new = malloc(sizeof(symbol_l));
-  new->sym = sym;
-  new->next = NULL;
-  
-  APPEND(list, last, new);
-}
-
-
-void generate_prod_rule_list(FILE* g_file, symbol* sym)
-{
-  char token[TOK_LEN];
-  prod_rule* tmp_rule;
-  
-  sym->num_prod_rules = 0;
-  sym->prod_l = NULL;
-
-  tmp_rule = generate_prod_rule();
-
-  while (get_token(g_file, token) != EOF && token[strlen(token)-1] != ':') {
-    if (token[0] != '|') {
-      if (tmp_rule->num_symbols < MAX_TERMS_PER_RULE) {
-        tmp_rule->sym_l[tmp_rule->num_symbols++] = strdup(token);
-      } else {
-        fprintf(stderr, "Grammar parse error: exceeded maximum number of symbols"
-            "per production rule.\n"
-            "Can't be over '%d'\n", MAX_TERMS_PER_RULE);
-        exit(1);
-      }
-    } else {
-      sym->prod_l = append_prod_rule_l(sym->prod_l, tmp_rule);
-      sym->num_prod_rules++;
-      tmp_rule = generate_prod_rule();
-    }
-  }
-  sym->prod_l = append_prod_rule_l(sym->prod_l, tmp_rule);
-  sym->num_prod_rules++;
-  if (token[strlen(token)-1] == ':')
-    unget_token(g_file, token);
-}
-
-
-
-symbol_l* generate_grammar_map(FILE* g_file)
+symbol_l* generate_grammar_map(Grammar* g)
 {
-  char token[TOK_LEN];
-  symbol* tmp_sym;
+  int num_nonterms = g->num_syms - g->num_terms;
+  symbol** syms = malloc(num_nonterms * sizeof(symbol*));
   symbol_l* sym_list = NULL;
-  while (get_token(g_file, token) != EOF) {
-    if (token[strlen(token)-1] == ':') {
-      token[strlen(token)-1] = '\0';
-      tmp_sym = generate_symbol(token);
-      generate_prod_rule_list(g_file, tmp_sym);
-      sym_list = append_symbol_l(sym_list, tmp_sym);
-    } else {
-      fprintf(stderr, "syntax error: non-terminals must be defined with a"
-          "':' without spaces separating it from the non-terminal name\n");
-      exit(1);
-    }
-  }
-  return sym_list;
-}
-
-// check whether it is in given sym list
-int is_terminal(const char* token, symbol_l* sym_list)
-{
-  symbol_l* iter;
-  for (iter = sym_list; iter != NULL; iter = iter->next) {
-    if (strcmp(iter->sym->name, token) == 0)
-      return 0;
-  }
-  return 1;
-}
-
-// assume that all tokens are separated by spaces
-int get_token(FILE* in, char *buf)
-{
-  char in_c;
-  int buf_idx = 0;
-
-  while (isspace(in_c = fgetc(in))); // skip all whitespace characters
-
-  if (in_c == EOF)
-    return EOF;
-  else
-    buf[buf_idx++] = in_c;
-
-  do {
-    if (!isspace(in_c = fgetc(in)))
-      buf[buf_idx++] = in_c;
-    else
-      break;
-  } while (in_c != EOF);
-
-  buf[buf_idx] = '\0';
-  return (in_c == EOF) ? EOF : buf_idx;
-}
+  symbol_l* sym_new;
+  prod_rule_l* rule_new;
+  prod_rule* rule;
+  int i, r, s;
 
-// return the index of where inside in you are now or -1 for end of string
-int get_token_from_string(const char* in, char* buf, int* isend)
-{
-  int idx, buf_idx;
-
-  idx = -1;
-  buf_idx = 0;
-  while (isspace(in[++idx]));
-  if (in[idx] == '\0') {
-    *isend = 1;
-    return idx;
-  } else {
-    buf[buf_idx++] = in[idx];
+  for (i = 0; i < num_nonterms; i++) {
+    syms[i] = generate_symbol(Grammar_name(g, g->num_terms + i));
+    syms[i]->id = i;
   }
 
-  do {
-    if (!isspace(in[++idx]))
-      buf[buf_idx++] = in[idx];
-    else
-      break;
-  } while (in[idx] != '\0');
-
-  buf[buf_idx] = '\0';
-  *isend = (in[idx] == '\0') ? 1 : 0;
-  return idx;
-}
-
-void unget_token(FILE* in, char* token)
-{
-  if (ungetc(' ', in) == EOF) {
-    fprintf(stderr, "couldn't unget character ' '\n");
-    exit(1);
-  }
-  for (int i = strlen(token) - 1; i >= 0; i--) {
-    if (ungetc(token[i], in) == EOF) {
-      fprintf(stderr, "couldn't unget character '%c'\n", token[i]);
-      exit(1);
+  // the lists are built back to front so every item is just put in front,
+  // the rules point at the non-terminals they use right away and terminals
+  // keep their id from the compiled grammar
+  for (i = num_nonterms - 1; i >= 0; i--) {
+    s = g->num_terms + i;
+    for (r = g->sym_rules[s + 1] - 1; r >= g->sym_rules[s]; r--) {
+      rule = generate_prod_rule(g, r);
+      for (int j = 0; j < rule->num_symbols; j++) {
+        rule->syms[j] = GRAMMAR_IS_TERM(g, rule->ids[j]) ? NULL :
+          syms[rule->ids[j] - g->num_terms];
+        rule->sym_l[j] = Grammar_name(g, rule->ids[j]);
+      }
+      rule_new = malloc(sizeof(prod_rule_l));
+      rule_new->rule = rule;
+      rule_new->next = syms[i]->prod_l;
+      syms[i]->prod_l = rule_new;
+      syms[i]->num_prod_rules++;
     }
+    sym_new = malloc(sizeof(symbol_l));
+    sym_new->sym = syms[i];
+    sym_new->next = sym_list;
+    sym_list = sym_new;
   }
+  free(syms);
+  return sym_list;
 }
@@ -0,0 +1,210 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "grammar.h"
+#include "tree.h"
+
+#define TOK_INIT_LEN 64
+#define READ_BLOCK_SIZE 65536
+#define TOK_BLOCK_SIZE 4096
+#define MEMO_INIT_CAP 1024
+#define ARENA_CHUNK_SIZE 65536
+
+// token ids are the symbol ids of the terminals in the compiled grammar
+#define TOK_EOF GRAMMAR_END
+#define TOK_UNKNOWN -2 // a word that is not a terminal of the grammar
+#define MEMO_DEFAULT_MB 64
+
+typedef struct prod_rule {
+  int num_symbols;
+  const int* ids; // symbol ids in the compiled grammar, for a terminal that
+                  // is its terminal id
+  struct symbol** syms; // NULL for terminals
+  const char** sym_l; // names in the compiled grammar
+} prod_rule;
+
+typedef struct symbol {
+  const char* name;
+  int num_prod_rules;
+  int prod_rule_sel;
+  struct prod_rule_l* prod_l;
+  int id; // position in the grammar file
+  int ll1_conflict; // more than one rule for some lookahead, filled in by
+                    // generate_ll1_table
+} symbol;
+
+typedef struct prod_rule_l {
+  struct prod_rule* rule;
+  struct prod_rule_l* next;
+} prod_rule_l;
+
+// top level list containing one item for every non-terminal definition
+typedef struct symbol_l {
+  struct symbol* sym;
+  struct symbol_l* next;
+} symbol_l;
+
+typedef struct arena_chunk {
+  struct arena_chunk* next;
+  long size;
+  char data[];
+} arena_chunk;
+
+typedef struct arena {
+  struct arena_chunk* first;
+  struct arena_chunk* cur; // chunk that is allocated from
+  long used; // bytes used in cur
+} arena;
+
+typedef struct arena_mark {
+  struct arena_chunk* chunk;
+  long used;
+} arena_mark;
+
+
+typedef struct ptree_node {
+  const char* name; // owned by the compiled grammar
+  struct symbol* sym; // NULL for terminals
+  int term_id; // -1 for non-terminals
+  long idx_old; // index of the first token
+  long horizon; // first token that backtracking to it or a parent may read
+  int pending; // children that are not matched yet
+  struct ptree_node* memo_copy; // copy in the packrat cache once matched
+  int is_memo; // node belongs to the packrat cache and may be shared
+  int in_conflict; // the node or a parent has an LL(1) conflict
+  struct prod_rule_l* next_rule;
+  struct ptree_node* parent;
+  struct ptree_edge* edge_l;
+  // arena and pending stack from right before the node was expanded,
+  // trying its next rule goes back to them
+  arena_mark mark;
+  struct node_l* stack_mark;
+} ptree_node;
+
+typedef struct ptree_edge {
+  struct ptree_node* node;
+  struct ptree_edge* next;
+} ptree_edge;
+
+// a node of the pointer tree whose children are being flattened
+typedef struct tree_frame {
+  struct ptree_node* node;
+  struct ptree_edge* next; // next child to visit
+  long start; // token index of the first token
+  int num_kids; // children added to the flat tree
+} tree_frame;
+
+typedef struct node_l {
+  struct ptree_node* node;
+  struct node_l* next;
+} node_l;
+
+// LL(1) prediction table, the rule to use for non-terminal 'sym' with
+// lookahead terminal id 't' is rules[sym->id * num_terms + t]
+// terminal id TOK_EOF stands for the end of the input
+typedef struct ll1_table {
+  int num_terms;
+  int num_syms;
+  struct symbol** syms;
+  struct prod_rule** rules;
+} ll1_table;
+
+// packrat cache: the result of trying non-terminal 'sym_id' at token
+// index 'idx', either the index after it and its subtree or a failure
+typedef struct memo_entry {
+  int sym_id;
+  long idx;
+  long end; // -1 if the non-terminal can't be matched there
+  struct ptree_node* tree;
+} memo_entry;
+
+typedef struct memo_table {
+  memo_entry* entries; // open addressing, sym_id -1 marks an empty slot
+  int capacity;
+  int size;
+  struct ptree_node** nodes; // every node copied into the cache
+  int num_nodes;
+  int nodes_capacity;
+  long bytes;
+  long max_bytes; // nothing new is cached once this much memory is used
+  long hits;
+  int conflicts_only; // only non-terminals with an LL(1) conflict are cached
+} memo_table;
+
+// Input of the parser. Only the part from 'base' on is kept in memory, the
+// parser releases everything before the point it can backtrack to.
+// A file is mmap'd as a whole, stdin is read block by block.
+typedef struct tok_reader {
+  FILE* in; // NULL if the input is mmap'd
+  char* data;
+  long base; // input index of data[0]
+  long len; // bytes in data
+  long capacity; // size of data or of the whole mapping
+  int eof;
+} tok_reader;
+
+// Terminal ids of the input tokens, each token is lexed only once.
+// Like the characters in the reader only the tokens from 'base' on are kept.
+typedef struct tok_stream {
+  tok_reader* reader;
+  Grammar* g;
+  int* ids;
+  long base; // token index of ids[0]
+  long len;
+  long capacity;
+  long offset; // input index right after the last token in ids
+  int done; // the end of the input was reached
+  char* word; // characters of the token being lexed, grows with the tokens
+  int word_cap;
+} tok_stream;
+
+
+
+symbol* generate_symbol(const char* name);
+prod_rule* generate_prod_rule(Grammar* g, int rule_idx);
+symbol_l* generate_grammar_map(Grammar* g);
+void print_prod_rule_list(prod_rule_l* list);
+void print_grammar_map(symbol_l* gmap);
+
+void free_prod_l(prod_rule_l* prod_l);
+void free_grammar_map(symbol_l* gmap);
+
+prod_rule* get_prod_rule_by_idx(prod_rule_l* list, int idx);
+ptree_node* parse_tree_gen(tok_stream* in, symbol* root_sym, ll1_table* table,
+    memo_table* memo, arena* a);
+ptree_edge* insert_edge(ptree_edge* edge, ptree_node* node, arena* a);
+ptree_node* gen_ptree_node(symbol* sym, ptree_node* parent, arena* a);
+ptree_node* gen_ptree_node_for_terminal(const char* name, int term_id,
+    ptree_node* parent, arena* a);
+ptree_node* pop_node(node_l** stack);
+node_l* push_node(node_l* list, ptree_node* node, arena* a);
+Tree* flatten_tree(ptree_node* root, Grammar* g);
+
+arena* generate_arena();
+void* arena_alloc(arena* a, long size);
+arena_mark arena_get_mark(arena* a);
+void arena_reset(arena* a, arena_mark mark);
+void free_arena(arena* a);
+
+ll1_table* generate_ll1_table(Grammar* g, symbol_l* sym_list);
+prod_rule* ll1_predict(ll1_table* table, symbol* sym, int tok);
+void print_ll1_conflicts(ll1_table* table);
+void free_ll1_table(ll1_table* table);
+
+memo_table* generate_memo_table(long max_bytes, int conflicts_only);
+memo_entry* memo_lookup(memo_table* memo, symbol* sym, long idx);
+void memo_store(memo_table* memo, symbol* sym, long idx, long end,
+    ptree_node* tree);
+ptree_node* memo_copy_node(memo_table* memo, ptree_node* node);
+void free_memo_table(memo_table* memo);
+
+tok_reader* reader_open(const char* path);
+long reader_token(tok_reader* reader, long idx, char** buf, int* cap);
+void reader_release(tok_reader* reader, long idx);
+void reader_close(tok_reader* reader);
+tok_stream* generate_tok_stream(tok_reader* reader, Grammar* g);
+int tok_at(tok_stream* stream, long idx);
+void tok_release(tok_stream* stream, long idx);
+void free_tok_stream(tok_stream* stream);
+
+#endif
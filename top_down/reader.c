@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h> // for exit
+#include <ctype.h> // for isspace
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+
+// Windowed reader for the input of the parser
+//
+// The input is split into whitespace separated words once and every word is
+// translated to the terminal id it has in the grammar. The parser reads
+// these ids by token index so it can go back to any token it has not
+// released yet, and the characters of a word are released right after it
+// was read. Stdin is read into a buffer that only holds the bytes from the
+// last released index on, a file is mmap'd and released pages are given
+// back to the kernel.
+
+
+tok_reader* reader_open(const char* path)
+{
+  tok_reader* out = malloc(sizeof(tok_reader));
+  struct stat st;
+  int fd;
+
+  out->base = 0;
+  out->len = 0;
+
+  if (path == NULL) {
+    out->in = stdin;
+    out->capacity = READ_BLOCK_SIZE;
+    out->data = malloc(out->capacity);
+    out->eof = 0;
+    return out;
+  }
+
+  if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    fprintf(stderr, "Error: can't open file '%s'\n", path);
+    exit(1);
+  }
+  out->in = NULL;
+  out->data = NULL;
+  out->len = st.st_size;
+  out->capacity = st.st_size;
+  out->eof = 1;
+  // mmap refuses zero length mappings so empty files are just empty input
+  if (out->len > 0) {
+    out->data = mmap(NULL, out->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (out->data == MAP_FAILED) {
+      fprintf(stderr, "Error: can't mmap file '%s'\n", path);
+      exit(1);
+    }
+    madvise(out->data, out->len, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  return out;
+}
+
+// read the next block from stdin, returns 0 at the end of the input
+static int reader_fill(tok_reader* reader)
+{
+  size_t n;
+
+  if (reader->eof)
+    return 0;
+  if (reader->len == reader->capacity) {
+    reader->capacity *= 2;
+    reader->data = realloc(reader->data, reader->capacity);
+  }
+  n = fread(reader->data + reader->len, 1, reader->capacity - reader->len,
+      reader->in);
+  if (n == 0) {
+    reader->eof = 1;
+    return 0;
+  }
+  reader->len += n;
+  return 1;
+}
+
+// character at input index 'idx' or EOF
+static int reader_char(tok_reader* reader, long idx)
+{
+  if (idx < reader->base) {
+    fprintf(stderr, "Error: input index %ld was already released\n", idx);
+    exit(1);
+  }
+  while (idx - reader->base >= reader->len) {
+    if (!reader_fill(reader))
+      return EOF;
+  }
+  return (unsigned char)reader->data[idx - reader->base];
+}
+
+// Copy the token starting at or after input index 'idx' to '*buf', tokens
+// are separated by whitespace and can be of any length, '*buf' of '*cap'
+// bytes is grown to fit. Returns the number of bytes up to the end of the
+// token, '*buf' is empty at the end of the input.
+long reader_token(tok_reader* reader, long idx, char** buf, int* cap)
+{
+  int len = 0;
+  int c;
+  long i = idx;
+
+  while ((c = reader_char(reader, i)) != EOF && isspace(c))
+    i++;
+  while (c != EOF && !isspace(c)) {
+    if (len == *cap - 1) {
+      *cap *= 2;
+      *buf = realloc(*buf, *cap);
+    }
+    (*buf)[len++] = c;
+    c = reader_char(reader, ++i);
+  }
+  (*buf)[len] = '\0';
+  return i - idx;
+}
+
+// nothing before input index 'idx' will be read again
+void reader_release(tok_reader* reader, long idx)
+{
+  long n = idx - reader->base;
+  long page;
+
+  if (n <= 0)
+    return;
+  if (reader->in == NULL) {
+    // only whole pages can be dropped, they are read from the file again
+    // if they are ever touched
+    page = sysconf(_SC_PAGESIZE);
+    n -= n % page;
+    if (n > reader->len)
+      n = reader->len - reader->len % page;
+    if (n == 0)
+      return;
+    madvise(reader->data, n, MADV_DONTNEED);
+    reader->data += n;
+    reader->len -= n;
+    reader->base += n;
+    return;
+  }
+  if (n > reader->len)
+    n = reader->len;
+  memmove(reader->data, reader->data + n, reader->len - n);
+  reader->len -= n;
+  reader->base += n;
+}
+
+void reader_close(tok_reader* reader)
+{
+  if (reader->in == NULL) {
+    if (reader->capacity > 0)
+      munmap(reader->data - reader->base, reader->capacity);
+  } else {
+    free(reader->data);
+  }
+  free(reader);
+}
+
+
+tok_stream* generate_tok_stream(tok_reader* reader, Grammar* g)
+{
+  tok_stream* out = malloc(sizeof(tok_stream));
+  out->reader = reader;
+  out->g = g;
+  out->capacity = TOK_BLOCK_SIZE;
+  out->ids = malloc(out->capacity * sizeof(int));
+  out->base = 0;
+  out->len = 0;
+  out->offset = 0;
+  out->done = 0;
+  out->word_cap = TOK_INIT_LEN;
+  out->word = malloc(out->word_cap);
+  return out;
+}
+
+// lex the next token, its characters are not needed after that
+static void lex_next(tok_stream* stream)
+{
+  int id;
+
+  stream->offset += reader_token(stream->reader, stream->offset,
+      &stream->word, &stream->word_cap);
+  if (stream->offset - stream->reader->base >= READ_BLOCK_SIZE / 2)
+    reader_release(stream->reader, stream->offset);
+  if (stream->word[0] == '\0') {
+    stream->done = 1;
+    return;
+  }
+
+  if (stream->len == stream->capacity) {
+    stream->capacity *= 2;
+    stream->ids = realloc(stream->ids, stream->capacity * sizeof(int));
+  }
+  id = Grammar_find(stream->g, stream->word);
+  stream->ids[stream->len++] = (id > GRAMMAR_END &&
+      GRAMMAR_IS_TERM(stream->g, id)) ? id : TOK_UNKNOWN;
+}
+
+// terminal id of the token at token index 'idx' or TOK_EOF
+int tok_at(tok_stream* stream, long idx)
+{
+  if (idx < stream->base) {
+    fprintf(stderr, "Error: token %ld was already released\n", idx);
+    exit(1);
+  }
+  while (idx - stream->base >= stream->len) {
+    if (stream->done)
+      return TOK_EOF;
+    lex_next(stream);
+  }
+  return stream->ids[idx - stream->base];
+}
+
+// no token before token index 'idx' will be read again
+void tok_release(tok_stream* stream, long idx)
+{
+  long n = idx - stream->base;
+
+  if (n <= 0)
+    return;
+  if (n > stream->len)
+    n = stream->len;
+  memmove(stream->ids, stream->ids + n, (stream->len - n) * sizeof(int));
+  stream->len -= n;
+  stream->base += n;
+}
+
+void free_tok_stream(tok_stream* stream)
+{
+  free(stream->word);
+  free(stream->ids);
+  free(stream);
+}